@@ -2,8 +2,13 @@
 
 #include <algorithm>
 #include <functional>
+#include <optional>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "islutils/fingerprint.h"
 #include "islutils/locus.h"
 
 namespace matchers {
@@ -12,114 +17,47 @@ template <typename Container> size_t containerSize(Container &&c) {
   return std::distance(c.begin(), c.end());
 }
 
-// Check that, if two elements in "combination" correspond to the same values
-// in "folds", they are equal, and that they are unique within "combination"
-// otherwise.  Comparison is performed by calling the function objects
-// "eqCompare" and "neCompare" for equality and non-equality respectively.
-// While these operations are often reciprocal, this is not always the case,
-// for example in tri-state logic.
-// "folds" must be at least as large as "combination".
-template <typename T, typename EqComparator, typename NeComparator>
-bool areFoldsValid(const std::vector<T> &combination,
-                   const std::vector<size_t> &folds, EqComparator eqCompare,
-                   NeComparator neCompare) {
-  // Algorithmically not the most efficient way of finding duplicates, but
-  // removes the need to include hash-tables and/or perform additional
-  // allocations.
-  size_t size = combination.size();
-  if (size > folds.size()) {
-    ISLUTILS_DIE("folds are not properly set up");
+template <typename CandidatePayload, typename PatternPayload>
+Match<CandidatePayload, PatternPayload>::Match(
+    const PlaceholderSet<CandidatePayload, PatternPayload> &ps,
+    const std::vector<DimCandidate<CandidatePayload>> &combination) {
+  if (containerSize(ps) != combination.size()) {
+    ISLUTILS_DIE("expected the same number of placeholders and candidates");
   }
 
-  for (size_t i = 0; i < size; ++i) {
-    for (size_t j = i + 1; j < size; ++j) {
-      if (folds[i] == folds[j]) {
-        if (neCompare(combination.at(i), combination.at(j))) {
-          return false;
-        } else {
-          continue;
-        }
-      }
-      if (eqCompare(combination.at(i), combination.at(j))) {
-        return false;
-      }
-    }
+  size_t idx = 0;
+  for (const auto &candidate : combination) {
+    placeholderValues_.emplace_back(ps.placeholders_[idx++].id_, candidate);
   }
-  return true;
 }
 
-// All placeholders should get different assignments, except those that belong
-// to the same fold which should get equal assignments modulo matched map.
 template <typename CandidatePayload, typename PatternPayload>
-inline bool hasNoDuplicateAssignments(
-    const std::vector<DimCandidate<CandidatePayload>> &combination,
-    const PlaceholderSet<CandidatePayload, PatternPayload> &ps) {
-  return areFoldsValid(
-      combination, ps.placeholderFolds_,
-      [](const DimCandidate<CandidatePayload> &left,
-         const DimCandidate<CandidatePayload> &right) {
-        return left.isEqualModuloMap(right);
-      },
-      [](const DimCandidate<CandidatePayload> &left,
-         const DimCandidate<CandidatePayload> &right) {
-        return !left.isEqualModuloMap(right);
-      });
-}
+Match<CandidatePayload, PatternPayload>
+Match<CandidatePayload, PatternPayload>::rebound(
+    const PlaceholderSet<CandidatePayload, PatternPayload> &ps) const {
+  if (containerSize(ps) != placeholderValues_.size()) {
+    ISLUTILS_DIE("expected the same number of placeholders and candidates");
+  }
 
-// All placeholders in a group are either not yet matched, or matched the same
-// map.  A map matched in the group is not matched in any previous group.
-template <typename CandidatePayload, typename PatternPayload>
-bool groupsAreProperlyFormed(
-    const std::vector<DimCandidate<CandidatePayload>> &combination,
-    const PlaceholderSet<CandidatePayload, PatternPayload> &ps) {
-  std::vector<isl::space> previouslyMatchedSpaces;
-  for (const auto &group : ps.placeholderGroups_) {
-    isl::space matchedSpace;
-    // Ignore parts that are not yet matched.
-    for (size_t pos : group) {
-      if (pos >= combination.size()) {
-        continue;
-      }
-      auto candidateSpace = combination.at(pos).candidateMapSpace_;
-      if (matchedSpace) { // A group has already matched a map.
-        // If matched a different map, groups are not a match.
-        if (!matchedSpace.is_equal(candidateSpace)) {
-          return false;
-        }
-      } else { // First time a map is matched in the group.
-        matchedSpace = candidateSpace;
-        auto it = std::find(previouslyMatchedSpaces.begin(),
-                            previouslyMatchedSpaces.end(), matchedSpace);
-        // If the same map as one of the previously considered groups, groups
-        // are not a match.
-        if (it != previouslyMatchedSpaces.end()) {
-          return false;
-        }
-        previouslyMatchedSpaces.push_back(matchedSpace);
-      }
-    }
+  auto result = *this;
+  size_t idx = 0;
+  for (auto &kvp : result.placeholderValues_) {
+    kvp.first = ps.placeholders_[idx++].id_;
   }
-  return true;
+  return result;
 }
 
+// Group folds only exist in grouped placeholder sets.
 template <typename CandidatePayload, typename PatternPayload>
-bool PlaceholderSet<CandidatePayload, PatternPayload>::isSuitableCombination(
-    const std::vector<DimCandidate<CandidatePayload>> &combination) const {
-  return hasNoDuplicateAssignments(combination, *this) &&
-         groupsAreProperlyFormed(combination, *this);
+const std::vector<size_t> *
+groupFolds(const PlaceholderSet<CandidatePayload, PatternPayload> &) {
+  return nullptr;
 }
 
-template <typename CandidatePayload>
-static inline isl::space
-findSpace(const std::vector<size_t> &group,
-          const std::vector<DimCandidate<CandidatePayload>> &combination) {
-  for (auto idx : group) {
-    if (idx >= combination.size()) {
-      continue;
-    }
-    return combination.at(idx).candidateMapSpace_;
-  }
-  return isl::space();
+template <typename CandidatePayload, typename PatternPayload>
+const std::vector<size_t> *
+groupFolds(const PlaceholderGroupedSet<CandidatePayload, PatternPayload> &ps) {
+  return &ps.placeholderGroupFolds_;
 }
 
 // Handle both right-tagged and untagged access relation spaces,
@@ -138,32 +76,380 @@ static inline isl::id extractArrayId(isl::space accessSpace) {
   return rangeSpace.get_tuple_id(isl::dim::set);
 }
 
-// Compare if two groups (containing indexes of candidates in "combination")
-// matched the same array (if "equality" is set) or different arrays (if
-// "equality" is not set).  If it is impossible to determine the array that
-// matched at least one of the group, e.g., in case of partial combination,
-// return false for both equality and inequality checks.
-// Array ids are expected to be tuple ids of the rightmost set space in the
-// matched space.  Two absent ids are interpreted as equal since the
-// corresponding spaces are considered equal.  All groups are expected to match
-// exactly one space.
+// Hash of the tuple identifiers and dimensions of "space", looking into
+// wrapped spaces.  Parameters are ignored.  Equal spaces have equal hashes.
+inline uint64_t tupleHash(isl::space space) {
+  uint64_t hash = space.dim(isl::dim::set);
+  if (space.has_tuple_id(isl::dim::set)) {
+    combineHash(hash, isl_id_get_hash(space.get_tuple_id(isl::dim::set).get()));
+  }
+  if (space.is_wrapping()) {
+    auto wrapped = space.unwrap();
+    combineHash(hash, tupleHash(wrapped.domain()));
+    combineHash(hash, tupleHash(wrapped.range()));
+  }
+  return hash;
+}
+
+inline uint64_t mapSpaceHash(isl::space space) {
+  uint64_t hash = tupleHash(space.domain());
+  combineHash(hash, tupleHash(space.range()));
+  return hash;
+}
+
+// Numbering of the spaces of candidate maps and of the array ids they access,
+// see extractArrayId, so that they can be compared without calling isl.
+// Spaces and ids are looked up by hash, so only equal hashes are compared.
+class SpaceNumbering {
+public:
+  // Number of "space", numbered now if it was not yet.
+  size_t number(isl::space space) {
+    auto &bucket = spaceBuckets_[mapSpaceHash(space)];
+    for (auto n : bucket) {
+      if (spaces_[n].is_equal(space)) {
+        return n;
+      }
+    }
+    bucket.push_back(spaces_.size());
+    spaces_.push_back(space);
+    arrays_.push_back(numberArray(extractArrayId(space)));
+    return spaces_.size() - 1;
+  }
+
+  // Number of the array id accessed in the space numbered "spaceNumber".
+  size_t array(size_t spaceNumber) const { return arrays_[spaceNumber]; }
+
+private:
+  // Absent ids are equal to each other.
+  size_t numberArray(isl::id id) {
+    uint64_t hash = id.is_null() ? 0 : isl_id_get_hash(id.get());
+    auto &bucket = arrayBuckets_[hash];
+    for (auto n : bucket) {
+      if (arrayIds_[n] == id) {
+        return n;
+      }
+    }
+    bucket.push_back(arrayIds_.size());
+    arrayIds_.push_back(id);
+    return arrayIds_.size() - 1;
+  }
+
+  std::vector<isl::space> spaces_;
+  std::vector<size_t> arrays_;
+  std::unordered_map<uint64_t, std::vector<size_t>> spaceBuckets_;
+  std::vector<isl::id> arrayIds_;
+  std::unordered_map<uint64_t, std::vector<size_t>> arrayBuckets_;
+};
+
+// Candidate payloads may provide
+//   size_t candidateHash(const CandidatePayload &)
+// consistent with their equality, found by argument-dependent lookup.  Fold
+// validation then looks up equal candidates by hash instead of comparing
+// with all folds.
+template <typename CandidatePayload, typename = void>
+struct HasCandidateHash : std::false_type {};
+
 template <typename CandidatePayload>
-bool compareGroupsBelongToSameArray(
-    const std::vector<size_t> &group1, const std::vector<size_t> &group2,
-    const std::vector<DimCandidate<CandidatePayload>> &combination,
-    bool equality) {
-  // By this point, we should know that any placeholder in the group matched
-  // the same space.
-  isl::space space1 = findSpace(group1, combination);
-  isl::space space2 = findSpace(group2, combination);
-  // If one of the groups has no placeholder with assigned candidates, consider
-  // as different.
-  if (space1.is_null() || space2.is_null()) {
+struct HasCandidateHash<CandidatePayload,
+                        decltype((void)candidateHash(
+                            std::declval<const CandidatePayload &>()))>
+    : std::true_type {};
+
+// Incremental check of the constraints of "isSuitableCombination" of a
+// placeholder collection: placeholders in the same fold must be assigned
+// equal candidates and other placeholders different candidates; placeholders
+// in the same group must have matched the same map and placeholders in
+// different groups different maps; and, for grouped sets, groups in the same
+// group fold must have matched the same array and groups in different group
+// folds different arrays.
+//
+// Candidates are pushed for the placeholders in any order and popped in
+// reverse order.  Instead of comparing pairs of candidates, the validator
+// keeps, for each fold, its first assigned placeholder, for each group, the
+// space it matched, and, for each group fold, the array it matched, together
+// with the owner of each space and array.  Spaces and arrays are interned in
+// a SpaceNumbering.  Checking, pushing and popping a candidate thus take
+// constant time, except for the comparison of a candidate starting a new fold
+// with the candidates of the other folds, which is only constant on average
+// if the payload provides candidateHash.  Payload equality is expected to be
+// an equivalence relation.
+template <typename PlaceholderCollectionTy> class CombinationValidator {
+  using CandidateTy = typename PlaceholderCollectionTy::CandidateTy;
+
+public:
+  explicit CombinationValidator(const PlaceholderCollectionTy &ps);
+
+  // Number of "space", the space of a candidate map, to be passed to
+  // accepts() and push().
+  size_t spaceId(isl::space space) { return numbering_.number(space); }
+
+  // Number of placeholders with an assigned candidate.
+  size_t size() const { return pushed_.size(); }
+
+  // Whether "candidate", matching the space numbered "space", may be
+  // assigned to the unassigned placeholder at "pos".
+  bool accepts(size_t pos, const DimCandidate<CandidateTy> &candidate,
+               size_t space) const;
+  // Assign "candidate", which must be accepted, to the placeholder at "pos".
+  // The candidate is stored by reference until it is popped.
+  void push(size_t pos, const DimCandidate<CandidateTy> &candidate,
+            size_t space);
+  // Remove the last assignment.
+  void pop();
+
+private:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  bool isDuplicate(const DimCandidate<CandidateTy> &candidate) const;
+  static void setOwner(std::vector<size_t> &owners, size_t pos, size_t owner) {
+    if (pos >= owners.size()) {
+      owners.resize(pos + 1, npos);
+    }
+    owners[pos] = owner;
+  }
+  static size_t owner(const std::vector<size_t> &owners, size_t pos) {
+    return pos < owners.size() ? owners[pos] : npos;
+  }
+
+  const PlaceholderCollectionTy &ps_;
+  const std::vector<size_t> *groupFolds_;
+  // Group of each placeholder, or npos if it does not belong to any.
+  std::vector<size_t> groups_;
+  SpaceNumbering numbering_;
+
+  // Assigned candidate and its space, by placeholder, and placeholders in the
+  // order of assignment.
+  std::vector<const DimCandidate<CandidateTy> *> assigned_;
+  std::vector<size_t> spaces_;
+  std::vector<size_t> pushed_;
+
+  // Number of assigned placeholders in each fold and the first one.
+  std::vector<size_t> foldCounts_;
+  std::vector<size_t> foldFirsts_;
+  // First placeholders of the folds with assigned placeholders, by hash of
+  // their candidate if available.
+  std::unordered_multimap<size_t, size_t> foldsByHash_;
+  std::vector<size_t> activeFolds_;
+
+  // Number of assigned placeholders and matched space of each group, and the
+  // group owning each space.
+  std::vector<size_t> groupCounts_;
+  std::vector<size_t> groupSpaces_;
+  std::vector<size_t> spaceOwners_;
+
+  // Number of groups with assigned placeholders and matched array of each
+  // group fold, and the group fold owning each array.
+  std::vector<size_t> groupFoldCounts_;
+  std::vector<size_t> groupFoldArrays_;
+  std::vector<size_t> arrayOwners_;
+};
+
+template <typename PlaceholderCollectionTy>
+CombinationValidator<PlaceholderCollectionTy>::CombinationValidator(
+    const PlaceholderCollectionTy &ps)
+    : ps_(ps), groupFolds_(groupFolds(ps)) {
+  size_t size = containerSize(ps);
+  size_t nGroups = ps.placeholderGroups_.size();
+  if (size > ps.placeholderFolds_.size()) {
+    ISLUTILS_DIE("folds are not properly set up");
+  }
+  if (groupFolds_ && nGroups > groupFolds_->size()) {
+    ISLUTILS_DIE("folds are not properly set up");
+  }
+
+  groups_.assign(size, npos);
+  for (size_t g = 0; g < nGroups; ++g) {
+    for (size_t pos : ps.placeholderGroups_[g]) {
+      if (pos >= size) {
+        continue;
+      }
+      if (groups_[pos] != npos && groups_[pos] != g) {
+        ISLUTILS_DIE("placeholder belongs to multiple groups");
+      }
+      groups_[pos] = g;
+    }
+  }
+  size_t nFolds = 0;
+  for (size_t i = 0; i < size; ++i) {
+    nFolds = std::max(nFolds, ps.placeholderFolds_[i] + 1);
+  }
+
+  assigned_.assign(size, nullptr);
+  spaces_.assign(size, npos);
+  pushed_.reserve(size);
+  foldCounts_.assign(nFolds, 0);
+  foldFirsts_.assign(nFolds, npos);
+  groupCounts_.assign(nGroups, 0);
+  groupSpaces_.assign(nGroups, npos);
+  if (groupFolds_) {
+    groupFoldCounts_.assign(groupFolds_->size(), 0);
+    groupFoldArrays_.assign(groupFolds_->size(), npos);
+  }
+}
+
+template <typename PlaceholderCollectionTy>
+bool CombinationValidator<PlaceholderCollectionTy>::isDuplicate(
+    const DimCandidate<CandidateTy> &candidate) const {
+  if constexpr (HasCandidateHash<CandidateTy>::value) {
+    auto range = foldsByHash_.equal_range(candidateHash(candidate.payload_));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (assigned_[it->second]->isEqualModuloMap(candidate)) {
+        return true;
+      }
+    }
+  } else {
+    for (auto first : activeFolds_) {
+      if (assigned_[first]->isEqualModuloMap(candidate)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+template <typename PlaceholderCollectionTy>
+bool CombinationValidator<PlaceholderCollectionTy>::accepts(
+    size_t pos, const DimCandidate<CandidateTy> &candidate,
+    size_t space) const {
+  size_t fold = ps_.placeholderFolds_[pos];
+  if (foldCounts_[fold] != 0) {
+    if (!assigned_[foldFirsts_[fold]]->isEqualModuloMap(candidate)) {
+      return false;
+    }
+  } else if (isDuplicate(candidate)) {
     return false;
   }
-  isl::id id1 = extractArrayId(space1);
-  isl::id id2 = extractArrayId(space2);
-  return (id1 == id2) ^ !equality;
+
+  // The first placeholder of a group checks that no other group matched its
+  // space and that its array agrees with the group fold.  Other placeholders
+  // of the group check that they matched the same space.
+  size_t group = groups_[pos];
+  if (group == npos) {
+    return true;
+  }
+  if (groupCounts_[group] != 0) {
+    return groupSpaces_[group] == space;
+  }
+  if (owner(spaceOwners_, space) != npos) {
+    return false;
+  }
+  if (!groupFolds_) {
+    return true;
+  }
+  size_t groupFold = (*groupFolds_)[group];
+  size_t array = numbering_.array(space);
+  if (groupFoldCounts_[groupFold] != 0) {
+    return groupFoldArrays_[groupFold] == array;
+  }
+  return owner(arrayOwners_, array) == npos;
+}
+
+template <typename PlaceholderCollectionTy>
+void CombinationValidator<PlaceholderCollectionTy>::push(
+    size_t pos, const DimCandidate<CandidateTy> &candidate, size_t space) {
+  assigned_[pos] = &candidate;
+  spaces_[pos] = space;
+  pushed_.push_back(pos);
+
+  size_t fold = ps_.placeholderFolds_[pos];
+  if (foldCounts_[fold]++ == 0) {
+    foldFirsts_[fold] = pos;
+    if constexpr (HasCandidateHash<CandidateTy>::value) {
+      foldsByHash_.emplace(candidateHash(candidate.payload_), pos);
+    } else {
+      activeFolds_.push_back(pos);
+    }
+  }
+
+  size_t group = groups_[pos];
+  if (group == npos || groupCounts_[group]++ != 0) {
+    return;
+  }
+  groupSpaces_[group] = space;
+  setOwner(spaceOwners_, space, group);
+  if (!groupFolds_) {
+    return;
+  }
+  size_t groupFold = (*groupFolds_)[group];
+  if (groupFoldCounts_[groupFold]++ == 0) {
+    size_t array = numbering_.array(space);
+    groupFoldArrays_[groupFold] = array;
+    setOwner(arrayOwners_, array, groupFold);
+  }
+}
+
+template <typename PlaceholderCollectionTy>
+void CombinationValidator<PlaceholderCollectionTy>::pop() {
+  if (pushed_.empty()) {
+    ISLUTILS_DIE("no candidate to pop");
+  }
+
+  size_t pos = pushed_.back();
+  size_t fold = ps_.placeholderFolds_[pos];
+  if (--foldCounts_[fold] == 0) {
+    foldFirsts_[fold] = npos;
+    if constexpr (HasCandidateHash<CandidateTy>::value) {
+      auto range =
+          foldsByHash_.equal_range(candidateHash(assigned_[pos]->payload_));
+      for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == pos) {
+          foldsByHash_.erase(it);
+          break;
+        }
+      }
+    } else {
+      // Folds are deactivated in the reverse order of their activation.
+      activeFolds_.pop_back();
+    }
+  }
+
+  size_t group = groups_[pos];
+  if (group != npos && --groupCounts_[group] == 0) {
+    setOwner(spaceOwners_, groupSpaces_[group], npos);
+    groupSpaces_[group] = npos;
+    if (groupFolds_) {
+      size_t groupFold = (*groupFolds_)[group];
+      if (--groupFoldCounts_[groupFold] == 0) {
+        setOwner(arrayOwners_, groupFoldArrays_[groupFold], npos);
+        groupFoldArrays_[groupFold] = npos;
+      }
+    }
+  }
+
+  assigned_[pos] = nullptr;
+  spaces_[pos] = npos;
+  pushed_.pop_back();
+}
+
+// Check "combination", possibly incomplete, against the constraints of "ps".
+template <typename PlaceholderCollectionTy, typename CandidatePayload>
+bool isValidCombination(
+    const PlaceholderCollectionTy &ps,
+    const std::vector<DimCandidate<CandidatePayload>> &combination) {
+  if (combination.size() > containerSize(ps)) {
+    ISLUTILS_DIE("more candidates than placeholders");
+  }
+
+  CombinationValidator<PlaceholderCollectionTy> validator(ps);
+  for (size_t pos = 0; pos < combination.size(); ++pos) {
+    const auto &candidate = combination[pos];
+    size_t space = validator.spaceId(candidate.candidateMapSpace_);
+    if (!validator.accepts(pos, candidate, space)) {
+      return false;
+    }
+    validator.push(pos, candidate, space);
+  }
+  return true;
+}
+
+// All placeholders should get different assignments, except those that belong
+// to the same fold which should get equal assignments modulo matched map.
+// All placeholders in a group are either not yet matched, or matched the same
+// map.  A map matched in the group is not matched in any other group.
+template <typename CandidatePayload, typename PatternPayload>
+bool PlaceholderSet<CandidatePayload, PatternPayload>::isSuitableCombination(
+    const std::vector<DimCandidate<CandidatePayload>> &combination) const {
+  return isValidCombination(*this, combination);
 }
 
 // In addition to PlaceholderSet::isSuitableCombination checks for
@@ -174,109 +460,349 @@ template <typename CandidatePayload, typename PatternPayload>
 bool PlaceholderGroupedSet<CandidatePayload, PatternPayload>::
     isSuitableCombination(
         const std::vector<DimCandidate<CandidatePayload>> &combination) const {
-  return static_cast<const PlaceholderSet<CandidatePayload, PatternPayload> &>(
-             *this)
-             .isSuitableCombination(combination) &&
-         areFoldsValid(
-             this->placeholderGroups_, placeholderGroupFolds_,
-             [&combination](const std::vector<size_t> &group1,
-                            const std::vector<size_t> &group2) {
-               return compareGroupsBelongToSameArray(group1, group2,
-                                                     combination, true);
-             },
-             [&combination](const std::vector<size_t> &group1,
-                            const std::vector<size_t> &group2) {
-               return compareGroupsBelongToSameArray(group1, group2,
-                                                     combination, false);
-             });
+  return isValidCombination(*this, combination);
 }
 
-template <typename CandidatePayload, typename PatternPayload>
-Match<CandidatePayload, PatternPayload>::Match(
-    const PlaceholderSet<CandidatePayload, PatternPayload> &ps,
-    const std::vector<DimCandidate<CandidatePayload>> &combination) {
-  if (containerSize(ps) != combination.size()) {
-    ISLUTILS_DIE("expected the same number of placeholders and candidates");
+// Backtracking search for the combinations of candidates accepted by
+// "isSuitableCombination" of a placeholder collection.  When a candidate is
+// assigned to a placeholder, it is pushed into a CombinationValidator and the
+// candidates that the validator no longer accepts are removed from the lists
+// of the placeholders that are not assigned yet (forward checking).  Any
+// candidate that remains in a list is therefore compatible with all current
+// assignments and need not be checked again.  Unless matches must be visited
+// in order, the placeholder with the fewest remaining candidates is assigned
+// first.  Matches are returned in the same order as if candidates were
+// enumerated in the order of placeholders.
+template <typename PlaceholderCollectionTy> class CombinationSearch {
+  using CandidateTy = typename PlaceholderCollectionTy::CandidateTy;
+  using PatternTy = typename PlaceholderCollectionTy::PatternTy;
+
+public:
+  explicit CombinationSearch(const PlaceholderCollectionTy &ps);
+
+  // All matches.
+  Matches<CandidateTy, PatternTy> run();
+  // Number of matches, stopping at "limit".
+  size_t count(size_t limit);
+  // Call "visitor" on each match in turn until it returns false.  Placeholders
+  // are assigned in order rather than by the number of remaining candidates so
+  // that matches are visited in the order run() returns them.
+  template <typename Visitor> void visit(Visitor &&visitor);
+
+private:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  bool assign(size_t pos, size_t candidate);
+  void restore(size_t trailSize);
+  // Call "callback" on each complete assignment until it returns false.
+  // Return false if the search was stopped.
+  template <typename Callback>
+  bool search(size_t nAssigned, bool ordered, Callback &callback);
+  Match<CandidateTy, PatternTy>
+  makeMatch(const std::vector<size_t> &assignment) const;
+
+  const PlaceholderCollectionTy &ps_;
+  CombinationValidator<PlaceholderCollectionTy> validator_;
+
+  // spaceIds_[i][c] is the number of the space matched by candidate "c" of
+  // placeholder "i" in validator_.
+  std::vector<std::vector<size_t>> spaceIds_;
+
+  // The remaining candidates of placeholder "i" are the first
+  // domainSizes_[i] elements of domains_[i].  Removing a candidate swaps it
+  // past the end, so restoring the size restores the list.
+  std::vector<std::vector<size_t>> domains_;
+  std::vector<size_t> domainSizes_;
+  std::vector<std::pair<size_t, size_t>> trail_;
+
+  std::vector<size_t> assignment_;
+};
+
+template <typename PlaceholderCollectionTy>
+CombinationSearch<PlaceholderCollectionTy>::CombinationSearch(
+    const PlaceholderCollectionTy &ps)
+    : ps_(ps), validator_(ps) {
+  size_t size = containerSize(ps);
+  spaceIds_.resize(size);
+  domains_.resize(size);
+  domainSizes_.resize(size);
+  for (size_t i = 0; i < size; ++i) {
+    const auto &candidates = ps.placeholders_[i].candidates_;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+      const auto &space = candidates[c].candidateMapSpace_;
+      spaceIds_[i].push_back(validator_.spaceId(space));
+      domains_[i].push_back(c);
+    }
+    domainSizes_[i] = candidates.size();
   }
+  assignment_.assign(size, npos);
+}
 
-  size_t idx = 0;
-  for (const auto &candidate : combination) {
-    placeholderValues_.emplace_back(ps.placeholders_[idx++].id_, candidate);
+// Assign "candidate" to the placeholder at "pos" and remove candidates of
+// unassigned placeholders that are no longer accepted.  Return false if a
+// placeholder is left without candidates.  The changes to the lists are
+// recorded in trail_; the assignment is undone by popping the validator.
+template <typename PlaceholderCollectionTy>
+bool CombinationSearch<PlaceholderCollectionTy>::assign(size_t pos,
+                                                        size_t candidate) {
+  assignment_[pos] = candidate;
+  validator_.push(pos, ps_.placeholders_[pos].candidates_[candidate],
+                  spaceIds_[pos][candidate]);
+  for (size_t other = 0; other < assignment_.size(); ++other) {
+    if (assignment_[other] != npos) {
+      continue;
+    }
+    const auto &candidates = ps_.placeholders_[other].candidates_;
+    auto &domain = domains_[other];
+    size_t &domainSize = domainSizes_[other];
+    size_t oldSize = domainSize;
+    for (size_t i = 0; i < domainSize;) {
+      if (validator_.accepts(other, candidates[domain[i]],
+                             spaceIds_[other][domain[i]])) {
+        ++i;
+      } else {
+        std::swap(domain[i], domain[--domainSize]);
+      }
+    }
+    if (domainSize != oldSize) {
+      trail_.emplace_back(other, oldSize);
+    }
+    if (domainSize == 0) {
+      return false;
+    }
   }
+  return true;
 }
 
 template <typename PlaceholderCollectionTy>
-void recursivelyCheckCombinations(
-    const PlaceholderCollectionTy &ps,
-    std::vector<DimCandidate<typename PlaceholderCollectionTy::CandidateTy>>
-        partialCombination,
-    Matches<typename PlaceholderCollectionTy::CandidateTy,
-            typename PlaceholderCollectionTy::PatternTy> &suitableCandidates) {
+void CombinationSearch<PlaceholderCollectionTy>::restore(size_t trailSize) {
+  while (trail_.size() > trailSize) {
+    domainSizes_[trail_.back().first] = trail_.back().second;
+    trail_.pop_back();
+  }
+}
 
-  if (!ps.isSuitableCombination(partialCombination)) {
-    return;
+template <typename PlaceholderCollectionTy>
+template <typename Callback>
+bool CombinationSearch<PlaceholderCollectionTy>::search(size_t nAssigned,
+                                                        bool ordered,
+                                                        Callback &callback) {
+  if (nAssigned == assignment_.size()) {
+    return callback(assignment_);
   }
 
-  // The partial combination is known to be suitable. If it is also full, add
-  // it to the list and be done.
-  if (partialCombination.size() == containerSize(ps)) {
-    suitableCandidates.emplace_back(ps, partialCombination);
-    return;
+  size_t pos = npos;
+  for (size_t i = 0; i < assignment_.size(); ++i) {
+    if (assignment_[i] != npos) {
+      continue;
+    }
+    if (ordered) {
+      pos = i;
+      break;
+    }
+    if (pos == npos || domainSizes_[i] < domainSizes_[pos]) {
+      pos = i;
+    }
+  }
+
+  // The domain of an assigned placeholder is not modified by deeper levels,
+  // but removals may have permuted it.
+  const auto &domain = domains_[pos];
+  std::vector<size_t> sorted;
+  if (ordered) {
+    sorted.assign(domain.begin(), domain.begin() + domainSizes_[pos]);
+    std::sort(sorted.begin(), sorted.end());
+  }
+  bool proceed = true;
+  for (size_t i = 0; proceed && i < domainSizes_[pos]; ++i) {
+    size_t trailSize = trail_.size();
+    if (assign(pos, ordered ? sorted[i] : domain[i])) {
+      proceed = search(nAssigned + 1, ordered, callback);
+    }
+    restore(trailSize);
+    validator_.pop();
   }
+  assignment_[pos] = npos;
+  return proceed;
+}
 
-  // Otherwise, try adding one element to the combination and recurse.
-  auto pos = partialCombination.size();
-  for (const auto &candidate : ps.placeholders_[pos].candidates_) {
-    partialCombination.push_back(candidate);
-    recursivelyCheckCombinations(ps, partialCombination, suitableCandidates);
-    partialCombination.pop_back();
+template <typename PlaceholderCollectionTy>
+Match<typename PlaceholderCollectionTy::CandidateTy,
+      typename PlaceholderCollectionTy::PatternTy>
+CombinationSearch<PlaceholderCollectionTy>::makeMatch(
+    const std::vector<size_t> &assignment) const {
+  std::vector<DimCandidate<CandidateTy>> combination;
+  combination.reserve(assignment.size());
+  for (size_t i = 0; i < assignment.size(); ++i) {
+    combination.push_back(ps_.placeholders_[i].candidates_[assignment[i]]);
   }
+  return Match<CandidateTy, PatternTy>(ps_, combination);
 }
 
 template <typename PlaceholderCollectionTy>
 Matches<typename PlaceholderCollectionTy::CandidateTy,
         typename PlaceholderCollectionTy::PatternTy>
-suitableCombinations(const PlaceholderCollectionTy &ps) {
-  Matches<typename PlaceholderCollectionTy::CandidateTy,
-          typename PlaceholderCollectionTy::PatternTy>
-      result;
-  recursivelyCheckCombinations(ps, {}, result);
+CombinationSearch<PlaceholderCollectionTy>::run() {
+  std::vector<std::vector<size_t>> solutions;
+  auto collect = [&solutions](const std::vector<size_t> &assignment) {
+    solutions.push_back(assignment);
+    return true;
+  };
+  search(0, false, collect);
+
+  std::sort(solutions.begin(), solutions.end());
+  Matches<CandidateTy, PatternTy> result;
+  result.reserve(solutions.size());
+  for (const auto &solution : solutions) {
+    result.push_back(makeMatch(solution));
+  }
   return result;
 }
 
+template <typename PlaceholderCollectionTy>
+size_t CombinationSearch<PlaceholderCollectionTy>::count(size_t limit) {
+  size_t result = 0;
+  auto counter = [&result, limit](const std::vector<size_t> &) {
+    return ++result < limit;
+  };
+  if (limit > 0) {
+    search(0, false, counter);
+  }
+  return result;
+}
+
+template <typename PlaceholderCollectionTy>
+template <typename Visitor>
+void CombinationSearch<PlaceholderCollectionTy>::visit(Visitor &&visitor) {
+  auto callback = [this, &visitor](const std::vector<size_t> &assignment) {
+    return static_cast<bool>(visitor(makeMatch(assignment)));
+  };
+  search(0, true, callback);
+}
+
 template <typename PlaceholderCollectionTy>
 Matches<typename PlaceholderCollectionTy::CandidateTy,
         typename PlaceholderCollectionTy::PatternTy>
-match(isl::union_map access, PlaceholderCollectionTy ps) {
-  std::vector<isl::map> accesses;
-  access.foreach_map([&accesses](isl::map m) { 
-    accesses.push_back(m); 
+suitableCombinations(const PlaceholderCollectionTy &ps) {
+  return CombinationSearch<PlaceholderCollectionTy>(ps).run();
+}
+
+// Candidate payload classes may provide
+//   candidates(const DecomposedAccess &, const PatternPayload &)
+// to reuse the decomposition of access relations shared by all placeholders.
+// Otherwise, they are given the access relation itself.
+template <typename CandidatePayload, typename PatternPayload, typename = void>
+struct HasDecomposedCandidates : std::false_type {};
+
+template <typename CandidatePayload, typename PatternPayload>
+struct HasDecomposedCandidates<
+    CandidatePayload, PatternPayload,
+    decltype((void)CandidatePayload::candidates(
+        std::declval<const DecomposedAccess &>(),
+        std::declval<const PatternPayload &>()))> : std::true_type {};
+
+template <typename CandidatePayload, typename PatternPayload>
+std::vector<CandidatePayload> findCandidates(const DecomposedAccess &access,
+                                             const PatternPayload &pattern) {
+  if constexpr (HasDecomposedCandidates<CandidatePayload,
+                                        PatternPayload>::value) {
+    return CandidatePayload::candidates(access, pattern);
+  } else {
+    return CandidatePayload::candidates(access.map(), pattern);
+  }
+}
+
+// Stage 1 of matching: fill in the candidate lists for all placeholders.
+// Return false if one of the placeholders has no candidates.
+template <typename PlaceholderCollectionTy>
+bool collectCandidates(isl::union_map access, PlaceholderCollectionTy &ps) {
+  using CandidateTy = typename PlaceholderCollectionTy::CandidateTy;
+  using PatternTy = typename PlaceholderCollectionTy::PatternTy;
+
+  // Decompose each relation once for all placeholders.
+  std::vector<DecomposedAccess> accesses;
+  access.foreach_map([&accesses](isl::map m) {
+    accesses.emplace_back(m);
     return isl_stat_ok;
   });
 
-  // Stage 1: fill in the candidate lists for all placeholders.
   for (auto &ph : ps) {
-    for (auto acc : accesses) {
+    for (const auto &acc : accesses) {
       for (auto &&c :
-           PlaceholderCollectionTy::CandidateTy::candidates(acc, ph.pattern_)) {
-        ph.candidates_.emplace_back(c, acc.get_space());
+           findCandidates<CandidateTy, PatternTy>(acc, ph.pattern_)) {
+        ph.candidates_.emplace_back(c, acc.space());
       }
     }
     // Early exit if one of the placeholders has no candidates.
     if (ph.candidates_.empty()) {
-      return {};
+      return false;
     }
   }
+  return true;
+}
+
+// The functions below accept any source of accesses for which
+// collectCandidates is defined, i.e. an isl::union_map or an AccessIndex.
+template <typename Accesses, typename PlaceholderCollectionTy>
+Matches<typename PlaceholderCollectionTy::CandidateTy,
+        typename PlaceholderCollectionTy::PatternTy>
+match(const Accesses &access, PlaceholderCollectionTy ps) {
+  if (!collectCandidates(access, ps)) {
+    return {};
+  }
 
   // Stage 2: generate all combinations of values replacing the placeholders
   // while filtering incompatible ones immediately.
   return suitableCombinations(ps);
 }
 
+template <typename Accesses, typename PlaceholderCollectionTy>
+size_t matchCount(const Accesses &access, PlaceholderCollectionTy ps,
+                  size_t limit) {
+  if (!collectCandidates(access, ps)) {
+    return 0;
+  }
+  return CombinationSearch<PlaceholderCollectionTy>(ps).count(limit);
+}
+
+template <typename Accesses, typename PlaceholderCollectionTy>
+bool matchAny(const Accesses &access, PlaceholderCollectionTy ps) {
+  return matchCount(access, std::move(ps), 1) != 0;
+}
+
+template <typename Accesses, typename PlaceholderCollectionTy,
+          typename Visitor>
+void forEachMatch(const Accesses &access, PlaceholderCollectionTy ps,
+                  Visitor &&visitor) {
+  if (!collectCandidates(access, ps)) {
+    return;
+  }
+  CombinationSearch<PlaceholderCollectionTy>(ps).visit(
+      std::forward<Visitor>(visitor));
+}
+
+template <typename Accesses, typename PlaceholderCollectionTy>
+std::optional<Match<typename PlaceholderCollectionTy::CandidateTy,
+                    typename PlaceholderCollectionTy::PatternTy>>
+matchFirst(const Accesses &access, PlaceholderCollectionTy ps) {
+  std::optional<Match<typename PlaceholderCollectionTy::CandidateTy,
+                      typename PlaceholderCollectionTy::PatternTy>>
+      result;
+  forEachMatch(access, std::move(ps), [&result](const auto &m) {
+    result.emplace(m);
+    return false;
+  });
+  return result;
+}
+
+// Transform "map" according to the only replacement among "arg" and "args"
+// whose pattern matches it, and store the position of this replacement in
+// "replacementPos".  Return a null object if no replacement matches.
 template <typename CandidatePayload, typename PatternPayload, typename... Args>
 isl::map transformOneMap(
     isl::map map, const Match<CandidatePayload, PatternPayload> &oneMatch,
-    Replacement<CandidatePayload, PatternPayload> arg, Args... args) {
+    size_t &replacementPos, Replacement<CandidatePayload, PatternPayload> arg,
+    Args... args) {
   static_assert(
       std::is_same<
           typename std::common_type<
@@ -285,6 +811,7 @@ isl::map transformOneMap(
       "");
 
   isl::map result;
+  size_t pos = 0;
   for (const auto &rep : {arg, args...}) {
     // separability of matches is important!
     // if we match here something that we would not have matched with the whole
@@ -292,7 +819,8 @@ isl::map transformOneMap(
     // one of the groups in the set, we just don't know which one.  If it
     // matches two groups, this means the transformation would happen twice,
     // which we expicitly disallow.
-    if (match(isl::union_map(map), allOf(rep.pattern)).empty()) {
+    if (!matchAny(isl::union_map(map), allOf(rep.pattern))) {
+      ++pos;
       continue;
     }
     if (!result.is_null()) {
@@ -301,6 +829,7 @@ isl::map transformOneMap(
     }
     // Actual transformation.
     result = map;
+    replacementPos = pos++;
     for (const auto &plh : rep.replacement) {
       result = CandidatePayload::transformMap(result, oneMatch[plh].payload(),
                                               plh.pattern_);
@@ -310,9 +839,10 @@ isl::map transformOneMap(
 }
 
 template <typename CandidatePayload, typename PatternPayload, typename... Args>
-isl::union_map findAndReplace(isl::union_map umap,
-                              Replacement<CandidatePayload, PatternPayload> arg,
-                              Args... args) {
+ReplacementReport
+findAndReplaceReport(isl::union_map umap,
+                     Replacement<CandidatePayload, PatternPayload> arg,
+                     Args... args) {
   static_assert(
       std::is_same<
           typename std::common_type<
@@ -320,21 +850,32 @@ isl::union_map findAndReplace(isl::union_map umap,
           Replacement<CandidatePayload, PatternPayload>>::value,
       "");
 
-  // make a vector of maps
-  // for each match,
+  // Index the maps by the hash of their space.  A union contains at most one
+  // map per space, so a lookup only compares spaces within one bucket.
+  // For each match,
   //   find all corresponding maps,
-  //     if not found, the map was deleted already meaning there was an attempt
-  //     of double transformation
-  //   remove them from vector,
-  //   transform them and
-  //   add them to the resulting vector
-  // finally, copy all the remaining original maps as is into result
-
-  std::vector<isl::map> originalMaps, transformedMaps;
-  umap.foreach_map([&originalMaps](isl::map m) { 
-    originalMaps.push_back(m); 
+  //     if already transformed, there was an attempt of double
+  //     transformation,
+  //   transform them.
+  // Finally, add all maps, transformed or not, to the result at once.
+  std::vector<isl::map> maps;
+  std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+  umap.foreach_map([&maps, &buckets](isl::map m) {
+    buckets[mapSpaceHash(m.get_space())].push_back(maps.size());
+    maps.push_back(m);
     return isl_stat_ok;
   });
+  auto find = [&maps, &buckets](isl::space space) {
+    auto bucket = buckets.find(mapSpaceHash(space));
+    if (bucket != buckets.end()) {
+      for (auto i : bucket->second) {
+        if (maps[i].get_space().is_equal(space)) {
+          return i;
+        }
+      }
+    }
+    return maps.size();
+  };
 
   auto getPattern =
       [](const Replacement<CandidatePayload, PatternPayload> &replacement) {
@@ -342,54 +883,56 @@ isl::union_map findAndReplace(isl::union_map umap,
       };
 
   auto ps = allOf(getPattern(arg), getPattern(args)...);
-  auto matches = match(umap, ps);
+  std::vector<bool> isTransformed(maps.size(), false);
+  ReplacementReport report;
+  report.nTransformed.assign(1 + sizeof...(Args), 0);
+  std::vector<size_t> toTransform;
 
-  for (const auto &m : matches) {
-    std::vector<isl::map> toTransform;
+  forEachMatch(umap, ps, [&](const Match<CandidatePayload, PatternPayload> &m) {
+    toTransform.clear();
     for (const auto &plh : ps.placeholders_) {
-      auto spaces = m[plh].candidateSpaces();
-      for (auto candidate : spaces) {
-        auto found = std::find_if(toTransform.begin(), toTransform.end(),
-                                  [candidate](isl::map map) {
-                                    return map.get_space().is_equal(candidate);
-                                  });
-        if (found != toTransform.end()) {
-          continue;
+      for (auto candidate : m[plh].candidateSpaces()) {
+        auto i = find(candidate);
+        if (i == maps.size()) {
+          ISLUTILS_DIE("could not find the matched map");
+        }
+        if (std::find(toTransform.begin(), toTransform.end(), i) ==
+            toTransform.end()) {
+          toTransform.push_back(i);
         }
-        toTransform.push_back(umap.extract_map(candidate));
       }
     }
 
-    for (const auto &candidate : toTransform) {
-      auto found = std::find_if(
-          originalMaps.begin(), originalMaps.end(),
-          [candidate](isl::map map) { return map.is_equal(candidate); });
-      if (found == originalMaps.end()) {
-        ISLUTILS_DIE("could not find the matched map\n"
-                     "this typically means a map was matched more than once\n"
-                     "in which case the transformation is undefined");
-        continue;
+    for (auto i : toTransform) {
+      if (isTransformed[i]) {
+        ISLUTILS_DIE("a map was matched more than once\n"
+                     "the transformation is undefined");
       }
-      originalMaps.erase(found);
+      isTransformed[i] = true;
 
-      auto r = transformOneMap<CandidatePayload, PatternPayload>(candidate, m,
-                                                                 arg, args...);
-      transformedMaps.push_back(r);
+      size_t pos = 0;
+      auto transformed = transformOneMap<CandidatePayload, PatternPayload>(
+          maps[i], m, pos, arg, args...);
+      if (!transformed.is_null()) {
+        maps[i] = transformed;
+        ++report.nTransformed[pos];
+      }
     }
-  }
+    return true;
+  });
 
-  for (const auto &map : originalMaps) {
-    transformedMaps.push_back(map);
+  report.result = isl::union_map::empty(umap.get_space());
+  for (const auto &map : maps) {
+    report.result = report.result.add_map(map);
   }
+  return report;
+}
 
-  if (transformedMaps.empty()) {
-    return isl::union_map::empty(umap.get_space());
-  }
-  auto result = isl::union_map(transformedMaps.front());
-  for (const auto &map : transformedMaps) {
-    result = result.unite(isl::union_map(map));
-  }
-  return result;
+template <typename CandidatePayload, typename PatternPayload, typename... Args>
+isl::union_map findAndReplace(isl::union_map umap,
+                              Replacement<CandidatePayload, PatternPayload> arg,
+                              Args... args) {
+  return findAndReplaceReport(umap, arg, args...).result;
 }
 
 template <typename TargetPatternPayload, typename CandidatePayload,
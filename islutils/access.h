@@ -5,8 +5,11 @@
 
 #include <algorithm>
 #include <functional>
+#include <limits>
+#include <optional>
 #include <vector>
 
+#include "islutils/decomposed_access.h"
 #include "islutils/die.h"
 #include "islutils/operators.h"
 
@@ -160,15 +163,10 @@ public:
   // all placeholders have unique candidates except for those within one fold
   // that have the same candidate assigned.
   //
-  // Note that the filter must work on incomplete candidates for the
-  // branch-and-cut to work.  It can return "true" for incomplete candidates
-  // and only actually check complete candidates, but would require enumerating
-  // them all.
-  // Note also that the filter might be doing duplicate work: in the
-  // hasNoDuplicateAssignments example, there is not need to check all pairs in
-  // the N-element list if we know that elements of (N-1) array are unique.
-  // This algorithmic optimization requires some API changes and is left for
-  // future work.
+  // The filter accepts incomplete candidates, in which case only the assigned
+  // placeholders are checked.  The checks are performed incrementally, see
+  // CombinationValidator, which match() also uses while searching, see
+  // CombinationSearch.
   bool isSuitableCombination(
       const std::vector<DimCandidate<CandidatePayload>> &combination) const;
 };
@@ -215,6 +213,11 @@ public:
   MatchCandidates<CandidatePayload>
   operator[](const Placeholder<CandidatePayload, PPayload> &pl) const;
 
+  // The same match for "ps", which must have the same structure as the set
+  // this match was created for but may consist of other placeholders.
+  Match
+  rebound(const PlaceholderSet<CandidatePayload, PatternPayload> &ps) const;
+
 private:
   std::vector<std::pair<size_t, DimCandidate<CandidatePayload>>>
       placeholderValues_;
@@ -223,10 +226,39 @@ private:
 template <typename CandidatePayload, typename PatternPayload>
 using Matches = std::vector<Match<CandidatePayload, PatternPayload>>;
 
-template <typename PlaceholderCollectionTy>
+// Matching functions take the accesses either as an isl::union_map or as an
+// AccessIndex.
+
+// All matches of "ps" in "access".
+template <typename Accesses, typename PlaceholderCollectionTy>
 Matches<typename PlaceholderCollectionTy::CandidateTy,
         typename PlaceholderCollectionTy::PatternTy>
-match(isl::union_map access, PlaceholderCollectionTy ps);
+match(const Accesses &access, PlaceholderCollectionTy ps);
+
+// Number of matches of "ps" in "access".  Stop counting at "limit", e.g. a
+// limit of 2 is sufficient to check whether there is exactly one match.
+// Match objects are not constructed.
+template <typename Accesses, typename PlaceholderCollectionTy>
+size_t matchCount(const Accesses &access, PlaceholderCollectionTy ps,
+                  size_t limit = std::numeric_limits<size_t>::max());
+
+// Whether "ps" matches "access" at all.  Stops at the first match found.
+template <typename Accesses, typename PlaceholderCollectionTy>
+bool matchAny(const Accesses &access, PlaceholderCollectionTy ps);
+
+// First element of match(access, ps), if any, computed without enumerating
+// other matches.
+template <typename Accesses, typename PlaceholderCollectionTy>
+std::optional<Match<typename PlaceholderCollectionTy::CandidateTy,
+                    typename PlaceholderCollectionTy::PatternTy>>
+matchFirst(const Accesses &access, PlaceholderCollectionTy ps);
+
+// Call "visitor" with each element of match(access, ps) in turn, as a
+// const Match &, until it returns false.
+template <typename Accesses, typename PlaceholderCollectionTy,
+          typename Visitor>
+void forEachMatch(const Accesses &access, PlaceholderCollectionTy ps,
+                  Visitor &&visitor);
 
 template <typename CandidatePayload, typename PatternPayload>
 struct Replacement {
@@ -267,6 +299,25 @@ isl::union_map findAndReplace(isl::union_map umap,
                               Replacement<CandidatePayload, PatternPayload> arg,
                               Args... args);
 
+// Result of findAndReplaceReport: the transformed relations and, for each
+// replacement in the order of the arguments, the number of relations it
+// transformed.
+struct ReplacementReport {
+  bool fired(size_t replacementPos) const {
+    return nTransformed.at(replacementPos) != 0;
+  }
+
+  isl::union_map result;
+  std::vector<size_t> nTransformed;
+};
+
+// Same as findAndReplace, but also reports which replacements fired.
+template <typename CandidatePayload, typename PatternPayload, typename... Args>
+ReplacementReport
+findAndReplaceReport(isl::union_map umap,
+                     Replacement<CandidatePayload, PatternPayload> arg,
+                     Args... args);
+
 } // namespace matchers
 
 #include "access-inl.h"
@@ -0,0 +1,96 @@
+#include "islutils/access_index.h"
+#include "islutils/pet_wrapper.h"
+#include "islutils/scop.h"
+
+namespace matchers {
+
+AccessIndex::AccessIndex(const ::Scop &scop, unsigned kinds) {
+  if (kinds & Read) {
+    add(scop.reads, Read);
+  }
+  if (kinds & MayWrite) {
+    add(scop.mayWrites, MayWrite);
+  }
+  if (kinds & MustWrite) {
+    add(scop.mustWrites, MustWrite);
+  }
+}
+
+AccessIndex::AccessIndex(const pet::Scop &scop, unsigned kinds)
+    : AccessIndex(scop.getScop(), kinds) {}
+
+// Whether the affine hull of "domain" has equalities that involve its set
+// dimensions, i.e., whether it is not the product of a universe set and a
+// parameter domain.
+static bool domainHasInputEqualities(isl::set domain) {
+  auto hull = isl::set(domain.affine_hull());
+  auto lifted =
+      isl::set::universe(hull.get_space()).intersect_params(hull.params());
+  return !lifted.is_subset(hull);
+}
+
+void AccessIndex::add(isl::union_map accesses, Kind kind) {
+  if (accesses.is_null()) {
+    return;
+  }
+
+  std::vector<long> row;
+  accesses.foreach_map([&](isl::map map) {
+    auto space = map.get_space();
+    auto domainSpace = space.domain();
+    isl::id statement, ref;
+    if (domainSpace.is_wrapping()) {
+      auto tagged = domainSpace.unwrap();
+      if (tagged.domain().has_tuple_id(isl::dim::set)) {
+        statement = tagged.domain().get_tuple_id(isl::dim::set);
+      }
+      if (tagged.range().has_tuple_id(isl::dim::set)) {
+        ref = tagged.range().get_tuple_id(isl::dim::set);
+      }
+      map = map.curry();
+    } else if (domainSpace.has_tuple_id(isl::dim::set)) {
+      statement = domainSpace.get_tuple_id(isl::dim::set);
+    }
+    isl::id array;
+    if (space.range().has_tuple_id(isl::dim::set)) {
+      array = space.range().get_tuple_id(isl::dim::set);
+    }
+
+    statements_.push_back(statement);
+    arrays_.push_back(array);
+    refs_.push_back(ref);
+    kinds_.push_back(kind);
+    relations_.emplace_back(map);
+
+    const auto &relation = relations_.back();
+    int nInputs = map.dim(isl::dim::in);
+    nInputs_.push_back(nInputs);
+    hasInputEqualities_.push_back(domainHasInputEqualities(map.domain()));
+    firstRow_.push_back(rowIsAffine_.size());
+    firstCoefficient_.push_back(coefficients_.size());
+    for (int pos = 0, e = relation.nOutDims(); pos < e; ++pos) {
+      bool isAffine = integerCoefficients(relation.outDimAff(pos), row);
+      rowIsAffine_.push_back(isAffine);
+      if (isAffine) {
+        coefficients_.insert(coefficients_.end(), row.begin(), row.end());
+      } else {
+        coefficients_.insert(coefficients_.end(), nInputs + 1, 0);
+      }
+    }
+    return isl_stat_ok;
+  });
+}
+
+isl::union_map AccessIndex::relations(unsigned kinds) const {
+  isl::union_map result;
+  for (size_t i = 0; i < size(); ++i) {
+    if (!(kinds_[i] & kinds)) {
+      continue;
+    }
+    auto relation = isl::union_map(relations_[i].map());
+    result = result.is_null() ? relation : result.unite(relation);
+  }
+  return result;
+}
+
+} // namespace matchers
@@ -0,0 +1,160 @@
+#ifndef ISLUTILS_ACCESS_INDEX_H
+#define ISLUTILS_ACCESS_INDEX_H
+
+#include "islutils/access.h"
+#include "islutils/decomposed_access.h"
+
+#include <isl/isl-noexceptions.h>
+
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class Scop;
+namespace pet {
+class Scop;
+}
+
+namespace matchers {
+
+// Access relations of a SCoP, extracted once and shared by all access
+// matchers.  Per access, the index keeps the statement id, the array id, the
+// reference tag, the relation (in the curried form
+//   S[...] -> [ref[] -> A[...]]
+// for tagged accesses, and as is for untagged accesses) and, for each
+// subscript, the integer coefficients of the input dimensions and the integer
+// constant when the subscript is affine in the input dimensions only.  Data
+// are stored in parallel arrays indexed by access; subscripts of all accesses
+// share one array of coefficient rows.
+//
+// Pass the index instead of relations to match() and its variants to run
+// access matchers against the index.  Candidate payloads that provide
+//   candidates(const AccessIndex &, size_t, const PatternPayload &)
+// may compare integer coefficients directly.  Other payloads, and subscripts
+// that are not affine, are handled on the isl relations.
+class AccessIndex {
+public:
+  // Kinds of accesses, can be combined with bitwise or.
+  enum Kind : unsigned {
+    Read = 1u << 0,
+    MayWrite = 1u << 1,
+    MustWrite = 1u << 2,
+    AllKinds = Read | MayWrite | MustWrite
+  };
+
+  AccessIndex() = default;
+  // Index the (tagged) accesses of the given kinds in "scop".  Note that
+  // may-writes usually include must-writes.
+  explicit AccessIndex(const ::Scop &scop, unsigned kinds = AllKinds);
+  explicit AccessIndex(const pet::Scop &scop, unsigned kinds = AllKinds);
+
+  // Index all relations of "accesses" as accesses of the given kind.
+  void add(isl::union_map accesses, Kind kind);
+
+  size_t size() const { return relations_.size(); }
+  bool empty() const { return relations_.empty(); }
+
+  isl::id statement(size_t access) const { return statements_[access]; }
+  isl::id array(size_t access) const { return arrays_[access]; }
+  // Null id for untagged accesses.
+  isl::id ref(size_t access) const { return refs_[access]; }
+  Kind kind(size_t access) const { return kinds_[access]; }
+  const DecomposedAccess &relation(size_t access) const {
+    return relations_[access];
+  }
+
+  int nInputs(size_t access) const { return nInputs_[access]; }
+  int nSubscripts(size_t access) const {
+    return relations_[access].nOutDims();
+  }
+  // Whether subscript "pos" of "access" has integer coefficients, with
+  // "pos" being a non-negative position.
+  bool isAffine(size_t access, int pos) const {
+    return rowIsAffine_[firstRow_[access] + pos];
+  }
+  // Coefficient of input dimension "inputPos" in subscript "pos" of
+  // "access".  Only valid if isAffine(access, pos).
+  long coefficient(size_t access, int pos, int inputPos) const {
+    return coefficients_[rowStart(access, pos) + inputPos];
+  }
+  // Constant term of subscript "pos" of "access".  Only valid if
+  // isAffine(access, pos).
+  long constant(size_t access, int pos) const {
+    return coefficients_[rowStart(access, pos) + nInputs_[access]];
+  }
+  // Whether the domain of "access" has equalities involving its input
+  // dimensions.  A subscript may then be equal to input dimensions other
+  // than those with non-zero coefficients on that domain.
+  bool hasInputEqualities(size_t access) const {
+    return hasInputEqualities_[access];
+  }
+
+  // Relations of the indexed accesses of the given kinds, or a null object if
+  // there are none.
+  isl::union_map relations(unsigned kinds = AllKinds) const;
+
+private:
+  size_t rowStart(size_t access, int pos) const {
+    return firstCoefficient_[access] + pos * (nInputs_[access] + 1);
+  }
+
+  std::vector<isl::id> statements_;
+  std::vector<isl::id> arrays_;
+  std::vector<isl::id> refs_;
+  std::vector<Kind> kinds_;
+  std::vector<DecomposedAccess> relations_;
+  std::vector<int> nInputs_;
+  std::vector<bool> hasInputEqualities_;
+  std::vector<size_t> firstRow_;
+  std::vector<size_t> firstCoefficient_;
+
+  std::vector<bool> rowIsAffine_;
+  std::vector<long> coefficients_;
+};
+
+template <typename CandidatePayload, typename PatternPayload, typename = void>
+struct HasIndexedCandidates : std::false_type {};
+
+template <typename CandidatePayload, typename PatternPayload>
+struct HasIndexedCandidates<
+    CandidatePayload, PatternPayload,
+    decltype((void)CandidatePayload::candidates(
+        std::declval<const AccessIndex &>(), std::declval<size_t>(),
+        std::declval<const PatternPayload &>()))> : std::true_type {};
+
+template <typename CandidatePayload, typename PatternPayload>
+std::vector<CandidatePayload> findCandidates(const AccessIndex &index,
+                                             size_t access,
+                                             const PatternPayload &pattern) {
+  if constexpr (HasIndexedCandidates<CandidatePayload,
+                                     PatternPayload>::value) {
+    return CandidatePayload::candidates(index, access, pattern);
+  } else {
+    return findCandidates<CandidatePayload>(index.relation(access), pattern);
+  }
+}
+
+// Stage 1 of matching against the index, see collectCandidates for
+// isl::union_map.
+template <typename PlaceholderCollectionTy>
+bool collectCandidates(const AccessIndex &index, PlaceholderCollectionTy &ps) {
+  using CandidateTy = typename PlaceholderCollectionTy::CandidateTy;
+  using PatternTy = typename PlaceholderCollectionTy::PatternTy;
+
+  for (auto &ph : ps) {
+    for (size_t i = 0, e = index.size(); i < e; ++i) {
+      for (auto &&c :
+           findCandidates<CandidateTy, PatternTy>(index, i, ph.pattern_)) {
+        ph.candidates_.emplace_back(c, index.relation(i).space());
+      }
+    }
+    if (ph.candidates_.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace matchers
+
+#endif // ISLUTILS_ACCESS_INDEX_H
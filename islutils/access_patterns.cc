@@ -3,20 +3,16 @@
 
 namespace matchers {
 
-std::vector<SingleInputDim>
-SingleInputDim::candidates(isl::map singleOutDimMap, const SimpleAff &pattern) {
-  std::vector<SingleInputDim> result = {};
-  singleOutDimMap = singleOutDimMap.coalesce();
-  if (!singleOutDimMap.is_single_valued()) {
+// Find the input dimensions "i" such that "pa" is equal to
+//   pattern.coefficient_ * i + pattern.constant_
+// on its domain.  A null "pa" has no candidates.
+static std::vector<SingleInputDim> candidatesFromAff(isl::pw_aff pa,
+                                                     const SimpleAff &pattern) {
+  if (pa.is_null()) {
     return {};
   }
 
-  auto pma = isl::pw_multi_aff::from_map(singleOutDimMap);
-  // Truly piece-wise access is not a single variable.
-  if (pma.n_piece() != 1) {
-    return {};
-  }
-  auto pa = pma.get_pw_aff(0);
+  std::vector<SingleInputDim> result = {};
   isl::aff a;
   pa.foreach_piece([&a](isl::set, isl::aff aff) {
     if (!a.is_null()) {
@@ -26,15 +22,15 @@ SingleInputDim::candidates(isl::map singleOutDimMap, const SimpleAff &pattern) {
     return isl_stat_ok;
   });
 
-  int dim = singleOutDimMap.dim(isl::dim::in);
-  auto space = singleOutDimMap.get_space();
+  auto space = pa.get_space();
+  int dim = space.dim(isl::dim::in);
   auto lspace = isl::local_space(space.domain());
+  auto domain = pa.domain();
   for (int i = 0; i < dim; ++i) {
     auto candidateAff = isl::aff::var_on_domain(lspace, isl::dim::set, i);
     candidateAff = candidateAff.scale(pattern.coefficient_);
     candidateAff = candidateAff.add_constant_val(pattern.constant_);
-    auto candidatePwAff =
-        isl::pw_aff(candidateAff).intersect_domain(pa.domain());
+    auto candidatePwAff = isl::pw_aff(candidateAff).intersect_domain(domain);
     if (pa.is_equal(candidatePwAff)) {
       result.emplace_back(SingleInputDim{i});
     }
@@ -43,6 +39,48 @@ SingleInputDim::candidates(isl::map singleOutDimMap, const SimpleAff &pattern) {
   return result;
 }
 
+std::vector<SingleInputDim>
+SingleInputDim::candidates(isl::map singleOutDimMap, const SimpleAff &pattern) {
+  return candidatesFromAff(singleValuedAff(singleOutDimMap), pattern);
+}
+
+std::vector<SingleInputDim>
+SingleInputDim::candidates(const DecomposedAccess &access, int outDimPos,
+                           const SimpleAff &pattern) {
+  return candidatesFromAff(access.outDimAff(outDimPos), pattern);
+}
+
+std::vector<SingleInputDim>
+SingleInputDim::candidates(const AccessIndex &index, size_t access,
+                           int outDimPos, const SimpleAff &pattern) {
+  // Comparing coefficients is only exact if the domain has no equalities
+  // relating the input dimensions.
+  if (!index.isAffine(access, outDimPos) || !pattern.coefficient_.is_int() ||
+      !pattern.constant_.is_int() || index.hasInputEqualities(access)) {
+    return candidates(index.relation(access), outDimPos, pattern);
+  }
+
+  long coefficient = pattern.coefficient_.get_num_si();
+  if (index.constant(access, outDimPos) != pattern.constant_.get_num_si()) {
+    return {};
+  }
+
+  // The subscript must be "coefficient" times exactly one input dimension.
+  std::vector<SingleInputDim> result = {};
+  int dim = index.nInputs(access);
+  for (int i = 0; i < dim; ++i) {
+    bool matches = true;
+    for (int j = 0; j < dim && matches; ++j) {
+      long expected = i == j ? coefficient : 0;
+      matches = index.coefficient(access, outDimPos, j) == expected;
+    }
+    if (matches) {
+      result.emplace_back(SingleInputDim{i});
+    }
+  }
+  return result;
+}
+
 isl::map SingleInputDim::transformMap(isl::map map,
                                       const SingleInputDim &candidate,
                                       const SimpleAff &pattern) {
@@ -58,6 +96,94 @@ isl::map SingleInputDim::transformMap(isl::map map,
 
 ///////////////////////////////
 
+// Given the integer coefficients of a subscript "row", input dimensions first
+// and constant last, find X such that the subscript is equal to
+//   pattern.coefficient_ * X + pattern.constant_
+// X must have integer coefficients and involve at least one input dimension.
+static std::vector<MultiInputDim> candidatesFromRow(std::vector<long> row,
+                                                    const GeneralAff &pattern) {
+  if (!pattern.coefficient_.is_int() || !pattern.constant_.is_int() ||
+      pattern.coefficient_.is_zero()) {
+    return {};
+  }
+
+  long coefficient = pattern.coefficient_.get_num_si();
+  row.back() -= pattern.constant_.get_num_si();
+  for (auto &c : row) {
+    if (c % coefficient != 0) {
+      return {};
+    }
+    c /= coefficient;
+  }
+  long constant = row.back();
+  row.pop_back();
+  if (std::all_of(row.begin(), row.end(), [](long c) { return c == 0; })) {
+    return {};
+  }
+  return {MultiInputDim{row, constant}};
+}
+
+std::vector<MultiInputDim>
+MultiInputDim::candidates(isl::map singleOutDimMap, const GeneralAff &pattern) {
+  std::vector<long> row;
+  if (!integerCoefficients(singleValuedAff(singleOutDimMap), row)) {
+    return {};
+  }
+  return candidatesFromRow(row, pattern);
+}
+
+std::vector<MultiInputDim>
+MultiInputDim::candidates(const DecomposedAccess &access, int outDimPos,
+                          const GeneralAff &pattern) {
+  std::vector<long> row;
+  if (!integerCoefficients(access.outDimAff(outDimPos), row)) {
+    return {};
+  }
+  return candidatesFromRow(row, pattern);
+}
+
+std::vector<MultiInputDim>
+MultiInputDim::candidates(const AccessIndex &index, size_t access,
+                          int outDimPos, const GeneralAff &pattern) {
+  // The index stores the coefficients of exactly the subscripts that
+  // integerCoefficients accepts.
+  if (!index.isAffine(access, outDimPos)) {
+    return {};
+  }
+  int dim = index.nInputs(access);
+  std::vector<long> row;
+  row.reserve(dim + 1);
+  for (int i = 0; i < dim; ++i) {
+    row.push_back(index.coefficient(access, outDimPos, i));
+  }
+  row.push_back(index.constant(access, outDimPos));
+  return candidatesFromRow(row, pattern);
+}
+
+isl::map MultiInputDim::transformMap(isl::map map,
+                                     const MultiInputDim &candidate,
+                                     const GeneralAff &pattern) {
+  auto space = map.get_space();
+  int dim = space.dim(isl::dim::in);
+  if (dim != static_cast<int>(candidate.coefficients_.size())) {
+    ISLUTILS_DIE("candidate does not match the input dimensions of the map");
+  }
+  auto ctx = map.get_ctx();
+  auto lhs = isl::aff(isl::local_space(space.domain()),
+                      isl::val(ctx, candidate.constant_));
+  for (int i = 0; i < dim; ++i) {
+    lhs = lhs.set_coefficient_val(isl::dim::in, i,
+                                  isl::val(ctx, candidate.coefficients_[i]));
+  }
+  lhs = lhs.scale(pattern.coefficient_).add_constant_val(pattern.constant_);
+  auto rhs = isl::aff::var_on_domain(isl::local_space(space.range()),
+                                     isl::dim::set, 0);
+  using map_maker::operator==;
+  return lhs == rhs;
+}
+
+///////////////////////////////
+
 // Create a relation between a point in the given space and one
 // (if "all" == false) or multiple (otherwise) points in the same space
 // such that the value along the last dimension of the space in the range is
@@ -84,9 +210,12 @@ static isl::map mapToNext(isl::space space, bool all = false) {
   return all ? result.intersect(aff < aff) : result.intersect(next == aff);
 }
 
-std::vector<StrideCandidate>
-StrideCandidate::candidates(isl::map singleOutDimMap,
-                            const StridePattern &pattern) {
+// Set of differences between the values of "singleOutDimMap" at a point of
+// its domain and at the next point along the last dimension.  If
+// "nonEmptySchedulePoints" is not null, the next point is the
+// lexicographically smallest greater point in this set.
+static isl::set strideDeltas(isl::map singleOutDimMap,
+                             isl::set nonEmptySchedulePoints) {
   // Construct a relation between a point in space representing loops (e.g.,
   // partial schedule space) and is immediate successor in the innermost loop
   // (the last dimension).
@@ -96,29 +225,167 @@ StrideCandidate::candidates(isl::map singleOutDimMap,
   // of active schedule points must be provided in the pattern.  In this case,
   // take the lexicographically smallest point that is active.
   auto map = mapToNext(singleOutDimMap.get_space().domain(),
-                       !pattern.nonEmptySchedulePoints.is_null());
-  if (pattern.nonEmptySchedulePoints) {
-    map = map.intersect_domain(pattern.nonEmptySchedulePoints)
-              .intersect_range(pattern.nonEmptySchedulePoints);
+                       !nonEmptySchedulePoints.is_null());
+  if (nonEmptySchedulePoints) {
+    map = map.intersect_domain(nonEmptySchedulePoints)
+              .intersect_range(nonEmptySchedulePoints);
     map = map.lexmin();
   }
-  auto delta =
-      map.apply_domain(singleOutDimMap).apply_range(singleOutDimMap).deltas();
-  // TODO: also match parametric strides
-  auto strideAff =
-      isl::aff(isl::local_space(delta.get_space()), pattern.stride);
+  return map.apply_domain(singleOutDimMap)
+      .apply_range(singleOutDimMap)
+      .deltas();
+}
+
+// Check if all elements of the one-dimensional set "delta" are equal to
+// "stride".  Since the empty set is a subset of any set, empty deltas set
+// (caused, e.g., by empty input set) would indicate a match.  However, it does
+// not make sense to say that accessed that is not performed has any
+// meaningful stride.  Consider empty deltas as an absence of match.
+static bool isConstantStride(isl::set delta, isl::val stride) {
+  auto strideAff = isl::aff(isl::local_space(delta.get_space()), stride);
   auto varAff = isl::aff::var_on_domain(isl::local_space(delta.get_space()),
                                         isl::dim::set, 0);
-  // Since the empty set is a subset of any set, empty deltas set (caused,
-  // e.g., by empty input set) would indicate a match.  However, it does not
-  // make sense to say that accessed that is not performed has any meaningful
-  // stride.  Consider empty deltas as an absence of match.
   using set_maker::operator==;
-  if (!delta.is_empty() && delta.is_subset(strideAff == varAff))
-    return {StrideCandidate{}};
+  return !delta.is_empty() && delta.is_subset(strideAff == varAff);
+}
+
+// Check if all elements of the one-dimensional set "delta" are equal to
+// "stride", an affine function of the parameters without integer divisions.
+// As above, empty deltas do not match.
+static bool isParametricStride(isl::set delta, isl::aff stride) {
+  if (stride.dim(isl::dim::in) != 0 || stride.dim(isl::dim::div) != 0) {
+    return false;
+  }
+  if (delta.is_empty()) {
+    return false;
+  }
+
+  // Bring both to the same parameters and express the stride on the space of
+  // deltas.
+  stride = stride.align_params(delta.get_space());
+  delta = delta.align_params(stride.get_space());
+  auto lspace = isl::local_space(delta.get_space());
+  auto strideAff = isl::aff(lspace).set_constant_val(stride.get_constant_val());
+  for (int i = 0, e = stride.dim(isl::dim::param); i < e; ++i) {
+    strideAff = strideAff.set_coefficient_val(
+        isl::dim::param, i, stride.get_coefficient_val(isl::dim::param, i));
+  }
+  auto varAff = isl::aff::var_on_domain(lspace, isl::dim::set, 0);
+  using set_maker::operator==;
+  return delta.is_subset(strideAff == varAff);
+}
+
+// Return the affine function of the parameters all elements of "delta" are
+// equal to, or a null object if there is no such function.
+static isl::aff symbolicStride(isl::set delta) {
+  if (delta.is_empty()) {
+    return isl::aff();
+  }
+  auto min = delta.dim_min(0);
+  if (min.n_piece() != 1 || !min.is_equal(delta.dim_max(0))) {
+    return isl::aff();
+  }
+  isl::aff result;
+  min.foreach_piece([&result](isl::set, isl::aff aff) {
+    result = aff;
+    return isl_stat_ok;
+  });
+  return isParametricStride(delta, result) ? result : isl::aff();
+}
+
+std::vector<StrideCandidate>
+StrideCandidate::candidates(isl::map singleOutDimMap,
+                            const StridePattern &pattern) {
+  auto delta = strideDeltas(singleOutDimMap, pattern.nonEmptySchedulePoints);
+  if (pattern.anyStride) {
+    auto stride = symbolicStride(delta);
+    if (stride.is_null()) {
+      return {};
+    }
+    return {StrideCandidate{stride}};
+  }
+  if (!pattern.parametricStride.is_null()) {
+    if (isParametricStride(delta, pattern.parametricStride)) {
+      return {StrideCandidate{pattern.parametricStride}};
+    }
+    return {};
+  }
+  if (isConstantStride(delta, pattern.stride)) {
+    auto params = isl::local_space(delta.get_space().params());
+    return {StrideCandidate{isl::aff(params, pattern.stride)}};
+  }
   return {};
 }
 
+StrideProfile::StrideProfile(isl::multi_union_pw_aff schedule,
+                             isl::union_map accesses)
+    : nDims_(schedule.dim(isl::dim::set)) {
+  accesses.foreach_map([this](isl::map map) {
+    position(map.get_space().range());
+    return isl_stat_ok;
+  });
+  accessed_.assign(spaces_.size() * nDims_, false);
+  strides_.assign(spaces_.size() * nDims_, isl::val());
+
+  for (int dim = 0; dim < nDims_; ++dim) {
+    auto schedule1D = schedule.get_union_pw_aff(dim);
+    auto scheduleMap1D = isl::union_map::from_union_pw_aff(schedule1D);
+    auto scheduled = accesses.apply_domain(scheduleMap1D);
+    scheduled.foreach_map([this, dim](isl::map map) {
+      size_t pos = position(map.get_space().range()) * nDims_ + dim;
+      accessed_[pos] = true;
+
+      int nOut = map.dim(isl::dim::out);
+      if (nOut == 0) {
+        return isl_stat_ok;
+      }
+      auto single = map.project_out(isl::dim::out, 0, nOut - 1);
+      auto delta = strideDeltas(single, isl::set());
+      if (delta.is_empty()) {
+        return isl_stat_ok;
+      }
+      // A constant stride is equal to any of the deltas.
+      auto candidate =
+          delta.sample_point().get_coordinate_val(isl::dim::set, 0);
+      if (isConstantStride(delta, candidate)) {
+        strides_[pos] = candidate;
+      }
+      return isl_stat_ok;
+    });
+  }
+}
+
+size_t StrideProfile::position(isl::space space) {
+  auto &bucket = spaceBuckets_[tupleHash(space)];
+  for (auto pos : bucket) {
+    if (spaces_[pos].is_equal(space)) {
+      return pos;
+    }
+  }
+  bucket.push_back(spaces_.size());
+  spaces_.push_back(space);
+  return spaces_.size() - 1;
+}
+
+size_t StrideProfile::nAccessed(int dim) const {
+  size_t result = 0;
+  for (size_t i = 0; i < nAccesses(); ++i) {
+    result += isAccessed(i, dim);
+  }
+  return result;
+}
+
+size_t StrideProfile::count(int dim, long stride) const {
+  size_t result = 0;
+  for (size_t i = 0; i < nAccesses(); ++i) {
+    auto value = this->stride(i, dim);
+    if (value && value.is_int() && value.get_num_si() == stride) {
+      ++result;
+    }
+  }
+  return result;
+}
+
 ///////////////////
 // Utility functions for FixedOutDimPattern::transformMap
 
@@ -2,9 +2,12 @@
 #define ISLUTILS_ACCESS_PATTERNS_H
 
 #include "islutils/access.h"
+#include "islutils/access_index.h"
+#include "islutils/decomposed_access.h"
 #include "islutils/die.h"
 
 #include <climits>
+#include <unordered_map>
 
 namespace matchers {
 
@@ -19,6 +22,21 @@ public:
   static std::vector<CandidateTy>
   candidates(isl::map access, const FixedOutDimPattern<PatternTy> &pattern);
 
+  // Same as above, but reads the output dimension from the decomposition
+  // shared by all placeholders.  CandidateTy must provide
+  //   candidates(const DecomposedAccess &, int, const PatternTy &).
+  template <typename CandidateTy>
+  static std::vector<CandidateTy>
+  candidates(const DecomposedAccess &access,
+             const FixedOutDimPattern<PatternTy> &pattern);
+
+  // Same as above, for an access in the index.  CandidateTy must provide
+  //   candidates(const AccessIndex &, size_t, int, const PatternTy &).
+  template <typename CandidateTy>
+  static std::vector<CandidateTy>
+  candidates(const AccessIndex &index, size_t access,
+             const FixedOutDimPattern<PatternTy> &pattern);
+
   template <typename CandidateTy>
   static isl::map transformMap(isl::map map, const CandidateTy &candidate,
                                const FixedOutDimPattern<PatternTy> &pattern);
@@ -68,6 +86,46 @@ std::vector<CandidateTy> FixedOutDimPattern<PatternTy>::candidates(
                                  static_cast<const PatternTy &>(pattern));
 }
 
+template <typename PatternTy>
+template <typename CandidateTy>
+std::vector<CandidateTy> FixedOutDimPattern<PatternTy>::candidates(
+    const DecomposedAccess &access,
+    const FixedOutDimPattern<PatternTy> &pattern) {
+  int pos = pattern.outDimPos;
+  if (pos == INT_MAX) {
+    ISLUTILS_DIE("no out dimension specified for FixedOutDimPattern");
+  }
+  int dim = access.nOutDims();
+  if (pos < 0) {
+    pos = dim + pos;
+  }
+  if (pos >= dim || pos < 0) {
+    return {};
+  }
+  return CandidateTy::candidates(access, pos,
+                                 static_cast<const PatternTy &>(pattern));
+}
+
+template <typename PatternTy>
+template <typename CandidateTy>
+std::vector<CandidateTy> FixedOutDimPattern<PatternTy>::candidates(
+    const AccessIndex &index, size_t access,
+    const FixedOutDimPattern<PatternTy> &pattern) {
+  int pos = pattern.outDimPos;
+  if (pos == INT_MAX) {
+    ISLUTILS_DIE("no out dimension specified for FixedOutDimPattern");
+  }
+  int dim = index.nSubscripts(access);
+  if (pos < 0) {
+    pos = dim + pos;
+  }
+  if (pos >= dim || pos < 0) {
+    return {};
+  }
+  return CandidateTy::candidates(index, access, pos,
+                                 static_cast<const PatternTy &>(pattern));
+}
+
 template <typename CandidateTy, typename T>
 Placeholder<CandidateTy, FixedOutDimPattern<T>>
 dim(int pos, Placeholder<CandidateTy, UnfixedOutDimPattern<T>> placeholder) {
@@ -167,6 +225,25 @@ public:
     return FixedOutDimPattern<SimpleAff>::candidates<SingleInputDim>(map,
                                                                      pattern);
   }
+  static std::vector<SingleInputDim>
+  candidates(const DecomposedAccess &access, int outDimPos,
+             const SimpleAff &pattern);
+  static std::vector<SingleInputDim>
+  candidates(const DecomposedAccess &access,
+             const FixedOutDimPattern<SimpleAff> &pattern) {
+    return FixedOutDimPattern<SimpleAff>::candidates<SingleInputDim>(access,
+                                                                     pattern);
+  }
+  // Compares integer coefficients if the subscript is affine.
+  static std::vector<SingleInputDim> candidates(const AccessIndex &index,
+                                                size_t access, int outDimPos,
+                                                const SimpleAff &pattern);
+  static std::vector<SingleInputDim>
+  candidates(const AccessIndex &index, size_t access,
+             const FixedOutDimPattern<SimpleAff> &pattern) {
+    return FixedOutDimPattern<SimpleAff>::candidates<SingleInputDim>(
+        index, access, pattern);
+  }
 
   static isl::map transformMap(isl::map, const SingleInputDim &candidate,
                                const SimpleAff &pattern);
@@ -185,6 +262,10 @@ inline bool operator==(const SingleInputDim &left,
   return left.inputDimPos_ == right.inputDimPos_;
 }
 
+inline size_t candidateHash(const SingleInputDim &candidate) {
+  return candidate.inputDimPos_;
+}
+
 inline Placeholder<SingleInputDim, UnfixedOutDimPattern<SimpleAff>>
 placeholder(isl::ctx ctx) {
   return Placeholder<SingleInputDim, UnfixedOutDimPattern<SimpleAff>>(
@@ -217,6 +298,114 @@ operator-(Placeholder<SingleInputDim, UnfixedOutDimPattern<SimpleAff>> p,
 
 ////////////////////
 
+// Pattern payload class for placeholders that capture affine expressions of
+// the form
+//   coefficient_ * X + constant_
+// where X is an affine combination of any number of input dimensions, for
+// example "t + i" after skewing or "32 * ti + i" after tiling, described by
+// MultiInputDim.  Expressions that involve no input dimension are not matched.
+class GeneralAff {
+public:
+  explicit GeneralAff(isl::ctx ctx)
+      : coefficient_(isl::val::one(ctx)), constant_(isl::val::zero(ctx)) {}
+
+  isl::val coefficient_;
+  isl::val constant_;
+};
+
+// Affine combination of the input dimensions with integer coefficients
+//   coefficients_[0] * i0 + coefficients_[1] * i1 + ... + constant_
+// Unlike SingleInputDim, candidates are read from the affine form of the
+// subscript at once rather than by trying every input dimension.  Candidates
+// are equal, e.g. in folds, if all their coefficients and constants are.
+class MultiInputDim {
+public:
+  static std::vector<MultiInputDim> candidates(isl::map singleOutDimMap,
+                                               const GeneralAff &pattern);
+  static std::vector<MultiInputDim>
+  candidates(isl::map map, const FixedOutDimPattern<GeneralAff> &pattern) {
+    return FixedOutDimPattern<GeneralAff>::candidates<MultiInputDim>(map,
+                                                                     pattern);
+  }
+  static std::vector<MultiInputDim>
+  candidates(const DecomposedAccess &access, int outDimPos,
+             const GeneralAff &pattern);
+  static std::vector<MultiInputDim>
+  candidates(const DecomposedAccess &access,
+             const FixedOutDimPattern<GeneralAff> &pattern) {
+    return FixedOutDimPattern<GeneralAff>::candidates<MultiInputDim>(access,
+                                                                     pattern);
+  }
+  // Reads the integer coefficients stored in the index.
+  static std::vector<MultiInputDim> candidates(const AccessIndex &index,
+                                               size_t access, int outDimPos,
+                                               const GeneralAff &pattern);
+  static std::vector<MultiInputDim>
+  candidates(const AccessIndex &index, size_t access,
+             const FixedOutDimPattern<GeneralAff> &pattern) {
+    return FixedOutDimPattern<GeneralAff>::candidates<MultiInputDim>(
+        index, access, pattern);
+  }
+
+  static isl::map transformMap(isl::map map, const MultiInputDim &candidate,
+                               const GeneralAff &pattern);
+
+  static isl::map transformMap(isl::map map, const MultiInputDim &candidate,
+                               const FixedOutDimPattern<GeneralAff> &pattern) {
+    return FixedOutDimPattern<GeneralAff>::transformMap<MultiInputDim>(
+        map, candidate, pattern);
+  }
+
+  std::vector<long> coefficients_;
+  long constant_;
+};
+
+inline bool operator==(const MultiInputDim &left,
+                       const MultiInputDim &right) {
+  return left.coefficients_ == right.coefficients_ &&
+         left.constant_ == right.constant_;
+}
+
+inline size_t candidateHash(const MultiInputDim &candidate) {
+  uint64_t hash = candidate.constant_;
+  for (auto coefficient : candidate.coefficients_) {
+    combineHash(hash, coefficient);
+  }
+  return hash;
+}
+
+inline Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>>
+affine(isl::ctx ctx) {
+  return Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>>(
+      UnfixedOutDimPattern<GeneralAff>(GeneralAff(ctx)));
+}
+
+inline Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>>
+operator*(int i,
+          Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>> p) {
+  p.pattern_.coefficient_ = p.pattern_.coefficient_.mul(
+      isl::val(p.pattern_.coefficient_.get_ctx(), i));
+  return p;
+}
+
+inline Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>>
+operator+(Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>> p,
+          int i) {
+  p.pattern_.constant_ =
+      p.pattern_.constant_.add(isl::val(p.pattern_.constant_.get_ctx(), i));
+  return p;
+}
+
+inline Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>>
+operator-(Placeholder<MultiInputDim, UnfixedOutDimPattern<GeneralAff>> p,
+          int i) {
+  p.pattern_.constant_ =
+      p.pattern_.constant_.sub(isl::val(p.pattern_.constant_.get_ctx(), i));
+  return p;
+}
+
+////////////////////
+
 /**
  * Pattern class to detect strides in an access relation.
  * By stride, we understand the constant offset in number of elements between
@@ -226,13 +415,17 @@ operator-(Placeholder<SingleInputDim, UnfixedOutDimPattern<SimpleAff>> p,
  * stride-zero (the same element is accessed in all iterations) or stride-one
  * (subsequent iterations access subsequent array elements).
  *
- * If the offset is not constant between loop iterations, the offset is
- * considered to be undefined and is not matched by any stride.
+ * The offset may depend on parameters, in which case it must be the same
+ * affine function of the parameters between all loop iterations.  If the
+ * offset is not such a function, it is considered to be undefined and is not
+ * matched by any stride.
  *
- * The pattern includes the value of the stride and, optionally, the set of
- * relevant points in schedule space.  The latter is useful in cases where not
- * every point in the schedule space performs the access, for example in case
- * of non-unit iterator increments or modular if-conditions.
+ * The pattern includes the value of the stride, either constant or as an
+ * affine function of the parameters, or a flag accepting any stride, and,
+ * optionally, the set of relevant points in schedule space.  The latter is
+ * useful in cases where not every point in the schedule space performs the
+ * access, for example in case of non-unit iterator increments or modular
+ * if-conditions.
  *
  * Candidates for this pattern may be captured by the StrideCandidate class.
  *
@@ -245,6 +438,12 @@ public:
 
   isl::val stride;                 ///< Expected stirde.
   isl::set nonEmptySchedulePoints; ///< Schedule points to check, if not empty.
+  /// Expected stride as an affine function of the parameters, used instead of
+  /// "stride" if not null.
+  isl::aff parametricStride;
+  /// Accept any stride, constant or parametric, ignoring "stride" and
+  /// "parametricStride".
+  bool anyStride = false;
 };
 
 class StrideCandidate {
@@ -257,8 +456,79 @@ public:
     return FixedOutDimPattern<StridePattern>::candidates<StrideCandidate>(
         map, pattern);
   }
+  static std::vector<StrideCandidate>
+  candidates(const DecomposedAccess &access, int outDimPos,
+             const StridePattern &pattern) {
+    return candidates(access.outDim(outDimPos), pattern);
+  }
+  static std::vector<StrideCandidate>
+  candidates(const DecomposedAccess &access,
+             const FixedOutDimPattern<StridePattern> &pattern) {
+    return FixedOutDimPattern<StridePattern>::candidates<StrideCandidate>(
+        access, pattern);
+  }
 
+  // All stride candidates are considered equal so that folded stride
+  // placeholders do not constrain each other.
   bool operator==(const StrideCandidate &) const { return true; }
+
+  /// Matched stride, as an affine function of the parameters.  It is constant
+  /// for constant strides.
+  isl::aff stride;
+};
+
+inline size_t candidateHash(const StrideCandidate &) { return 0; }
+
+/**
+ * Strides of a set of accesses along each dimension of a partial schedule.
+ *
+ * For each dimension of the schedule taken separately, the domain of the
+ * accesses is replaced by this dimension and the stride of the last subscript
+ * is computed as for StridePattern in a dense schedule space: it is the
+ * constant difference between the subscripts accessed at subsequent values of
+ * the dimension, if any.  Relations with the same range space, e.g. untagged
+ * accesses to the same array from different statements, are considered as one
+ * access, as they would be by match() on the scheduled accesses.
+ *
+ * The profile is computed once.  Queries compare integers.
+ */
+class StrideProfile {
+public:
+  StrideProfile(isl::multi_union_pw_aff schedule, isl::union_map accesses);
+  /// Profile of the accesses along the members of a band node.
+  StrideProfile(isl::schedule_node band, isl::union_map accesses)
+      : StrideProfile(band.band_get_partial_schedule(), accesses) {}
+
+  int nDims() const { return nDims_; }
+  size_t nAccesses() const { return spaces_.size(); }
+  /// Range space of the relations of an access.
+  isl::space space(size_t access) const { return spaces_[access]; }
+
+  /// Whether "access" is performed for some value of "dim".
+  bool isAccessed(size_t access, int dim) const {
+    return accessed_[access * nDims_ + dim];
+  }
+  /// Constant stride of "access" along "dim", or a null value if the access
+  /// is not performed or has no constant stride.
+  isl::val stride(size_t access, int dim) const {
+    return strides_[access * nDims_ + dim];
+  }
+
+  /// Number of accesses performed for some value of "dim".
+  size_t nAccessed(int dim) const;
+  /// Number of accesses with the given constant stride along "dim".
+  size_t count(int dim, long stride) const;
+
+private:
+  // Position of "space" in spaces_, appended if it is not there yet.
+  size_t position(isl::space space);
+
+  int nDims_;
+  std::vector<isl::space> spaces_;
+  // Positions in spaces_, by tupleHash of the space.
+  std::unordered_map<uint64_t, std::vector<size_t>> spaceBuckets_;
+  std::vector<bool> accessed_;
+  std::vector<isl::val> strides_;
 };
 
 inline Placeholder<StrideCandidate, UnfixedOutDimPattern<StridePattern>>
@@ -272,6 +542,27 @@ stride(isl::ctx ctx, int s) {
       UnfixedOutDimPattern<StridePattern>(StridePattern(pattern)));
 }
 
+/// Placeholder for accesses with the given parametric stride, e.g. when
+/// consecutive relevant schedule points are "N" iterations apart.  "s" is an
+/// affine function of the parameters without integer divisions.
+inline Placeholder<StrideCandidate, UnfixedOutDimPattern<StridePattern>>
+stride(isl::aff s) {
+  StridePattern pattern(s.get_ctx());
+  pattern.parametricStride = s;
+  return Placeholder<StrideCandidate, UnfixedOutDimPattern<StridePattern>>(
+      UnfixedOutDimPattern<StridePattern>(pattern));
+}
+
+/// Placeholder for accesses with any stride that is an affine function of the
+/// parameters.  The stride is available in the candidate payload.
+inline Placeholder<StrideCandidate, UnfixedOutDimPattern<StridePattern>>
+anyStride(isl::ctx ctx) {
+  StridePattern pattern(ctx);
+  pattern.anyStride = true;
+  return Placeholder<StrideCandidate, UnfixedOutDimPattern<StridePattern>>(
+      UnfixedOutDimPattern<StridePattern>(pattern));
+}
+
 } // namespace matchers
 
 #endif
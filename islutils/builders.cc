@@ -1,6 +1,8 @@
 #include <isl/id.h>
 #include <islutils/builders.h>
+#include <islutils/tree_path.h>
 
+#include <algorithm>
 #include <cassert>
 
 namespace builders {
@@ -13,6 +15,10 @@ BandDescriptor::BandDescriptor(isl::schedule_node band) {
   }
   permutable =
       isl_schedule_node_band_get_permutable(band.get()) == isl_bool_true;
+  auto options = band.band_get_ast_build_options();
+  if (!options.is_empty()) {
+    astOptions = options;
+  }
 }
 
 isl::schedule_node
@@ -31,36 +37,135 @@ BandDescriptor::applyPropertiesToBandNode(isl::schedule_node node) {
   return node;
 }
 
+ScheduleNodeBuilder::ScheduleNodeBuilder() {
+  pushNode(isl_schedule_node_leaf, Payload(), 0, 0);
+}
+
+void ScheduleNodeBuilder::pushNode(isl_schedule_node_type type,
+                                   Payload &&payload, size_t firstChild,
+                                   size_t nChildren) {
+  nodes_.push_back(Node{type, std::move(payload), firstChild, nChildren});
+}
+
+size_t ScheduleNodeBuilder::append(ScheduleNodeBuilder &&other) {
+  if (nodes_.empty()) {
+    *this = std::move(other);
+    return nodes_.size() - 1;
+  }
+
+  size_t nodeOffset = nodes_.size();
+  size_t childOffset = childPositions_.size();
+  for (auto pos : other.childPositions_) {
+    childPositions_.push_back(pos + nodeOffset);
+  }
+  for (auto &node : other.nodes_) {
+    node.firstChild += childOffset;
+    nodes_.push_back(std::move(node));
+  }
+  other.nodes_.clear();
+  other.childPositions_.clear();
+  return nodes_.size() - 1;
+}
+
+ScheduleNodeBuilder ScheduleNodeBuilder::makeNode(isl_schedule_node_type type,
+                                                  Payload &&payload,
+                                                  ScheduleNodeBuilder &&child) {
+  // The arena of the only child becomes the arena of the result.
+  ScheduleNodeBuilder builder(std::move(child));
+  size_t firstChild = builder.childPositions_.size();
+  builder.childPositions_.push_back(builder.nodes_.size() - 1);
+  builder.pushNode(type, std::move(payload), firstChild, 1);
+  return builder;
+}
+
+ScheduleNodeBuilder
+ScheduleNodeBuilder::makeNode(isl_schedule_node_type type, Payload &&payload,
+                              std::vector<ScheduleNodeBuilder> &&children) {
+  ScheduleNodeBuilder builder;
+  builder.nodes_.clear();
+  std::vector<size_t> positions;
+  positions.reserve(children.size());
+  for (auto &child : children) {
+    positions.push_back(builder.append(std::move(child)));
+  }
+  size_t firstChild = builder.childPositions_.size();
+  builder.childPositions_.insert(builder.childPositions_.end(),
+                                 positions.begin(), positions.end());
+  builder.pushNode(type, std::move(payload), firstChild, positions.size());
+  return builder;
+}
+
+template <typename T>
+static T evaluate(const ScheduleNodeBuilder::Property<T> &property) {
+  if (auto value = std::get_if<0>(&property)) {
+    return *value;
+  }
+  return std::get<1>(property)();
+}
+
+// Value of the property of type T stored in "payload".
+template <typename T>
+static T payloadValue(const ScheduleNodeBuilder::Payload &payload) {
+  return evaluate(std::get<ScheduleNodeBuilder::Property<T>>(payload));
+}
+
+// Evaluate the expansion and contraction of an expansion node, computing the
+// one that is not provided from the other.
+static void
+evaluateExpansion(const ScheduleNodeBuilder::Expansion &properties,
+                  isl::union_map &expansion,
+                  isl::union_pw_multi_aff &contraction) {
+  if (properties.expansion && properties.contraction) {
+    expansion = evaluate(*properties.expansion);
+    contraction = evaluate(*properties.contraction);
+  } else if (properties.expansion) {
+    expansion = evaluate(*properties.expansion);
+    contraction = isl::union_pw_multi_aff(expansion.reverse());
+  } else if (properties.contraction) {
+    contraction = evaluate(*properties.contraction);
+    expansion = isl::union_map(contraction).reverse();
+  } else {
+    assert(false && "neither expansion nor contraction builder provided");
+  }
+
+  if (expansion.is_identity()) {
+    assert(false && "dentity expansion map will not lead to an expansion node");
+  }
+}
+
 isl_union_set_list *
-ScheduleNodeBuilder::collectChildFilters(isl::ctx ctx) const {
-  if (children_.empty()) {
+ScheduleNodeBuilder::collectChildFilters(size_t pos, isl::ctx ctx) const {
+  const auto &node = nodes_[pos];
+  if (node.nChildren == 0) {
     assert(false && "no children of a sequence/set node");
     return nullptr;
   }
 
   isl_union_set_list *list =
-      isl_union_set_list_alloc(ctx.get(), static_cast<int>(children_.size()));
+      isl_union_set_list_alloc(ctx.get(), static_cast<int>(node.nChildren));
 
-  for (const auto &c : children_) {
-    if (c.current_ != isl_schedule_node_filter) {
+  for (size_t i = 0; i < node.nChildren; ++i) {
+    const auto &c = nodes_[child(node, i)];
+    if (c.type != isl_schedule_node_filter) {
       assert(false && "children of sequence/set must be filters");
       return nullptr;
     }
 
-    isl_union_set *uset = c.usetBuilder_().release();
+    isl_union_set *uset = payloadValue<isl::union_set>(c.payload).release();
     list = isl_union_set_list_add(list, uset);
   }
   return list;
 }
 
 isl::schedule_node
-ScheduleNodeBuilder::insertSequenceOrSetAt(isl::schedule_node node,
-                                           isl_schedule_node_type type) const {
-  auto filterList = collectChildFilters(node.get_ctx());
-  if (type == isl_schedule_node_sequence) {
+ScheduleNodeBuilder::insertSequenceOrSetAt(size_t pos,
+                                           isl::schedule_node node) const {
+  const auto &current = nodes_[pos];
+  auto filterList = collectChildFilters(pos, node.get_ctx());
+  if (current.type == isl_schedule_node_sequence) {
     node = isl::manage(
         isl_schedule_node_insert_sequence(node.release(), filterList));
-  } else if (type == isl_schedule_node_set) {
+  } else if (current.type == isl_schedule_node_set) {
     node =
         isl::manage(isl_schedule_node_insert_set(node.release(), filterList));
   } else {
@@ -70,15 +175,15 @@ ScheduleNodeBuilder::insertSequenceOrSetAt(isl::schedule_node node,
   // so go to grandchildren directly. After collection took place, we know
   // children exist and they are all fitler types (probably lift that logic
   // here).
-  for (size_t i = 0, ei = children_.size(); i < ei; ++i) {
+  for (size_t i = 0, ei = current.nChildren; i < ei; ++i) {
     auto childNode = node.child(i);
-    const auto &childBuilder = children_.at(i);
-    if (childBuilder.children_.size() > 1) {
+    const auto &childBuilder = nodes_[child(current, i)];
+    if (childBuilder.nChildren > 1) {
       assert(false && "more than one child of a filter node");
       return isl::schedule_node();
-    } else if (childBuilder.children_.size() == 1) {
+    } else if (childBuilder.nChildren == 1) {
       auto grandChildNode = childNode.child(0);
-      grandChildNode = childBuilder.children_.at(0).insertAt(grandChildNode);
+      grandChildNode = insertAt(child(childBuilder, 0), grandChildNode);
       childNode = grandChildNode.parent();
     }
     node = childNode.parent();
@@ -86,31 +191,48 @@ ScheduleNodeBuilder::insertSequenceOrSetAt(isl::schedule_node node,
   return node;
 }
 
-isl::schedule_node ScheduleNodeBuilder::insertSingleChildTypeNodeAt(
-    isl::schedule_node node, isl_schedule_node_type type) const {
-  if (current_ == isl_schedule_node_band) {
-    auto bandDescriptor = bandBuilder_();
+isl::schedule_node
+ScheduleNodeBuilder::insertAbove(size_t pos, isl::schedule_node node) const {
+  const auto &current = nodes_[pos];
+  if (current.type == isl_schedule_node_band) {
+    auto bandDescriptor = payloadValue<BandDescriptor>(current.payload);
     node = node.insert_partial_schedule(bandDescriptor.partialSchedule);
     node = bandDescriptor.applyPropertiesToBandNode(node);
-  } else if (current_ == isl_schedule_node_filter) {
+  } else if (current.type == isl_schedule_node_filter) {
     // TODO: if the current node is pointing to a filter, filters are merged
     // document this in builder construction:
     // or type it so that filter cannot have filter children
-    node = node.insert_filter(usetBuilder_());
-  } else if (current_ == isl_schedule_node_context) {
-    node = node.insert_context(setBuilder_());
-  } else if (current_ == isl_schedule_node_domain) {
+    node = node.insert_filter(payloadValue<isl::union_set>(current.payload));
+  } else if (current.type == isl_schedule_node_context) {
+    node = node.insert_context(payloadValue<isl::set>(current.payload));
+  } else if (current.type == isl_schedule_node_guard) {
+    node = node.insert_guard(payloadValue<isl::set>(current.payload));
+  } else if (current.type == isl_schedule_node_mark) {
+    node = node.insert_mark(payloadValue<isl::id>(current.payload));
+  } else {
+    assert(false && "unsupported node type");
+  }
+  return node;
+}
+
+isl::schedule_node ScheduleNodeBuilder::insertSingleChildTypeNodeAt(
+    size_t pos, isl::schedule_node node) const {
+  const auto &current = nodes_[pos];
+  if (current.type == isl_schedule_node_band ||
+      current.type == isl_schedule_node_filter ||
+      current.type == isl_schedule_node_context ||
+      current.type == isl_schedule_node_guard ||
+      current.type == isl_schedule_node_mark) {
+    node = insertAbove(pos, node);
+  } else if (current.type == isl_schedule_node_domain) {
     if (node.get()) {
       assert(false && "cannot insert domain at some node, only at root "
                       "represented as nullptr");
       return isl::schedule_node();
     }
-    node = isl::schedule_node::from_domain(usetBuilder_());
-  } else if (current_ == isl_schedule_node_guard) {
-    node = node.insert_guard(setBuilder_());
-  } else if (current_ == isl_schedule_node_mark) {
-    node = node.insert_mark(idBuilder_());
-  } else if (current_ == isl_schedule_node_extension) {
+    node = isl::schedule_node::from_domain(
+        payloadValue<isl::union_set>(current.payload));
+  } else if (current.type == isl_schedule_node_extension) {
     // There is no way to directly insert an extension node in isl.
     // isl_schedule_node_graft_* functions insert an extension node followed by
     // a sequence with two filters (one for the original domain points and
@@ -118,7 +240,8 @@ isl::schedule_node ScheduleNodeBuilder::insertSingleChildTypeNodeAt(
     // below the filter with the original domain points.  Go back to the
     // introduced sequence node and remove it, letting any child subtree to be
     // constructed as usual.
-    auto extensionRoot = isl::schedule_node::from_extension(umapBuilder_());
+    auto extensionRoot = isl::schedule_node::from_extension(
+        payloadValue<isl::union_map>(current.payload));
     node = isl::manage(isl_schedule_node_graft_before(node.release(),
                                                       extensionRoot.release()))
                .parent()
@@ -127,35 +250,15 @@ isl::schedule_node ScheduleNodeBuilder::insertSingleChildTypeNodeAt(
     node = node.parent();
   }
 
-  if (children_.size() > 1) {
+  if (current.nChildren > 1) {
     assert(false && "more than one child of non-set/sequence node");
     return isl::schedule_node();
   }
   // Because of CoW, node can change so we cannot return it directly, we
   // rather recurse to children, take what was returned and take its parent.
-  return children_.empty() ? node
-                           : children_.at(0).insertAt(node.child(0)).parent();
-}
-
-// Depth-first search through the tree, returning first match using vector as
-// optional (empty vector means no match).
-static std::vector<isl::schedule_node>
-dfsFirst(isl::schedule_node root,
-         std::function<bool(isl::schedule_node)> matcher) {
-  if (matcher(root)) {
-    return {root};
-  }
-
-  for (int i = 0, e = root.n_children(); i < e; ++i) {
-    root = root.child(i);
-    auto result = dfsFirst(root, matcher);
-    if (!result.empty()) {
-      return result;
-    }
-    root = root.parent();
-  }
-
-  return {};
+  return current.nChildren == 0
+             ? node
+             : insertAt(child(current, 0), node.child(0)).parent();
 }
 
 // For a builder of expansion node, build a separate schedule tree starting at
@@ -164,29 +267,16 @@ dfsFirst(isl::schedule_node root,
 // Contraty to isl_schedule_node_group, this method does not modify the nodes
 // on the way to root and therefore is insensitive to anchoring problems.
 isl::schedule_node
-ScheduleNodeBuilder::expandTree(isl::schedule_node node) const {
-  if (current_ != isl_schedule_node_expansion) {
+ScheduleNodeBuilder::expandTree(size_t pos, isl::schedule_node node) const {
+  const auto &current = nodes_[pos];
+  if (current.type != isl_schedule_node_expansion) {
     assert(false && "only call expandTree on expansion builder");
   }
 
   isl::union_map expansion;
   isl::union_pw_multi_aff contraction;
-  if (umapBuilder_ && upmaBuilder_) {
-    expansion = umapBuilder_();
-    contraction = upmaBuilder_();
-  } else if (umapBuilder_) {
-    expansion = umapBuilder_();
-    contraction = isl::union_pw_multi_aff(expansion.reverse());
-  } else if (upmaBuilder_) {
-    contraction = upmaBuilder_();
-    expansion = isl::union_map(contraction).reverse();
-  } else {
-    assert(false && "neither expansion nor contraction builder provided");
-  }
-
-  if (expansion.is_identity()) {
-    assert(false && "dentity expansion map will not lead to an expansion node");
-  }
+  evaluateExpansion(std::get<Expansion>(current.payload), expansion,
+                    contraction);
 
   // Construct the domain of the new subtree by applying the expansion map to
   // the set of domain points active at the given leaf.
@@ -194,63 +284,55 @@ ScheduleNodeBuilder::expandTree(isl::schedule_node node) const {
   auto parentDomain = node.get_domain();
   auto childDomain = parentDomain.apply(expansion);
   auto childRoot = isl::schedule_node::from_domain(childDomain);
-  childRoot = children_.at(0).insertAt(childRoot.child(0)).parent();
-
-  // Insert a mark node so that we can find the position in the transformed
-  // tree (yes, this is quite ugly but seems to be the only way around CoW).
-  auto markBuilder = mark(
-      isl::id::alloc(node.get_ctx(), "__islutils_expand_builder", nullptr));
-  node = markBuilder.insertAt(node);
+  childRoot = insertAt(child(current, 0), childRoot.child(0)).parent();
 
-  // Transform the entire schedule and find the corresponding location by
-  // DFS-lookup of the mark node.  Remove the mark node and return its child
-  // (the newly inserted expansion node) for continuation.
+  // Transform the entire schedule and find the position of "node" again by
+  // following its path from the root.  isl_schedule_expand only extends the
+  // leaves of the tree, so the path remains valid and leads to the newly
+  // inserted expansion node, or to "node" itself if it is not a leaf.
+  auto path = util::pathFromRoot(node);
   auto schedule = node.get_schedule();
   schedule =
       isl::manage(isl_schedule_expand(schedule.release(), contraction.release(),
                                       childRoot.get_schedule().release()));
-  auto optionalNewNode =
-      dfsFirst(schedule.get_root(), [markBuilder](isl::schedule_node n) {
-        return isl_schedule_node_get_type(n.get()) == isl_schedule_node_mark &&
-               isl_schedule_node_mark_get_id(n.get()) ==
-                   markBuilder.idBuilder_().get();
-      });
-  if (optionalNewNode.empty()) {
-    assert(false && "could not find mark node after expansion");
-  }
-  node = optionalNewNode.at(0);
-  node = isl::manage(isl_schedule_node_delete(node.release()));
-  return node;
+  return util::followPath(schedule.get_root(), path);
 }
 
-// need to insert at child?
 isl::schedule_node
-ScheduleNodeBuilder::insertAt(isl::schedule_node node) const {
-  if (current_ == isl_schedule_node_band ||
-      current_ == isl_schedule_node_filter ||
-      current_ == isl_schedule_node_mark ||
-      current_ == isl_schedule_node_guard ||
-      current_ == isl_schedule_node_context ||
-      current_ == isl_schedule_node_domain ||
-      current_ == isl_schedule_node_extension) {
-    return insertSingleChildTypeNodeAt(node, current_);
-  } else if (current_ == isl_schedule_node_sequence ||
-             current_ == isl_schedule_node_set) {
-    return insertSequenceOrSetAt(node, current_);
-  } else if (current_ == isl_schedule_node_expansion) {
-    return expandTree(node);
-  } else if (current_ == isl_schedule_node_leaf) {
+ScheduleNodeBuilder::insertAt(size_t pos, isl::schedule_node node) const {
+  const auto &current = nodes_[pos];
+  auto type = current.type;
+  if (type == isl_schedule_node_band || type == isl_schedule_node_filter ||
+      type == isl_schedule_node_mark || type == isl_schedule_node_guard ||
+      type == isl_schedule_node_context || type == isl_schedule_node_domain ||
+      type == isl_schedule_node_extension) {
+    return insertSingleChildTypeNodeAt(pos, node);
+  } else if (type == isl_schedule_node_sequence ||
+             type == isl_schedule_node_set) {
+    return insertSequenceOrSetAt(pos, node);
+  } else if (type == isl_schedule_node_expansion) {
+    return expandTree(pos, node);
+  } else if (type == isl_schedule_node_leaf) {
     // Leaf is a special type in isl that has no children, it gets added
     // automatically, i.e. there is no need to insert it. Double-check that
     // there are no children and stop here.
-    if (!children_.empty()) {
+    if (current.nChildren != 0) {
       assert(false && "leaf builder has children");
       return isl::schedule_node();
     }
     // If lazy-evaluation subtree builder is provided for the leaf node, call
     // it, otherwise just return the current node.
-    if (subBuilder_) {
-      return subBuilder_().insertAt(node);
+    if (auto callback = std::get_if<SubtreeCallback>(&current.payload)) {
+      return (*callback)().insertAt(node);
+    }
+    // A subtree spliced at its own position is already in place.
+    if (auto spliced = std::get_if<const isl::schedule_node *>(
+            &current.payload)) {
+      if (node.get() && isl_schedule_node_is_equal(
+                            node.get(), (*spliced)->get()) == isl_bool_true) {
+        return node;
+      }
+      return subtreeBuilder(**spliced).insertAt(node);
     }
     return node;
   }
@@ -259,8 +341,436 @@ ScheduleNodeBuilder::insertAt(isl::schedule_node node) const {
   return isl::schedule_node();
 }
 
+// Payload holding a property that is known when the builder is constructed.
+template <typename T> static ScheduleNodeBuilder::Payload value(T t) {
+  return ScheduleNodeBuilder::Property<T>(std::in_place_index<0>,
+                                          std::move(t));
+}
+
+// Payload holding a function object that creates the property when the tree
+// is built.
+template <typename T>
+static ScheduleNodeBuilder::Payload lazy(std::function<T()> callback) {
+  return ScheduleNodeBuilder::Property<T>(std::in_place_index<1>,
+                                          std::move(callback));
+}
+
+// Value-only copy of "payload" with all properties evaluated.
+static ScheduleNodeBuilder::Payload
+evaluatedPayload(const ScheduleNodeBuilder::Payload &payload) {
+  using BandProperty = ScheduleNodeBuilder::Property<BandDescriptor>;
+  if (auto band = std::get_if<BandProperty>(&payload)) {
+    return value(evaluate(*band));
+  } else if (auto set =
+                 std::get_if<ScheduleNodeBuilder::Property<isl::set>>(
+                     &payload)) {
+    return value(evaluate(*set));
+  } else if (auto uset =
+                 std::get_if<ScheduleNodeBuilder::Property<isl::union_set>>(
+                     &payload)) {
+    return value(evaluate(*uset));
+  } else if (auto umap =
+                 std::get_if<ScheduleNodeBuilder::Property<isl::union_map>>(
+                     &payload)) {
+    return value(evaluate(*umap));
+  } else if (auto id = std::get_if<ScheduleNodeBuilder::Property<isl::id>>(
+                 &payload)) {
+    return value(evaluate(*id));
+  } else if (auto properties =
+                 std::get_if<ScheduleNodeBuilder::Expansion>(&payload)) {
+    isl::union_map expansion;
+    isl::union_pw_multi_aff contraction;
+    evaluateExpansion(*properties, expansion, contraction);
+    ScheduleNodeBuilder::Expansion result;
+    result.expansion.emplace(std::in_place_index<0>, expansion);
+    result.contraction.emplace(std::in_place_index<0>, contraction);
+    return result;
+  }
+  return ScheduleNodeBuilder::Payload();
+}
+
+size_t ScheduleNodeBuilder::resolve(size_t pos,
+                                    ScheduleNodeBuilder &out) const {
+  const auto &current = nodes_[pos];
+  if (auto callback = std::get_if<SubtreeCallback>(&current.payload)) {
+    auto builder = (*callback)();
+    return builder.resolve(builder.nodes_.size() - 1, out);
+  }
+  if (auto spliced =
+          std::get_if<const isl::schedule_node *>(&current.payload)) {
+    auto builder = subtreeBuilder(**spliced);
+    return builder.resolve(builder.nodes_.size() - 1, out);
+  }
+
+  std::vector<size_t> positions;
+  positions.reserve(current.nChildren);
+  for (size_t i = 0; i < current.nChildren; ++i) {
+    positions.push_back(resolve(child(current, i), out));
+  }
+  size_t firstChild = out.childPositions_.size();
+  out.childPositions_.insert(out.childPositions_.end(), positions.begin(),
+                             positions.end());
+  out.pushNode(current.type, evaluatedPayload(current.payload), firstChild,
+               positions.size());
+  return out.nodes_.size() - 1;
+}
+
+static bool hasUserPointer(isl_id *id) {
+  bool result = id && isl_id_get_user(id);
+  isl_id_free(id);
+  return result;
+}
+
+// Whether any identifier of "space", including those of nested spaces, has a
+// user pointer.  Takes "space".
+static bool hasUserIds(isl_space *space) {
+  bool result = false;
+  bool isParams = isl_space_is_params(space) == isl_bool_true;
+  bool isSet = isParams || isl_space_is_set(space) == isl_bool_true;
+  for (auto type : {isl_dim_param, isl_dim_in, isl_dim_out}) {
+    if ((isSet && type == isl_dim_in) || (isParams && type != isl_dim_param)) {
+      continue;
+    }
+    for (int i = 0, e = isl_space_dim(space, type); i < e && !result; ++i) {
+      result = isl_space_has_dim_id(space, type, i) == isl_bool_true &&
+               hasUserPointer(isl_space_get_dim_id(space, type, i));
+    }
+    if (type != isl_dim_param && !result &&
+        isl_space_has_tuple_id(space, type) == isl_bool_true) {
+      result = hasUserPointer(isl_space_get_tuple_id(space, type));
+    }
+  }
+  if (!result && isSet && isl_space_is_wrapping(space) == isl_bool_true) {
+    result = hasUserIds(isl_space_unwrap(isl_space_copy(space)));
+  } else if (!result && !isSet) {
+    result = hasUserIds(isl_space_domain(isl_space_copy(space))) ||
+             hasUserIds(isl_space_range(isl_space_copy(space)));
+  }
+  isl_space_free(space);
+  return result;
+}
+
+static bool hasUserIds(isl::union_set uset) {
+  bool result = false;
+  uset.foreach_set([&result](isl::set set) {
+    result = result || hasUserIds(isl_set_get_space(set.get()));
+    return isl_stat_ok;
+  });
+  return result;
+}
+
+static bool hasUserIds(isl::union_map umap) {
+  bool result = false;
+  umap.foreach_map([&result](isl::map map) {
+    result = result || hasUserIds(isl_map_get_space(map.get()));
+    return isl_stat_ok;
+  });
+  return result;
+}
+
+// Whether the evaluated "payload" contains identifiers with user pointers
+// other than the identifier of a mark.
+static bool hasUserIds(const ScheduleNodeBuilder::Payload &payload) {
+  using BandProperty = ScheduleNodeBuilder::Property<BandDescriptor>;
+  if (auto band = std::get_if<BandProperty>(&payload)) {
+    const auto &descriptor = std::get<0>(*band);
+    auto schedule = descriptor.partialSchedule;
+    return hasUserIds(isl_multi_union_pw_aff_get_space(schedule.get())) ||
+           hasUserIds(isl::manage(
+               isl_multi_union_pw_aff_domain(schedule.copy()))) ||
+           (!descriptor.astOptions.is_null() &&
+            hasUserIds(descriptor.astOptions));
+  } else if (auto set =
+                 std::get_if<ScheduleNodeBuilder::Property<isl::set>>(
+                     &payload)) {
+    return hasUserIds(isl_set_get_space(std::get<0>(*set).get()));
+  } else if (auto uset =
+                 std::get_if<ScheduleNodeBuilder::Property<isl::union_set>>(
+                     &payload)) {
+    return hasUserIds(std::get<0>(*uset));
+  } else if (auto umap =
+                 std::get_if<ScheduleNodeBuilder::Property<isl::union_map>>(
+                     &payload)) {
+    return hasUserIds(std::get<0>(*umap));
+  } else if (auto properties =
+                 std::get_if<ScheduleNodeBuilder::Expansion>(&payload)) {
+    return hasUserIds(std::get<0>(*properties->expansion));
+  }
+  return false;
+}
+
+struct ScheduleNodeBuilder::Description {
+  isl_ctx *ctx = nullptr;
+  // Child positions leading from the root to the described node.
+  std::vector<int> path;
+  // Marks with identifiers carrying a user pointer, which the text cannot
+  // convey, and their positions.
+  std::vector<std::pair<std::vector<int>, isl::id>> marks;
+};
+
+static void appendQuoted(std::string &out, const std::string &str) {
+  out += '"';
+  out += str;
+  out += '"';
+}
+
+// Append the description of the node at "pos" and its subtree to "out", as
+// the entries of a YAML mapping understood by isl_schedule_read_from_str.
+// Only called on resolved builders.  Leaves are described by no entries.
+void ScheduleNodeBuilder::describe(size_t pos, std::string &out,
+                                   Description &description) const {
+  const auto &current = nodes_[pos];
+  auto type = current.type;
+  if (type == isl_schedule_node_leaf) {
+    if (current.nChildren != 0) {
+      assert(false && "leaf builder has children");
+    }
+    return;
+  }
+
+  auto &path = description.path;
+  if (type == isl_schedule_node_sequence || type == isl_schedule_node_set) {
+    if (current.nChildren == 0) {
+      assert(false && "no children of a sequence/set node");
+    }
+    out += type == isl_schedule_node_sequence ? "sequence: [ " : "set: [ ";
+    for (size_t i = 0; i < current.nChildren; ++i) {
+      auto childPos = child(current, i);
+      if (nodes_[childPos].type != isl_schedule_node_filter) {
+        assert(false && "children of sequence/set must be filters");
+      }
+      path.push_back(static_cast<int>(i));
+      out += i == 0 ? "{ " : ", { ";
+      describe(childPos, out, description);
+      out += " }";
+      path.pop_back();
+    }
+    out += " ]";
+    return;
+  }
+
+  if (type == isl_schedule_node_domain) {
+    if (!path.empty()) {
+      assert(false && "cannot insert domain at some node, only at root");
+    }
+    auto domain = payloadValue<isl::union_set>(current.payload);
+    description.ctx = domain.get_ctx().get();
+    out += "domain: ";
+    appendQuoted(out, domain.to_str());
+  } else if (type == isl_schedule_node_band) {
+    const auto &descriptor =
+        std::get<0>(std::get<Property<BandDescriptor>>(current.payload));
+    out += "schedule: ";
+    appendQuoted(out, descriptor.partialSchedule.to_str());
+    if (descriptor.permutable) {
+      out += ", permutable: 1";
+    }
+    if (!descriptor.coincident.empty()) {
+      out += ", coincident: [ ";
+      for (size_t i = 0, e = descriptor.coincident.size(); i < e; ++i) {
+        out += i == 0 ? "" : ", ";
+        out += descriptor.coincident[i] ? '1' : '0';
+      }
+      out += " ]";
+    }
+    if (!descriptor.astOptions.is_null()) {
+      out += ", options: ";
+      appendQuoted(out, descriptor.astOptions.to_str());
+    }
+  } else if (type == isl_schedule_node_filter) {
+    out += "filter: ";
+    appendQuoted(out, payloadValue<isl::union_set>(current.payload).to_str());
+  } else if (type == isl_schedule_node_context) {
+    out += "context: ";
+    appendQuoted(out, payloadValue<isl::set>(current.payload).to_str());
+  } else if (type == isl_schedule_node_guard) {
+    out += "guard: ";
+    appendQuoted(out, payloadValue<isl::set>(current.payload).to_str());
+  } else if (type == isl_schedule_node_mark) {
+    auto id = payloadValue<isl::id>(current.payload);
+    if (id.get_user()) {
+      description.marks.emplace_back(path, id);
+    }
+    out += "mark: ";
+    appendQuoted(out, id.get_name());
+  } else if (type == isl_schedule_node_extension) {
+    out += "extension: ";
+    appendQuoted(out, payloadValue<isl::union_map>(current.payload).to_str());
+  } else if (type == isl_schedule_node_expansion) {
+    const auto &properties = std::get<Expansion>(current.payload);
+    out += "contraction: ";
+    appendQuoted(out, evaluate(*properties.contraction).to_str());
+    out += ", expansion: ";
+    appendQuoted(out, evaluate(*properties.expansion).to_str());
+  } else {
+    assert(false && "unsupported node type");
+    return;
+  }
+
+  if (current.nChildren > 1) {
+    assert(false && "more than one child of non-set/sequence node");
+  } else if (current.nChildren == 1 &&
+             nodes_[child(current, 0)].type != isl_schedule_node_leaf) {
+    path.push_back(0);
+    out += ", child: { ";
+    describe(child(current, 0), out, description);
+    out += " }";
+    path.pop_back();
+  }
+}
+
+// Build the tree of a domain-rooted builder.  Properties are evaluated once,
+// while resolving the builder.  If they do not contain identifiers with user
+// pointers, isl reads a description of the resolved builder, which takes time
+// linear in the size of the tree.  Marks whose identifiers carry user pointers
+// are read with fresh identifiers and are replaced afterwards.  Otherwise, or
+// if isl fails to read the description, the resolved builder is inserted node
+// by node.
+isl::schedule_node ScheduleNodeBuilder::buildFromDescription() const {
+  ScheduleNodeBuilder resolved;
+  resolved.nodes_.clear();
+  size_t root = resolve(nodes_.size() - 1, resolved);
+
+  bool describable = true;
+  for (const auto &node : resolved.nodes_) {
+    if (hasUserIds(node.payload)) {
+      describable = false;
+      break;
+    }
+  }
+
+  isl::schedule schedule;
+  Description description;
+  if (describable) {
+    std::string text = "{ ";
+    resolved.describe(root, text, description);
+    text += " }";
+    schedule = isl::manage(
+        isl_schedule_read_from_str(description.ctx, text.c_str()));
+  }
+  if (schedule.is_null()) {
+    return resolved.insertAt(root, isl::schedule_node());
+  }
+
+  auto rootNode = schedule.get_root();
+  for (const auto &mark : description.marks) {
+    auto node = util::followPath(rootNode, mark.first);
+    node = isl::manage(isl_schedule_node_delete(node.release()));
+    rootNode = node.insert_mark(mark.second).root();
+  }
+  return rootNode;
+}
+
+// need to insert at child?
+isl::schedule_node
+ScheduleNodeBuilder::insertAt(isl::schedule_node node) const {
+  if (!node.get() && type() == isl_schedule_node_domain) {
+    return buildFromDescription();
+  }
+  return insertAt(nodes_.size() - 1, node);
+}
+
+// Whether nodes of this type can be inserted above and deleted from an
+// existing tree without affecting their children.
+static bool isReplaceableInPlace(isl_schedule_node_type type) {
+  return type == isl_schedule_node_band || type == isl_schedule_node_filter ||
+         type == isl_schedule_node_context ||
+         type == isl_schedule_node_guard || type == isl_schedule_node_mark;
+}
+
+static bool hasSetOrSequenceParent(isl::schedule_node node) {
+  if (!node.has_parent()) {
+    return false;
+  }
+  auto type = isl_schedule_node_get_parent_type(node.get());
+  return type == isl_schedule_node_sequence || type == isl_schedule_node_set;
+}
+
+// Whether the subtree rooted at "node" contains nodes that depend on the
+// prefix schedule, e.g. extension nodes.  isl neither inserts nor deletes
+// band nodes above such subtrees.
+static bool isAnchored(isl::schedule_node node) {
+  return isl_schedule_node_is_subtree_anchored(node.get()) == isl_bool_true;
+}
+
+// Number of generations between "node" and its descendant "spliced" if all
+// nodes in between, starting at "node", can be replaced in place, or -1
+// otherwise.
+static int splicedGeneration(isl::schedule_node node,
+                             isl::schedule_node spliced) {
+  if (node.get_schedule().get() != spliced.get_schedule().get()) {
+    return -1;
+  }
+  auto nodePath = util::pathFromRoot(node);
+  auto splicedPath = util::pathFromRoot(spliced);
+  if (splicedPath.size() < nodePath.size() ||
+      !std::equal(nodePath.begin(), nodePath.end(), splicedPath.begin())) {
+    return -1;
+  }
+  int generation = static_cast<int>(splicedPath.size() - nodePath.size());
+  bool hasBand = false;
+  for (int i = 0; i < generation; ++i) {
+    auto type = isl_schedule_node_get_type(node.get());
+    if (!isReplaceableInPlace(type) || node.n_children() != 1) {
+      return -1;
+    }
+    hasBand = hasBand || type == isl_schedule_node_band;
+    node = node.child(0);
+  }
+  if (hasBand && isAnchored(spliced)) {
+    return -1;
+  }
+  return generation;
+}
+
+isl::schedule_node
+ScheduleNodeBuilder::replace(isl::schedule_node node) const {
+  ReplacedLevels levels;
+  return replace(node, levels);
+}
+
+isl::schedule_node
+ScheduleNodeBuilder::replace(isl::schedule_node node,
+                             ReplacedLevels &levels) const {
+  // Collect the chain of nodes above a spliced leaf.
+  std::vector<size_t> chain;
+  size_t pos = nodes_.size() - 1;
+  while (isReplaceableInPlace(nodes_[pos].type) && nodes_[pos].nChildren == 1) {
+    chain.push_back(pos);
+    pos = child(nodes_[pos], 0);
+  }
+  auto spliced = std::get_if<const isl::schedule_node *>(&nodes_[pos].payload);
+  int generation = spliced ? splicedGeneration(node, **spliced) : -1;
+  bool insertsBand =
+      std::any_of(chain.begin(), chain.end(), [this](size_t position) {
+        return nodes_[position].type == isl_schedule_node_band;
+      });
+  // Nothing can be inserted or deleted between a set or a sequence and its
+  // children.  Cutting the tree and inserting the new subtree at the leaf
+  // also works for anchored subtrees.
+  if (generation < 0 ||
+      ((generation > 0 || !chain.empty()) && hasSetOrSequenceParent(node)) ||
+      (insertsBand && isAnchored(**spliced))) {
+    levels = {-1, -1};
+    return insertAt(node.cut());
+  }
+  levels = {generation, static_cast<int>(chain.size())};
+
+  // Insert the new chain above the spliced subtree, from the bottom up, and
+  // delete the old nodes above it.  Deleting a node leaves the position
+  // pointing to its only child.
+  node = util::followPath(node, util::TreePath(generation, 0));
+  for (auto it = chain.rbegin(), e = chain.rend(); it != e; ++it) {
+    node = insertAbove(*it, node);
+  }
+  for (int i = 0; i < generation; ++i) {
+    node = isl::manage(isl_schedule_node_delete(node.parent().release()));
+  }
+  return node;
+}
+
 isl::schedule_node ScheduleNodeBuilder::build() const {
-  if (current_ != isl_schedule_node_domain) {
+  if (type() != isl_schedule_node_domain) {
     assert(false && "can only build trees with a domain node as root");
     return isl::schedule_node();
   }
@@ -269,136 +779,174 @@ isl::schedule_node ScheduleNodeBuilder::build() const {
 
 ScheduleNodeBuilder domain(std::function<isl::union_set()> callback,
                            ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_domain;
-  builder.usetBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_domain,
+                                       lazy(std::move(callback)),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder domain(isl::union_set uset, ScheduleNodeBuilder &&child) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_domain, value(uset),
+                                       std::move(child));
 }
 
 ScheduleNodeBuilder band(std::function<BandDescriptor()> callback,
                          ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_band;
-  builder.bandBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_band,
+                                       lazy(std::move(callback)),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder band(BandDescriptor descr, ScheduleNodeBuilder &&child) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_band,
+                                       value(std::move(descr)),
+                                       std::move(child));
 }
 
 ScheduleNodeBuilder filter(std::function<isl::union_set()> callback,
                            ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_filter;
-  builder.usetBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_filter,
+                                       lazy(std::move(callback)),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder filter(isl::union_set uset, ScheduleNodeBuilder &&child) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_filter, value(uset),
+                                       std::move(child));
 }
 
 ScheduleNodeBuilder extension(std::function<isl::union_map()> callback,
                               ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_extension;
-  builder.umapBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_extension,
+                                       lazy(std::move(callback)),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder extension(isl::union_map umap,
+                              ScheduleNodeBuilder &&child) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_extension,
+                                       value(umap), std::move(child));
 }
 
 ScheduleNodeBuilder expansion(std::function<isl::union_map()> callback,
                               ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_expansion;
-  builder.umapBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  ScheduleNodeBuilder::Expansion properties;
+  properties.expansion.emplace(std::in_place_index<1>, std::move(callback));
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_expansion,
+                                       std::move(properties),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder expansion(isl::union_map umap,
+                              ScheduleNodeBuilder &&child) {
+  ScheduleNodeBuilder::Expansion properties;
+  properties.expansion.emplace(std::in_place_index<0>, umap);
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_expansion,
+                                       std::move(properties),
+                                       std::move(child));
 }
 
 ScheduleNodeBuilder mark(std::function<isl::id()> callback,
                          ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_mark;
-  builder.idBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_mark,
+                                       lazy(std::move(callback)),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder mark(isl::id id, ScheduleNodeBuilder &&child) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_mark, value(id),
+                                       std::move(child));
 }
 
 ScheduleNodeBuilder guard(std::function<isl::set()> callback,
                           ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_guard;
-  builder.setBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_guard,
+                                       lazy(std::move(callback)),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder guard(isl::set set, ScheduleNodeBuilder &&child) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_guard, value(set),
+                                       std::move(child));
 }
 
 ScheduleNodeBuilder context(std::function<isl::set()> callback,
                             ScheduleNodeBuilder &&child) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_context;
-  builder.setBuilder_ = callback;
-  builder.children_.emplace_back(child);
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_context,
+                                       lazy(std::move(callback)),
+                                       std::move(child));
+}
+
+ScheduleNodeBuilder context(isl::set set, ScheduleNodeBuilder &&child) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_context, value(set),
+                                       std::move(child));
 }
 
 ScheduleNodeBuilder sequence(std::vector<ScheduleNodeBuilder> &&children) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_sequence;
-  builder.children_ = children;
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_sequence,
+                                       ScheduleNodeBuilder::Payload(),
+                                       std::move(children));
 }
 
 ScheduleNodeBuilder set(std::vector<ScheduleNodeBuilder> &&children) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_set;
-  builder.children_ = children;
-  return builder;
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_set,
+                                       ScheduleNodeBuilder::Payload(),
+                                       std::move(children));
 }
 
 ScheduleNodeBuilder subtreeBuilder(isl::schedule_node node) {
-  ScheduleNodeBuilder builder;
   auto type = isl_schedule_node_get_type(node.get());
 
+  int nChildren = isl_schedule_node_n_children(node.get());
+  std::vector<ScheduleNodeBuilder> children;
+  children.reserve(nChildren);
+  for (int i = 0; i < nChildren; ++i) {
+    children.push_back(subtreeBuilder(node.child(i)));
+  }
+
+  // Nodes are immutable, so their properties are stored directly.
+  ScheduleNodeBuilder::Payload payload;
   if (type == isl_schedule_node_domain) {
-    builder = domain([node]() { return node.domain_get_domain(); });
+    payload = value(node.domain_get_domain());
   } else if (type == isl_schedule_node_filter) {
-    builder = filter([node]() { return node.filter_get_filter(); });
+    payload = value(node.filter_get_filter());
   } else if (type == isl_schedule_node_context) {
-    builder = context([node]() { return node.context_get_context(); });
+    payload = value(node.context_get_context());
   } else if (type == isl_schedule_node_guard) {
-    builder = guard([node]() { return node.guard_get_guard(); });
+    payload = value(node.guard_get_guard());
   } else if (type == isl_schedule_node_mark) {
-    builder = mark([node]() { return node.mark_get_id(); });
+    payload = value(node.mark_get_id());
   } else if (type == isl_schedule_node_band) {
-    builder = band(
-        [node]() { return BandDescriptor(node.band_get_partial_schedule()); });
+    payload = value(BandDescriptor(node));
   } else if (type == isl_schedule_node_extension) {
-    builder = extension([node]() { return node.extension_get_extension(); });
+    payload = value(node.extension_get_extension());
   } else if (type == isl_schedule_node_expansion) {
-    builder.current_ = type;
-    builder.umapBuilder_ = [node]() { return node.expansion_get_expansion(); };
-    builder.upmaBuilder_ = [node]() {
-      return node.expansion_get_contraction();
-    };
+    ScheduleNodeBuilder::Expansion properties;
+    properties.expansion.emplace(std::in_place_index<0>,
+                                 node.expansion_get_expansion());
+    properties.contraction.emplace(std::in_place_index<0>,
+                                   node.expansion_get_contraction());
+    payload = std::move(properties);
   } else if (type == isl_schedule_node_sequence ||
              type == isl_schedule_node_set || type == isl_schedule_node_leaf) {
     /* no payload */
-    builder.current_ = type;
   } else {
     assert(false && "unhandled node type");
   }
 
-  int nChildren = isl_schedule_node_n_children(node.get());
-  builder.children_.clear();
-  for (int i = 0; i < nChildren; ++i) {
-    builder.children_.push_back(subtreeBuilder(node.child(i)));
-  }
+  return ScheduleNodeBuilder::makeNode(type, std::move(payload),
+                                       std::move(children));
+}
 
-  return builder;
+ScheduleNodeBuilder splice(isl::schedule_node &node) {
+  return ScheduleNodeBuilder::makeNode(isl_schedule_node_leaf, &node,
+                                       std::vector<ScheduleNodeBuilder>());
 }
 
 ScheduleNodeBuilder subtree(std::function<ScheduleNodeBuilder()> callback) {
-  ScheduleNodeBuilder builder;
-  builder.subBuilder_ = callback;
-  return builder;
+  return ScheduleNodeBuilder::makeNode(
+      isl_schedule_node_leaf,
+      ScheduleNodeBuilder::SubtreeCallback(std::move(callback)),
+      std::vector<ScheduleNodeBuilder>());
 }
 
 } // namespace builders
@@ -4,6 +4,12 @@
 #include <isl/isl-noexceptions.h>
 #include <isl/id.h>
 
+#include <functional>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include <vector>
 
 /** \defgroup Builders Schedule Tree Builders
@@ -46,13 +52,16 @@ public:
  * think of it as essentially a different implementation of schedule trees
  * convertible to the one provided by isl.
  *
- * Instead of storing the data members directly, the class stores function
- * objects that create the properties of individual tree nodes.  This choice is
- * motivated by the declarative lazy-evaluation API around schedule tree
- * builders: when a builder is constructed, it may serve as a template for
- * multiple trees, and the data members for these trees may not exist yet.
- * This is, for example, the case when builders are used to reconstruct
- * (sub)trees captured by schedule tree matchers in an iterative fashion.
+ * Each node stores the property of its type, e.g. the partial schedule of a
+ * band or the filter set of a filter, in a single variant payload.  A
+ * property is either stored directly, if it is known when the builder is
+ * constructed, or as a function object that creates it when the tree is
+ * built.  The latter supports the declarative lazy-evaluation API around
+ * schedule tree builders: when a builder is constructed, it may serve as a
+ * template for multiple trees, and the data members for these trees may not
+ * exist yet.  This is, for example, the case when builders are used to
+ * reconstruct (sub)trees captured by schedule tree matchers in an iterative
+ * fashion.
  *
  * Although each property-creation function object will be called at most once
  * during tree construction, one should take care when using non-idempotent
@@ -65,38 +74,140 @@ public:
  * and then running it to insert nodes at a leaf.  Following the
  * lazy-evaluation principle, ScheduleNodeBuilder stores a function object that
  * is called to create the subtree builder.
+ *
+ * Builders are move-only.  All nodes of a builder are stored in one arena,
+ * children before their parents, with the root last.  Constructing a parent
+ * node moves the arena of its first child into the parent and appends the
+ * arenas of the other children, so that building a tree bottom-up neither
+ * copies nor allocates per node.
+ *
+ * Only build(), and insertAt() with a null node, construct the tree from a
+ * textual description: the domain-rooted builder is described in the YAML
+ * format of isl schedule trees and the description is read by isl at once.
+ * If a property contains identifiers with user pointers, which the text
+ * cannot convey, the tree is constructed node by node instead.  Insertion
+ * below an existing node, including replace() and therefore rewrites, always
+ * inserts node by node, so that its cost grows with the depth of the
+ * inserted tree times the cost of a copy-on-write step.  isl only grafts a
+ * tree read separately through isl_schedule_expand, as expandTree() does for
+ * expansion builders, which puts an expansion node above the grafted tree.
  */
 class ScheduleNodeBuilder {
-private:
-  isl_union_set_list *collectChildFilters(isl::ctx) const;
-  isl::schedule_node insertSequenceOrSetAt(isl::schedule_node,
-                                           isl_schedule_node_type type) const;
-  isl::schedule_node
-  insertSingleChildTypeNodeAt(isl::schedule_node,
-                              isl_schedule_node_type type) const;
-
-  isl::schedule_node expandTree(isl::schedule_node) const;
-
 public:
-  ScheduleNodeBuilder() : current_(isl_schedule_node_leaf) {}
+  /// Node property, stored directly or created by a function object when the
+  /// tree is built.
+  template <typename T> using Property = std::variant<T, std::function<T()>>;
+
+  /// Expansion and contraction of an expansion node, either of which may be
+  /// computed from the other.
+  struct Expansion {
+    std::optional<Property<isl::union_map>> expansion;
+    std::optional<Property<isl::union_pw_multi_aff>> contraction;
+  };
+
+  /// Function object creating the builder of the subtree inserted at a leaf.
+  using SubtreeCallback = std::function<ScheduleNodeBuilder()>;
+
+  /// Payload of a node: none for sequence, set and plain leaf nodes, band
+  /// descriptor for bands, set for contexts and guards, union set for domains
+  /// and filters, union map for extensions, identifier for marks, expansion
+  /// for expansions, subtree callback for leaves replaced by subtrees, and
+  /// pointer to the root of an existing subtree for leaves replaced by it.
+  using Payload =
+      std::variant<std::monostate, Property<BandDescriptor>, Property<isl::set>,
+                   Property<isl::union_set>, Property<isl::union_map>,
+                   Property<isl::id>, Expansion, SubtreeCallback,
+                   const isl::schedule_node *>;
+
+  /// Leaf builder.
+  ScheduleNodeBuilder();
+  ScheduleNodeBuilder(ScheduleNodeBuilder &&) = default;
+  ScheduleNodeBuilder &operator=(ScheduleNodeBuilder &&) = default;
+  ScheduleNodeBuilder(const ScheduleNodeBuilder &) = delete;
+  ScheduleNodeBuilder &operator=(const ScheduleNodeBuilder &) = delete;
+
+  /// Builder of a node of the given type with the given payload and
+  /// children.  The children are moved into the result.
+  static ScheduleNodeBuilder makeNode(isl_schedule_node_type type,
+                                      Payload &&payload,
+                                      ScheduleNodeBuilder &&child);
+  static ScheduleNodeBuilder
+  makeNode(isl_schedule_node_type type, Payload &&payload,
+           std::vector<ScheduleNodeBuilder> &&children);
 
   isl::schedule_node insertAt(isl::schedule_node node) const;
   isl::schedule_node build() const;
 
-public:
-  isl_schedule_node_type current_;
-  std::vector<ScheduleNodeBuilder> children_;
-
-  // XXX: Cannot use a union because C++ isl types have non-trivial
-  // constructors.  Cannot use std::variant because no C++17.
-  std::function<BandDescriptor()> bandBuilder_;
-  std::function<isl::set()> setBuilder_;
-  std::function<isl::union_set()> usetBuilder_;
-  std::function<isl::union_map()> umapBuilder_;
-  std::function<isl::union_pw_multi_aff()> upmaBuilder_;
-  std::function<isl::id()> idBuilder_;
-
-  std::function<ScheduleNodeBuilder()> subBuilder_;
+  /// Replace the subtree rooted at "node" by the tree built by this builder
+  /// and return the root of the new subtree.  If the builder is a chain of
+  /// band, filter, context, guard and mark nodes ending in a subtree spliced
+  /// from below "node" through such nodes, only the nodes above the spliced
+  /// subtree are replaced; the spliced subtree is kept in place, shared with
+  /// the original tree.  Bands are not replaced in place above subtrees
+  /// anchored at the prefix schedule, e.g. containing extension nodes.
+  /// Otherwise, the subtree is cut and the builder is inserted at the
+  /// resulting leaf.
+  isl::schedule_node replace(isl::schedule_node node) const;
+
+  /// Number of levels of the original subtree deleted by replace() and of the
+  /// new subtree inserted in their place, above the spliced subtree.  Both
+  /// are -1 if the entire subtree was replaced.
+  struct ReplacedLevels {
+    int deleted;
+    int inserted;
+  };
+  /// Same as above, also storing in "levels" which part of the subtree was
+  /// replaced.
+  isl::schedule_node replace(isl::schedule_node node,
+                             ReplacedLevels &levels) const;
+
+  /// Type of the root node.
+  isl_schedule_node_type type() const { return root().type; }
+  /// Number of nodes in the builder, not counting those created by subtree
+  /// callbacks.
+  size_t size() const { return nodes_.size(); }
+
+private:
+  struct Node {
+    isl_schedule_node_type type;
+    Payload payload;
+    // Children are childPositions_[firstChild, firstChild + nChildren).
+    size_t firstChild;
+    size_t nChildren;
+  };
+
+  const Node &root() const { return nodes_.back(); }
+  size_t child(const Node &node, size_t i) const {
+    return childPositions_[node.firstChild + i];
+  }
+  // Move the nodes of "other" into this arena and return the position of its
+  // root.
+  size_t append(ScheduleNodeBuilder &&other);
+  void pushNode(isl_schedule_node_type type, Payload &&payload,
+                size_t firstChild, size_t nChildren);
+
+  isl_union_set_list *collectChildFilters(size_t pos, isl::ctx) const;
+  isl::schedule_node insertSequenceOrSetAt(size_t pos,
+                                           isl::schedule_node) const;
+  isl::schedule_node insertSingleChildTypeNodeAt(size_t pos,
+                                                 isl::schedule_node) const;
+  isl::schedule_node expandTree(size_t pos, isl::schedule_node) const;
+  isl::schedule_node insertAt(size_t pos, isl::schedule_node node) const;
+  // Insert the node at "pos" without its children above "node".
+  isl::schedule_node insertAbove(size_t pos, isl::schedule_node node) const;
+
+  // Append the subtree rooted at "pos", with all properties evaluated and
+  // subtree callbacks expanded, to the arena of "out" and return the position
+  // of its root.
+  size_t resolve(size_t pos, ScheduleNodeBuilder &out) const;
+
+  // State of the textual description of a resolved domain-rooted builder.
+  struct Description;
+  void describe(size_t pos, std::string &out, Description &description) const;
+  isl::schedule_node buildFromDescription() const;
+
+  std::vector<Node> nodes_;
+  std::vector<size_t> childPositions_;
 };
 
 /** \defgroup BuildersCstr Builder Constructors *
@@ -106,115 +217,106 @@ public:
  * members of each node type.
  *
  * For convenience, overloads of these functions taking plain properties
- * instead of function objects are provided.  These overloads wrap the
- * properties into a lambda capturing them by-copy (capturing in lambdas does
- * not extend the lifetime of an object, so capturing function arguments
- * supplied by-copy by-reference leads to undefined behavior once the function
- * completes; changing the function to take arguments by-reference would
- * require the user to maintain the lifetime of the passed object at least as
- * long as the builder is alive, prohibiting temporaries, and creating
- * hard-to-detect runtime failures).
+ * instead of function objects are provided.  These overloads store the
+ * properties in the builder by-copy, without wrapping them into function
+ * objects (taking arguments by-reference would require the user to maintain
+ * the lifetime of the passed object at least as long as the builder is alive,
+ * prohibiting temporaries, and creating hard-to-detect runtime failures).
  *
  * \{
  */
 ScheduleNodeBuilder domain(std::function<isl::union_set()> callback,
                            ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-inline ScheduleNodeBuilder
-domain(isl::union_set uset,
-       ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return domain([uset]() { return uset; }, std::move(child));
-}
+ScheduleNodeBuilder domain(isl::union_set uset,
+                           ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
 
 ScheduleNodeBuilder band(std::function<BandDescriptor()> callback,
                          ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-inline ScheduleNodeBuilder
-band(BandDescriptor descr,
-     ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return band([descr]() { return descr; }, std::move(child));
-}
+ScheduleNodeBuilder band(BandDescriptor descr,
+                         ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
 
 ScheduleNodeBuilder filter(std::function<isl::union_set()> callback,
                            ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-inline ScheduleNodeBuilder
-filter(isl::union_set uset,
-       ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return filter([uset]() { return uset; }, std::move(child));
-}
+ScheduleNodeBuilder filter(isl::union_set uset,
+                           ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
 
 ScheduleNodeBuilder
 extension(std::function<isl::union_map()> callback,
           ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-inline ScheduleNodeBuilder
+ScheduleNodeBuilder
 extension(isl::union_map umap,
-          ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return extension([umap]() { return umap; }, std::move(child));
-}
+          ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
 
 ScheduleNodeBuilder
 expansion(std::function<isl::union_map()> callback,
           ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-ScheduleNodeBuilder inline expansion(
-    isl::union_map umap, ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return expansion([umap]() { return umap; }, std::move(child));
-}
+ScheduleNodeBuilder
+expansion(isl::union_map umap,
+          ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
 
 ScheduleNodeBuilder mark(std::function<isl::id()> callback,
                          ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-inline ScheduleNodeBuilder
-mark(isl::id id, ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return mark([id]() { return id; }, std::move(child));
-}
+ScheduleNodeBuilder mark(isl::id id,
+                         ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
 
 ScheduleNodeBuilder guard(std::function<isl::set()> callback,
                           ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-inline ScheduleNodeBuilder
-guard(isl::set set, ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return guard([set]() { return set; }, std::move(child));
-}
+ScheduleNodeBuilder guard(isl::set set,
+                          ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
 
 ScheduleNodeBuilder
 context(std::function<isl::set()> callback,
         ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
-inline ScheduleNodeBuilder
-context(isl::set set, ScheduleNodeBuilder &&child = ScheduleNodeBuilder()) {
-  return context([set]() { return set; });
+ScheduleNodeBuilder
+context(isl::set set, ScheduleNodeBuilder &&child = ScheduleNodeBuilder());
+
+inline void appendBuilders(std::vector<ScheduleNodeBuilder> &) {}
+
+template <class... Args>
+void appendBuilders(std::vector<ScheduleNodeBuilder> &result,
+                    std::vector<ScheduleNodeBuilder> &&builders,
+                    Args &&... args);
+
+template <class... Args>
+void appendBuilders(std::vector<ScheduleNodeBuilder> &result,
+                    ScheduleNodeBuilder &&builder, Args &&... args) {
+  result.push_back(std::move(builder));
+  appendBuilders(result, std::forward<Args>(args)...);
+}
+
+template <class... Args>
+void appendBuilders(std::vector<ScheduleNodeBuilder> &result,
+                    std::vector<ScheduleNodeBuilder> &&builders,
+                    Args &&... args) {
+  result.insert(std::end(result), std::make_move_iterator(builders.begin()),
+                std::make_move_iterator(builders.end()));
+  appendBuilders(result, std::forward<Args>(args)...);
 }
 
-template <typename... Args, typename = typename std::enable_if<std::is_same<
-                                typename std::common_type<Args...>::type,
-                                ScheduleNodeBuilder>::value>::type>
-ScheduleNodeBuilder set(Args... children) {
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_set;
-  builder.children_ = {children...};
-  return builder;
+/** Collect builders and vectors of builders into one vector.  Builders are
+ * move-only, so the arguments must be rvalues. */
+template <class... Args>
+std::vector<ScheduleNodeBuilder> varargToVector(Args &&... args) {
+  std::vector<ScheduleNodeBuilder> result;
+  appendBuilders(result, std::forward<Args>(args)...);
+  return result;
 }
 
 ScheduleNodeBuilder set(std::vector<ScheduleNodeBuilder> &&children);
 
-template <typename T,
+template <typename... Args,
           typename = typename std::enable_if<
-              std::is_same<T, ScheduleNodeBuilder>::value ||
-              std::is_same<T, std::vector<ScheduleNodeBuilder>>::value>::type>
-std::vector<ScheduleNodeBuilder> varargToVector(T t) {
-  return {t};
+              std::is_same<typename std::common_type<
+                               typename std::decay<Args>::type...>::type,
+                           ScheduleNodeBuilder>::value>::type>
+ScheduleNodeBuilder set(Args &&... children) {
+  return set(varargToVector(std::forward<Args>(children)...));
 }
 
-template <typename T, class... Args>
-std::vector<ScheduleNodeBuilder> varargToVector(T t, Args... args) {
-  std::vector<ScheduleNodeBuilder> rest = varargToVector(args...);
-  std::vector<ScheduleNodeBuilder> result = {t};
-  result.insert(std::end(result), std::make_move_iterator(rest.begin()),
-                std::make_move_iterator(rest.end()));
-  return result;
-}
+ScheduleNodeBuilder sequence(std::vector<ScheduleNodeBuilder> &&children);
 
-template <class... Args> ScheduleNodeBuilder sequence(Args... args) {
-  std::vector<ScheduleNodeBuilder> children = varargToVector(args...);
-  ScheduleNodeBuilder builder;
-  builder.current_ = isl_schedule_node_sequence;
-  builder.children_ = children;
-  return builder;
+template <class... Args> ScheduleNodeBuilder sequence(Args &&... args) {
+  return sequence(varargToVector(std::forward<Args>(args)...));
 }
 
 /** Create a schedule node builder that replicates the given schedule node.
@@ -226,6 +328,18 @@ ScheduleNodeBuilder subtreeBuilder(isl::schedule_node node);
  * callback.  Typically used with subtreeBuilder(). */
 ScheduleNodeBuilder subtree(std::function<ScheduleNodeBuilder()> callback);
 
+/** Construct a schedule tree builder that inserts the subtree rooted at the
+ * given node unchanged.  When used with ScheduleNodeBuilder::replace on an
+ * ancestor of the node, the subtree is kept in place without being rebuilt,
+ * so that the cost of replacing the nodes above it does not depend on its
+ * size.  Otherwise, the subtree is reconstructed as with subtreeBuilder(),
+ * including band permutability, coincidence and AST build options.
+ * As with subtree(), the node is stored by-reference so that it can be
+ * captured by a matcher after the builder is constructed; it is the
+ * responsibility of the caller to keep the reference valid.
+ */
+ScheduleNodeBuilder splice(isl::schedule_node &node);
+
 /** Construct a lazily-evaluated schedule tree builder that reconstructs the
  * subtree rooted at the given node.
  * Note that non-const reference is only used to prevent the argument from
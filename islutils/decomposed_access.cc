@@ -0,0 +1,92 @@
+#include "islutils/decomposed_access.h"
+#include "islutils/die.h"
+
+namespace matchers {
+
+DecomposedAccess::DecomposedAccess(isl::map map)
+    : map_(map), space_(map.get_space()) {
+  int dim = map.dim(isl::dim::out);
+  outDims_.resize(dim);
+  outDimAffs_.resize(dim);
+  hasOutDimAff_.resize(dim, false);
+}
+
+isl::map DecomposedAccess::outDim(int pos) const {
+  if (pos < 0 || pos >= nOutDims()) {
+    ISLUTILS_DIE("output dimension out of bounds");
+  }
+  auto &single = outDims_[pos];
+  if (single.is_null()) {
+    int dim = nOutDims();
+    single = map_.project_out(isl::dim::out, pos + 1, dim - (pos + 1))
+                 .project_out(isl::dim::out, 0, pos);
+  }
+  return single;
+}
+
+isl::pw_aff DecomposedAccess::outDimAff(int pos) const {
+  if (pos < 0 || pos >= nOutDims()) {
+    ISLUTILS_DIE("output dimension out of bounds");
+  }
+  if (!hasOutDimAff_[pos]) {
+    outDimAffs_[pos] = singleValuedAff(outDim(pos));
+    hasOutDimAff_[pos] = true;
+  }
+  return outDimAffs_[pos];
+}
+
+isl::pw_aff singleValuedAff(isl::map singleOutDimMap) {
+  singleOutDimMap = singleOutDimMap.coalesce();
+  if (!singleOutDimMap.is_single_valued()) {
+    return isl::pw_aff();
+  }
+
+  auto pma = isl::pw_multi_aff::from_map(singleOutDimMap);
+  // Truly piece-wise access is not a single variable.
+  if (pma.n_piece() != 1) {
+    return isl::pw_aff();
+  }
+  return pma.get_pw_aff(0);
+}
+
+bool integerCoefficients(isl::pw_aff pa, std::vector<long> &row) {
+  if (pa.is_null()) {
+    return false;
+  }
+  isl::aff aff;
+  pa.foreach_piece([&aff](isl::set, isl::aff piece) {
+    aff = piece;
+    return isl_stat_ok;
+  });
+  if (aff.is_null()) {
+    return false;
+  }
+
+  for (int i = 0, e = aff.dim(isl::dim::param); i < e; ++i) {
+    if (!aff.get_coefficient_val(isl::dim::param, i).is_zero()) {
+      return false;
+    }
+  }
+  for (int i = 0, e = aff.dim(isl::dim::div); i < e; ++i) {
+    if (!aff.get_coefficient_val(isl::dim::div, i).is_zero()) {
+      return false;
+    }
+  }
+
+  row.clear();
+  for (int i = 0, e = aff.dim(isl::dim::in); i < e; ++i) {
+    auto coefficient = aff.get_coefficient_val(isl::dim::in, i);
+    if (!coefficient.is_int()) {
+      return false;
+    }
+    row.push_back(coefficient.get_num_si());
+  }
+  auto constant = aff.get_constant_val();
+  if (!constant.is_int()) {
+    return false;
+  }
+  row.push_back(constant.get_num_si());
+  return true;
+}
+
+} // namespace matchers
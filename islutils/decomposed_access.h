@@ -0,0 +1,52 @@
+#ifndef ISLUTILS_DECOMPOSED_ACCESS_H
+#define ISLUTILS_DECOMPOSED_ACCESS_H
+
+#include <isl/isl-noexceptions.h>
+
+#include <vector>
+
+namespace matchers {
+
+// Access relation together with its decomposition into output dimensions.
+// The relation between the domain and each output dimension, and the
+// single-valued affine form of this relation, are computed on first use and
+// cached.  match() decomposes every access relation once and passes the
+// decomposition to all placeholders, so that placeholders looking at the same
+// output dimension of the same relation share the isl computations.
+class DecomposedAccess {
+public:
+  explicit DecomposedAccess(isl::map map);
+
+  isl::map map() const { return map_; }
+  isl::space space() const { return space_; }
+  int nOutDims() const { return static_cast<int>(outDims_.size()); }
+
+  // Relation between the domain and the output dimension "pos", with the
+  // other output dimensions projected out.  "pos" must be valid.
+  isl::map outDim(int pos) const;
+
+  // Single-valued, single-piece affine form of outDim(pos), or a null object
+  // if outDim(pos) has no such form.
+  isl::pw_aff outDimAff(int pos) const;
+
+private:
+  isl::map map_;
+  isl::space space_;
+  mutable std::vector<isl::map> outDims_;
+  mutable std::vector<isl::pw_aff> outDimAffs_;
+  mutable std::vector<bool> hasOutDimAff_;
+};
+
+// Return the single-valued, single-piece affine form of a relation with one
+// output dimension, or a null object if it has none.
+isl::pw_aff singleValuedAff(isl::map singleOutDimMap);
+
+// Store the integer coefficients of the input dimensions of "pa", the
+// single-valued affine form of a subscript, followed by its integer constant
+// in "row" and return true.  Return false if "pa" is null, involves parameters
+// or integer divisions or has rational coefficients.
+bool integerCoefficients(isl::pw_aff pa, std::vector<long> &row);
+
+} // namespace matchers
+
+#endif // ISLUTILS_DECOMPOSED_ACCESS_H
@@ -0,0 +1,103 @@
+#include "islutils/fingerprint.h"
+
+namespace matchers {
+
+uint64_t shapeFingerprint(isl_schedule_node_type type, int nChildren) {
+  uint64_t hash = static_cast<uint64_t>(type) + 1;
+  combineHash(hash, static_cast<uint64_t>(nChildren));
+  return hash == 0 ? 1 : hash;
+}
+
+uint64_t shapeFingerprint(isl::schedule_node node) {
+  return shapeFingerprint(isl_schedule_node_get_type(node.get()),
+                          isl_schedule_node_n_children(node.get()));
+}
+
+// Hash of the type-specific properties of "node".
+static uint64_t contentHash(isl::schedule_node node) {
+  uint64_t hash = 0;
+  switch (isl_schedule_node_get_type(node.get())) {
+  case isl_schedule_node_band: {
+    auto schedule = node.band_get_partial_schedule();
+    int n = isl_schedule_node_band_n_member(node.get());
+    combineHash(hash, isl_schedule_node_band_get_permutable(node.get()));
+    for (int i = 0; i < n; ++i) {
+      auto upa = schedule.get_union_pw_aff(i);
+      combineHash(hash, isl_union_pw_aff_get_hash(upa.get()));
+      combineHash(hash,
+                  isl_schedule_node_band_member_get_coincident(node.get(), i));
+    }
+    break;
+  }
+  case isl_schedule_node_domain:
+    combineHash(hash, isl_union_set_get_hash(node.domain_get_domain().get()));
+    break;
+  case isl_schedule_node_filter:
+    combineHash(hash, isl_union_set_get_hash(node.filter_get_filter().get()));
+    break;
+  case isl_schedule_node_context:
+    combineHash(hash, isl_set_get_hash(node.context_get_context().get()));
+    break;
+  case isl_schedule_node_guard:
+    combineHash(hash, isl_set_get_hash(node.guard_get_guard().get()));
+    break;
+  case isl_schedule_node_mark:
+    combineHash(hash, isl_id_get_hash(node.mark_get_id().get()));
+    break;
+  case isl_schedule_node_extension:
+    combineHash(hash,
+                isl_union_map_get_hash(node.extension_get_extension().get()));
+    break;
+  case isl_schedule_node_expansion:
+    combineHash(hash,
+                isl_union_map_get_hash(node.expansion_get_expansion().get()));
+    break;
+  default:
+    break;
+  }
+  return hash;
+}
+
+uint64_t nodeFingerprint(isl::schedule_node node, bool withContents) {
+  uint64_t hash = shapeFingerprint(node);
+  if (isl_schedule_node_get_type(node.get()) == isl_schedule_node_band) {
+    combineHash(hash, isl_schedule_node_band_n_member(node.get()));
+  }
+  if (withContents) {
+    combineHash(hash, contentHash(node));
+  }
+  return hash;
+}
+
+// Compute the subtree fingerprint of "node", appending the fingerprints of
+// the nodes in the subtree to "result" in preorder if it is not null.
+static uint64_t collectFingerprints(isl::schedule_node node, bool withContents,
+                                    std::vector<NodeFingerprint> *result) {
+  auto hash = nodeFingerprint(node, withContents);
+  size_t position = 0;
+  if (result) {
+    position = result->size();
+    result->push_back({shapeFingerprint(node), hash, 0});
+  }
+  int n = isl_schedule_node_n_children(node.get());
+  for (int i = 0; i < n; ++i) {
+    combineHash(hash, collectFingerprints(node.child(i), withContents, result));
+  }
+  if (result) {
+    (*result)[position].subtree = hash;
+  }
+  return hash;
+}
+
+uint64_t subtreeFingerprint(isl::schedule_node node, bool withContents) {
+  return collectFingerprints(node, withContents, nullptr);
+}
+
+std::vector<NodeFingerprint> computeFingerprints(isl::schedule schedule,
+                                                 bool withContents) {
+  std::vector<NodeFingerprint> result;
+  collectFingerprints(schedule.get_root(), withContents, &result);
+  return result;
+}
+
+} // namespace matchers
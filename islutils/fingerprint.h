@@ -0,0 +1,61 @@
+#ifndef ISLUTILS_FINGERPRINT_H
+#define ISLUTILS_FINGERPRINT_H
+
+#include <isl/isl-noexceptions.h>
+#include <isl/schedule_node.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace matchers {
+
+/** \defgroup Fingerprints Schedule Tree Fingerprints
+ * \brief Structural hashes of schedule tree nodes and subtrees.
+ *
+ * The shape fingerprint of a node only depends on its type and number of
+ * children, which is what a structural matcher constrains at each node.  It
+ * is never zero, so that matchers may use zero to accept any shape.
+ *
+ * The node fingerprint additionally covers the number of band members and,
+ * if requested, the contents of the node: the partial schedule and band
+ * properties, the filter, domain, context and guard sets, the mark
+ * identifier, and the extension and expansion relations.  The subtree
+ * fingerprint combines the node fingerprints of an entire subtree.
+ *
+ * Without contents, subtrees of the same shape have equal fingerprints.
+ * Contents are hashed through their isl representation, so that equal sets
+ * or relations described by different constraints, or with their disjuncts
+ * in a different order, may have different fingerprints.  A fingerprint with
+ * contents thus only identifies identical representations.  Different
+ * fingerprints do not imply different subtrees, and equal fingerprints imply
+ * identical subtrees with high probability only.  Skipping subtrees whose
+ * fingerprint did not change is conservative: unchanged subtrees may still
+ * be visited.
+ * \{
+ */
+
+inline void combineHash(uint64_t &hash, uint64_t value) {
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+}
+
+uint64_t shapeFingerprint(isl_schedule_node_type type, int nChildren);
+uint64_t shapeFingerprint(isl::schedule_node node);
+uint64_t nodeFingerprint(isl::schedule_node node, bool withContents = false);
+uint64_t subtreeFingerprint(isl::schedule_node node,
+                            bool withContents = false);
+
+struct NodeFingerprint {
+  uint64_t shape;
+  uint64_t node;
+  uint64_t subtree;
+};
+
+/// Compute the fingerprints of all nodes of "schedule", in preorder.
+std::vector<NodeFingerprint> computeFingerprints(isl::schedule schedule,
+                                                 bool withContents = false);
+
+/** \} */
+
+} // namespace matchers
+
+#endif // ISLUTILS_FINGERPRINT_H
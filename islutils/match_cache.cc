@@ -0,0 +1,29 @@
+#include "islutils/match_cache.h"
+
+namespace matchers {
+
+// Description of a possibly null isl object.
+template <typename T> static std::string describe(const T &object) {
+  return object.is_null() ? std::string("-") : object.to_str();
+}
+
+std::string patternSignature(const SimpleAff &pattern) {
+  return "SimpleAff(" + describe(pattern.coefficient_) + "," +
+         describe(pattern.constant_) + ")";
+}
+
+std::string patternSignature(const GeneralAff &pattern) {
+  return "GeneralAff(" + describe(pattern.coefficient_) + "," +
+         describe(pattern.constant_) + ")";
+}
+
+std::string patternSignature(const StridePattern &pattern) {
+  if (pattern.anyStride) {
+    return "Stride(any," + describe(pattern.nonEmptySchedulePoints) + ")";
+  }
+  return "Stride(" + describe(pattern.stride) + "," +
+         describe(pattern.parametricStride) + "," +
+         describe(pattern.nonEmptySchedulePoints) + ")";
+}
+
+} // namespace matchers
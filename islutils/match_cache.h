@@ -0,0 +1,141 @@
+#ifndef ISLUTILS_MATCH_CACHE_H
+#define ISLUTILS_MATCH_CACHE_H
+
+#include "islutils/access.h"
+#include "islutils/access_patterns.h"
+#include "islutils/fingerprint.h"
+
+#include <isl/isl-noexceptions.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace matchers {
+
+// Canonical descriptions of the pattern payloads, used by MatchCache to
+// recognize placeholder sets with the same structure.  Equal descriptions
+// must imply that the patterns accept the same candidates; different
+// descriptions of equivalent patterns only cause cache misses.  Overload
+// patternSignature in the namespace of a user-defined pattern payload to use
+// it with the cache.
+std::string patternSignature(const SimpleAff &pattern);
+std::string patternSignature(const GeneralAff &pattern);
+std::string patternSignature(const StridePattern &pattern);
+
+template <typename PatternTy>
+std::string patternSignature(const FixedOutDimPattern<PatternTy> &pattern) {
+  return "dim(" + std::to_string(pattern.outDimPos) + "," +
+         patternSignature(static_cast<const PatternTy &>(pattern)) + ")";
+}
+
+template <typename PatternTy>
+std::string patternSignature(const UnfixedOutDimPattern<PatternTy> &pattern) {
+  return patternSignature(static_cast<const PatternTy &>(pattern));
+}
+
+// Signature of a placeholder set: its patterns, groups and folds, but not the
+// identity of its placeholders.
+template <typename PlaceholderCollectionTy>
+std::string placeholderSetSignature(const PlaceholderCollectionTy &ps) {
+  std::string result;
+  for (const auto &ph : ps) {
+    result += patternSignature(ph.pattern_);
+    result += ';';
+  }
+  result += "|folds";
+  for (size_t i = 0, e = containerSize(ps); i < e; ++i) {
+    result += ' ' + std::to_string(ps.placeholderFolds_.at(i));
+  }
+  result += "|groups";
+  for (const auto &group : ps.placeholderGroups_) {
+    result += " (";
+    for (auto pos : group) {
+      result += ' ' + std::to_string(pos);
+    }
+    result += ')';
+  }
+  if (auto folds = groupFolds(ps)) {
+    result += "|group folds";
+    for (auto fold : *folds) {
+      result += ' ' + std::to_string(fold);
+    }
+  }
+  return result;
+}
+
+// Opt-in cache of match results.  Callbacks that ask the same question about
+// the same accesses, e.g. while a schedule tree is being rewritten
+// repeatedly, get the stored matches instead of matching again.  Entries are
+// keyed on the hash of the access relations and the signature of the
+// placeholder set; a hit also requires the relations to be equal, so stored
+// matches are never returned for other accesses.  On a hit, the stored
+// matches are rebound to the placeholders of the given set, so that they can
+// be looked up with these placeholders as usual.
+//
+// The cache never evicts entries, call clear() once the accesses are no
+// longer of interest, e.g. at the end of a pipeline run.
+template <typename CandidatePayload, typename PatternPayload>
+class MatchCache {
+public:
+  // Same as matchers::match(accesses, ps).
+  template <typename PlaceholderCollectionTy>
+  Matches<CandidatePayload, PatternPayload>
+  match(isl::union_map accesses, const PlaceholderCollectionTy &ps);
+
+  size_t size() const { return entries_.size(); }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  void clear() {
+    entries_.clear();
+    hits_ = 0;
+    misses_ = 0;
+  }
+
+private:
+  struct Entry {
+    isl::union_map accesses;
+    std::string signature;
+    Matches<CandidatePayload, PatternPayload> matches;
+  };
+
+  std::unordered_multimap<uint64_t, Entry> entries_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+template <typename CandidatePayload, typename PatternPayload>
+template <typename PlaceholderCollectionTy>
+Matches<CandidatePayload, PatternPayload>
+MatchCache<CandidatePayload, PatternPayload>::match(
+    isl::union_map accesses, const PlaceholderCollectionTy &ps) {
+  auto signature = placeholderSetSignature(ps);
+  uint64_t key = isl_union_map_get_hash(accesses.get());
+  combineHash(key, std::hash<std::string>()(signature));
+
+  auto range = entries_.equal_range(key);
+  for (auto it = range.first; it != range.second; ++it) {
+    const auto &entry = it->second;
+    if (entry.signature != signature || !entry.accesses.is_equal(accesses)) {
+      continue;
+    }
+    ++hits_;
+    Matches<CandidatePayload, PatternPayload> result;
+    result.reserve(entry.matches.size());
+    for (const auto &m : entry.matches) {
+      result.push_back(m.rebound(ps));
+    }
+    return result;
+  }
+
+  ++misses_;
+  auto result = matchers::match(accesses, ps);
+  entries_.emplace(key, Entry{accesses, signature, result});
+  return result;
+}
+
+} // namespace matchers
+
+#endif // ISLUTILS_MATCH_CACHE_H
@@ -0,0 +1,90 @@
+#include "islutils/match_iterator.h"
+#include "islutils/fingerprint.h"
+
+#include <iterator>
+
+namespace matchers {
+
+// Descend to the first node of the subtree in postorder.
+static isl::schedule_node firstInPostorder(isl::schedule_node node,
+                                           int &depth) {
+  while (isl_schedule_node_n_children(node.get()) > 0) {
+    node = node.child(0);
+    ++depth;
+  }
+  return node;
+}
+
+MatchIterator::MatchIterator(const MatchRange &range, isl::schedule_node root)
+    : range_(&range), current_(root) {
+  if (!current_.get()) {
+    return;
+  }
+  if (range.order_ == TraversalOrder::Postorder) {
+    current_ = firstInPostorder(current_, depth_);
+  }
+  skipNonMatching();
+}
+
+void MatchIterator::step() {
+  bool preorder = range_->order_ == TraversalOrder::Preorder;
+  if (preorder && isl_schedule_node_n_children(current_.get()) > 0) {
+    current_ = current_.child(0);
+    ++depth_;
+    return;
+  }
+  if (preorder) {
+    while (depth_ > 0 && !current_.has_next_sibling()) {
+      current_ = current_.parent();
+      --depth_;
+    }
+  }
+  if (depth_ == 0) {
+    current_ = isl::schedule_node();
+    return;
+  }
+  if (current_.has_next_sibling()) {
+    current_ = current_.next_sibling();
+    if (!preorder) {
+      current_ = firstInPostorder(current_, depth_);
+    }
+  } else {
+    current_ = current_.parent();
+    --depth_;
+  }
+}
+
+void MatchIterator::skipNonMatching() {
+  while (current_.get() &&
+         !CompiledMatcher::isMatching(range_->matcher_, current_,
+                                      shapeFingerprint(current_))) {
+    step();
+  }
+  if (!current_.get()) {
+    depth_ = 0;
+  }
+}
+
+MatchIterator &MatchIterator::operator++() {
+  step();
+  skipNonMatching();
+  return *this;
+}
+
+isl::schedule_node findFirst(const ScheduleNodeMatcher &matcher,
+                             isl::schedule_node root, TraversalOrder order) {
+  auto range = matches(matcher, root, order);
+  auto it = range.begin();
+  return it == range.end() ? isl::schedule_node() : *it;
+}
+
+size_t count(const ScheduleNodeMatcher &matcher, isl::schedule_node root) {
+  auto range = matches(matcher, root);
+  return static_cast<size_t>(std::distance(range.begin(), range.end()));
+}
+
+bool any(const ScheduleNodeMatcher &matcher, isl::schedule_node root) {
+  return !findFirst(matcher, root).is_null();
+}
+
+} // namespace matchers
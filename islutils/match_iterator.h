@@ -0,0 +1,106 @@
+#ifndef ISLUTILS_MATCH_ITERATOR_H
+#define ISLUTILS_MATCH_ITERATOR_H
+
+#include "islutils/matchers.h"
+
+#include <cstddef>
+#include <iterator>
+
+namespace matchers {
+
+enum class TraversalOrder { Preorder, Postorder };
+
+class MatchRange;
+
+/** Iterator over the nodes of a subtree at which a matcher matches.
+ * \ingroup Matchers
+ *
+ * The subtree is traversed lazily: advancing the iterator visits nodes until
+ * the next match and no list of matches is ever built.  As with
+ * CompiledMatcher::isMatching, capture variables of the matcher are updated
+ * each time the matcher is checked against a node, so they describe the
+ * current match right after the iterator has been advanced to it.
+ */
+class MatchIterator {
+public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = isl::schedule_node;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const isl::schedule_node *;
+  using reference = const isl::schedule_node &;
+
+  /// Past-the-end iterator.
+  MatchIterator() = default;
+
+  reference operator*() const { return current_; }
+  pointer operator->() const { return &current_; }
+  MatchIterator &operator++();
+
+  bool operator==(const MatchIterator &other) const {
+    return current_.get() == other.current_.get() && depth_ == other.depth_;
+  }
+  bool operator!=(const MatchIterator &other) const {
+    return !(*this == other);
+  }
+
+private:
+  friend class MatchRange;
+
+  MatchIterator(const MatchRange &range, isl::schedule_node root);
+
+  // Move to the next node in traversal order, resetting "current_" past the
+  // end of the subtree.
+  void step();
+  // Move to the first node at or after the current one that matches.
+  void skipNonMatching();
+
+  const MatchRange *range_ = nullptr;
+  isl::schedule_node current_;
+  // Depth of "current_" relative to the root of the traversed subtree.
+  int depth_ = 0;
+};
+
+/** Range of the matches of a matcher in a subtree, see MatchIterator.
+ * \ingroup Matchers
+ *
+ * The range compiles the matcher once; it must outlive its iterators.
+ */
+class MatchRange {
+public:
+  MatchRange(const ScheduleNodeMatcher &matcher, isl::schedule_node root,
+             TraversalOrder order = TraversalOrder::Preorder)
+      : matcher_(matcher), root_(root), order_(order) {}
+
+  MatchIterator begin() const { return MatchIterator(*this, root_); }
+  MatchIterator end() const { return MatchIterator(); }
+
+private:
+  friend class MatchIterator;
+
+  CompiledMatcher matcher_;
+  isl::schedule_node root_;
+  TraversalOrder order_;
+};
+
+/// Matches of "matcher" in the subtree rooted at "root".
+inline MatchRange matches(const ScheduleNodeMatcher &matcher,
+                          isl::schedule_node root,
+                          TraversalOrder order = TraversalOrder::Preorder) {
+  return MatchRange(matcher, root, order);
+}
+
+/// First match of "matcher" in the subtree rooted at "root", null if none.
+/// The traversal stops at the first match.
+isl::schedule_node findFirst(const ScheduleNodeMatcher &matcher,
+                             isl::schedule_node root,
+                             TraversalOrder order = TraversalOrder::Preorder);
+
+/// Number of nodes of the subtree rooted at "root" that "matcher" matches.
+size_t count(const ScheduleNodeMatcher &matcher, isl::schedule_node root);
+
+/// Whether "matcher" matches any node of the subtree rooted at "root".
+bool any(const ScheduleNodeMatcher &matcher, isl::schedule_node root);
+
+} // namespace matchers
+
+#endif // ISLUTILS_MATCH_ITERATOR_H
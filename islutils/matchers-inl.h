@@ -40,6 +40,8 @@ isl_schedule_node_type toIslType(ScheduleNodeType type) {
     return isl_schedule_node_sequence;
   case ScheduleNodeType::Set:
     return isl_schedule_node_set;
+  case ScheduleNodeType::Expansion:
+    return isl_schedule_node_expansion;
   case ScheduleNodeType::Loop:
     return isl_schedule_node_band;
   default:
@@ -70,6 +72,8 @@ ScheduleNodeType fromIslType(isl_schedule_node_type type) {
     return ScheduleNodeType::Sequence;
   case isl_schedule_node_set:
     return ScheduleNodeType::Set;
+  case isl_schedule_node_expansion:
+    return ScheduleNodeType::Expansion;
   default:
     assert(false && "cannot convert the given node type");
     return ScheduleNodeType::Leaf;
@@ -98,12 +102,20 @@ std::string fromTypeToString(ScheduleNodeType type) {
     return "MATCHER_SEQUENCE";
   case ScheduleNodeType::Set:
     return "MATCHER_SET";
+  case ScheduleNodeType::Expansion:
+    return "MATCHER_EXPANSION";
   case ScheduleNodeType::AnyTree:
     return "MATCHER_ANYTREE";
   case ScheduleNodeType::AnyForest:
     return "MATCHER_ANYFOREST";
   case ScheduleNodeType::FilterForest:
     return "MACTHER_FILTERFOREST";
+  case ScheduleNodeType::Optional:
+    return "MATCHER_OPTIONAL";
+  case ScheduleNodeType::ZeroOrMore:
+    return "MATCHER_ZEROORMORE";
+  case ScheduleNodeType::OneOrMore:
+    return "MATCHER_ONEORMORE";
   default:
     return "NOT IMPLEMENTED";
   }
@@ -292,4 +304,19 @@ filterForest(std::vector<isl::schedule_node> &multiCapture) {
   return matcher;
 }
 
+#define DEF_REPETITION_MATCHER(name, type)                                     \
+  inline ScheduleNodeMatcher name(ScheduleNodeMatcher &&child) {               \
+    static isl::schedule_node dummyCapture;                                    \
+    ScheduleNodeMatcher matcher(dummyCapture);                                 \
+    matcher.current_ = type;                                                   \
+    matcher.children_.emplace_back(child);                                     \
+    return matcher;                                                            \
+  }
+
+DEF_REPETITION_MATCHER(optional, ScheduleNodeType::Optional)
+DEF_REPETITION_MATCHER(zeroOrMore, ScheduleNodeType::ZeroOrMore)
+DEF_REPETITION_MATCHER(oneOrMore, ScheduleNodeType::OneOrMore)
+
+#undef DEF_REPETITION_MATCHER
+
 } // namespace matchers
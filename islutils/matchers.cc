@@ -1,5 +1,8 @@
 #include "islutils/matchers.h"
 #include "islutils/die.h"
+#include "islutils/fingerprint.h"
+
+#include <algorithm>
 
 namespace matchers {
 
@@ -16,15 +19,112 @@ std::string ScheduleNodeMatcher::getLabel() const {
   return label_;
 }
 
-bool ScheduleNodeMatcher::isMatching(const ScheduleNodeMatcher &matcher,
-                                     isl::schedule_node node) {
+ScheduleNodeMatcher makeMatcher(ScheduleNodeType type,
+                                std::function<bool(isl::schedule_node)> callback,
+                                isl::schedule_node *capture,
+                                std::vector<isl::schedule_node> *multiCapture,
+                                std::vector<ScheduleNodeMatcher> children) {
+  static isl::schedule_node dummyCapture;
+  ScheduleNodeMatcher matcher(
+      capture ? *capture : dummyCapture,
+      multiCapture ? *multiCapture
+                   : ScheduleNodeMatcher::dummyMultiCaptureData_);
+  matcher.current_ = type;
+  matcher.needToCapture_ = capture || multiCapture;
+  matcher.children_ = std::move(children);
+  matcher.nodeCallback_ = std::move(callback);
+  return matcher;
+}
+
+bool MatchResult::has(const std::string &label) const {
+  return nodes_.count(label) != 0 || forests_.count(label) != 0;
+}
+
+isl::schedule_node MatchResult::operator[](const std::string &label) const {
+  auto it = nodes_.find(label);
+  if (it == nodes_.end()) {
+    ISLUTILS_DIE("no node captured with the given label");
+  }
+  return it->second;
+}
+
+const std::vector<isl::schedule_node> &
+MatchResult::forest(const std::string &label) const {
+  auto it = forests_.find(label);
+  if (it == forests_.end()) {
+    ISLUTILS_DIE("no forest captured with the given label");
+  }
+  return it->second;
+}
+
+// Write the captured nodes to the capture references of the matchers.
+struct ScheduleNodeMatcher::ReferenceSink {
+  void node(const ScheduleNodeMatcher &matcher, isl::schedule_node node) {
+    if (matcher.needToCapture_) {
+      matcher.capture_ = node;
+    }
+  }
+  void forest(const ScheduleNodeMatcher &matcher,
+              std::vector<isl::schedule_node> &&nodes) {
+    matcher.multiCapture_ = std::move(nodes);
+  }
+};
+
+// Record the captured nodes of labeled matchers in a MatchResult.
+struct ScheduleNodeMatcher::LabelSink {
+  void node(const ScheduleNodeMatcher &matcher, isl::schedule_node node) {
+    if (matcher.label_ != "null") {
+      result.nodes_[matcher.label_] = node;
+    }
+  }
+  void forest(const ScheduleNodeMatcher &matcher,
+              std::vector<isl::schedule_node> &&nodes) {
+    if (matcher.label_ != "null") {
+      result.forests_[matcher.label_] = std::move(nodes);
+    }
+  }
+
+  MatchResult result;
+};
+
+// Discard the captured nodes.
+struct ScheduleNodeMatcher::NullSink {
+  void node(const ScheduleNodeMatcher &, isl::schedule_node) {}
+  void forest(const ScheduleNodeMatcher &,
+              std::vector<isl::schedule_node> &&) {}
+};
+
+static bool isRepetition(ScheduleNodeType type) {
+  return type == ScheduleNodeType::Optional ||
+         type == ScheduleNodeType::ZeroOrMore ||
+         type == ScheduleNodeType::OneOrMore;
+}
+
+bool ScheduleNodeMatcher::hasChildPattern() const {
+  for (const auto &child : children_) {
+    if (isRepetition(child.current_)) {
+      return true;
+    }
+    if (child.current_ == ScheduleNodeType::AnyForest && children_.size() > 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename Sink>
+bool ScheduleNodeMatcher::matchImpl(const ScheduleNodeMatcher &matcher,
+                                    isl::schedule_node node, Sink &sink) {
   if (!node.get()) {
     return false;
   }
 
+  if (isRepetition(matcher.current_)) {
+    ISLUTILS_DIE("optional or repeated matcher outside of a list of children");
+  }
+
   if (matcher.current_ == ScheduleNodeType::AnyTree) {
-    if (matcher.needToCapture_)
-      matcher.capture_ = node;
+    sink.node(matcher, node);
     return true;
   }
 
@@ -41,10 +141,11 @@ bool ScheduleNodeMatcher::isMatching(const ScheduleNodeMatcher &matcher,
     if (node.has_previous_sibling()) {
       ISLUTILS_DIE("AnyForest matcher combined with other types");
     }
-    matcher.multiCapture_.clear();
+    std::vector<isl::schedule_node> siblings;
     do {
-      matcher.multiCapture_.push_back(node);
+      siblings.push_back(node);
     } while (node.has_next_sibling() && (node = node.next_sibling()));
+    sink.forest(matcher, std::move(siblings));
     return true;
   }
 
@@ -56,6 +157,14 @@ bool ScheduleNodeMatcher::isMatching(const ScheduleNodeMatcher &matcher,
     return false;
   }
 
+  if (matcher.hasChildPattern()) {
+    if (!matchChildList(matcher, node, sink)) {
+      return false;
+    }
+    sink.node(matcher, node);
+    return true;
+  }
+
   // Check that the number of children matches unless the only matcher child is
   // AnyForest.  In the latter case, check that the tree node has at least one
   // child.
@@ -71,26 +180,445 @@ bool ScheduleNodeMatcher::isMatching(const ScheduleNodeMatcher &matcher,
     return false;
   }
 
+  // AnyForest includes all the siblings, only visit the first child.
+  if (nextIsAnyForest) {
+    nChildren = 1;
+  }
   for (size_t i = 0; i < nChildren; ++i) {
-    if (!isMatching(matcher.children_.at(i), node.child(i))) {
+    if (!matchImpl(matcher.children_.at(i), node.child(i), sink)) {
       return false;
     }
-    // Return after visiting the first child if we match AnyForest because it
-    // included all the siblings.
-    if (nextIsAnyForest) {
+  }
+
+  sink.node(matcher, node);
+  return true;
+}
+
+// The children of "matcher" are seen as a sequence of elements, each of which
+// matches between "min" and "max" consecutive children of the tree node.  The
+// automaton has two states per element: (e, 0) when no child has been matched
+// by element e yet and (e, 1) otherwise; (k, 0) past the last element is
+// accepting.  Children are consumed one by one while the set of active states
+// is tracked, each child being matched at most once against each element.
+// Predecessor states are recorded to recover one assignment of children to
+// elements, which is then matched again to capture nodes.
+template <typename Sink>
+bool ScheduleNodeMatcher::matchChildList(const ScheduleNodeMatcher &matcher,
+                                         isl::schedule_node node, Sink &sink) {
+  struct Element {
+    const ScheduleNodeMatcher *matcher;
+    bool wildcard;
+    bool optional;
+    bool repeated;
+  };
+  std::vector<Element> elements;
+  for (const auto &child : matcher.children_) {
+    switch (child.current_) {
+    case ScheduleNodeType::AnyForest:
+      elements.push_back({&child, true, true, true});
+      break;
+    case ScheduleNodeType::Optional:
+      elements.push_back({&child.children_.at(0), false, true, false});
+      break;
+    case ScheduleNodeType::ZeroOrMore:
+      elements.push_back({&child.children_.at(0), false, true, true});
+      break;
+    case ScheduleNodeType::OneOrMore:
+      elements.push_back({&child.children_.at(0), false, false, true});
+      break;
+    default:
+      elements.push_back({&child, false, false, false});
+      break;
+    }
+  }
+
+  int n = isl_schedule_node_n_children(node.get());
+  std::vector<isl::schedule_node> children;
+  children.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    children.push_back(node.child(i));
+  }
+
+  size_t k = elements.size();
+  size_t nStates = 2 * (k + 1);
+  auto state = [](size_t element, int matched) {
+    return 2 * element + matched;
+  };
+  // Lazily computed results of matching child i with element e.
+  enum class Cached : char { Unknown, Yes, No };
+  std::vector<Cached> cache(n * k, Cached::Unknown);
+  auto childMatches = [&](int i, size_t e) {
+    if (elements[e].wildcard) {
       return true;
     }
+    auto &cached = cache[i * k + e];
+    if (cached == Cached::Unknown) {
+      NullSink nullSink;
+      cached = matchImpl(*elements[e].matcher, children[i], nullSink)
+                   ? Cached::Yes
+                   : Cached::No;
+    }
+    return cached == Cached::Yes;
+  };
+
+  // predecessor[i][s] is the state on row i (epsilon move) or i - 1
+  // (consuming child i - 1) from which state s was reached with i children
+  // consumed, encoded as row * nStates + state; "unreached" if not reached.
+  const size_t unreached = static_cast<size_t>(-1);
+  const size_t start = static_cast<size_t>(-2);
+  std::vector<std::vector<size_t>> predecessor(
+      n + 1, std::vector<size_t>(nStates, unreached));
+  predecessor[0][state(0, 0)] = start;
+  for (int i = 0; i <= n; ++i) {
+    auto &row = predecessor[i];
+    bool active = false;
+    // Epsilon moves only go to later elements, close them in order.
+    for (size_t e = 0; e < k; ++e) {
+      for (int matched = 0; matched < 2; ++matched) {
+        size_t from = state(e, matched);
+        if (row[from] == unreached) {
+          continue;
+        }
+        active = true;
+        if ((matched || elements[e].optional) &&
+            row[state(e + 1, 0)] == unreached) {
+          row[state(e + 1, 0)] = i * nStates + from;
+        }
+        if (i == n || (matched && !elements[e].repeated) ||
+            !childMatches(i, e)) {
+          continue;
+        }
+        auto &next = predecessor[i + 1][state(e, 1)];
+        if (next == unreached) {
+          next = i * nStates + from;
+        }
+      }
+    }
+    if (!active && row[state(k, 0)] == unreached) {
+      return false;
+    }
+  }
+  if (predecessor[n][state(k, 0)] == unreached) {
+    return false;
+  }
+
+  // Recover the element matching each child.
+  std::vector<size_t> assignment(n);
+  size_t row = n, current = state(k, 0);
+  while (predecessor[row][current] != start) {
+    size_t previous = predecessor[row][current];
+    size_t previousRow = previous / nStates;
+    if (previousRow != row) {
+      assignment[previousRow] = current / 2;
+    }
+    row = previousRow;
+    current = previous % nStates;
+  }
+
+  std::vector<std::vector<isl::schedule_node>> forests(k);
+  for (int i = 0; i < n; ++i) {
+    const auto &element = elements[assignment[i]];
+    if (element.wildcard) {
+      forests[assignment[i]].push_back(children[i]);
+    } else if (!matchImpl(*element.matcher, children[i], sink)) {
+      return false;
+    }
+  }
+  for (size_t e = 0; e < k; ++e) {
+    if (elements[e].wildcard) {
+      sink.forest(*elements[e].matcher, std::move(forests[e]));
+    }
+  }
+  return true;
+}
+
+bool ScheduleNodeMatcher::isMatching(const ScheduleNodeMatcher &matcher,
+                                     isl::schedule_node node) {
+  ReferenceSink sink;
+  return matchImpl(matcher, node, sink);
+}
+
+MatchResult ScheduleNodeMatcher::match(const ScheduleNodeMatcher &matcher,
+                                       isl::schedule_node node) {
+  LabelSink sink;
+  if (!matchImpl(matcher, node, sink)) {
+    return MatchResult();
+  }
+  sink.result.matched_ = true;
+  return std::move(sink.result);
+}
+
+bool ScheduleNodeMatcher::isMatching(const ScheduleNodeMatcher &matcher,
+                                     isl::schedule_node node, uint64_t shape) {
+  auto expected = matcher.shapeFingerprint();
+  if (expected != 0 && expected != shape) {
+    return false;
+  }
+  return isMatching(matcher, node);
+}
+
+uint64_t ScheduleNodeMatcher::shapeFingerprint() const {
+  if (current_ == ScheduleNodeType::AnyTree ||
+      current_ == ScheduleNodeType::AnyForest ||
+      current_ == ScheduleNodeType::FilterForest || isRepetition(current_)) {
+    return 0;
+  }
+  if (hasChildPattern() ||
+      (children_.size() == 1 &&
+       children_.front().current_ == ScheduleNodeType::AnyForest)) {
+    return 0;
+  }
+  return matchers::shapeFingerprint(toIslType(current_), children_.size());
+}
+
+CompiledMatcher::CompiledMatcher(const ScheduleNodeMatcher &matcher)
+    : shape_(matcher.shapeFingerprint()) {
+  lower(matcher, noParent, 0);
+  // Parents precede their children in preorder.
+  std::vector<size_t> level(program_.size(), 1);
+  for (size_t i = 0, e = program_.size(); i < e; ++i) {
+    if (program_[i].parent != noParent) {
+      level[i] = level[program_[i].parent] + 1;
+    }
+    size_t subtreeHeight = 1;
+    if (program_[i].delegate >= 0) {
+      subtreeHeight = matcherHeight(delegates_[program_[i].delegate]);
+    }
+    height_ = std::max(height_, level[i] + subtreeHeight - 1);
+    if (program_[i].islType != isl_schedule_node_error) {
+      requiredTypes_ |= 1u << program_[i].islType;
+    }
   }
+}
 
-  // avoid to capture the node, id the matcher
-  // is not supposed to capture any node.
+// Number of tree levels spanned by "matcher".  Optional and repeated matchers
+// do not correspond to a tree node themselves.
+size_t CompiledMatcher::matcherHeight(const ScheduleNodeMatcher &matcher) {
+  size_t height = 0;
+  for (const auto &child : matcher.children_) {
+    height = std::max(height, matcherHeight(child));
+  }
+  if (isRepetition(matcher.current_)) {
+    return height;
+  }
+  return height + 1;
+}
+
+// Append the instructions for "matcher" and its children in preorder.
+void CompiledMatcher::lower(const ScheduleNodeMatcher &matcher, size_t parent,
+                            int position) {
+  Instruction instruction;
+  instruction.type = matcher.current_;
+  instruction.islType = isl_schedule_node_error;
+  if (matcher.current_ != ScheduleNodeType::AnyTree &&
+      matcher.current_ != ScheduleNodeType::AnyForest) {
+    instruction.islType = toIslType(matcher.current_);
+  }
+  instruction.parent = parent;
+  instruction.position = position;
+  instruction.nChildren = matcher.children_.size();
+  instruction.anyForestChild =
+      matcher.children_.size() == 1 &&
+      matcher.children_.at(0).current_ == ScheduleNodeType::AnyForest;
+  instruction.callback = -1;
+  instruction.capture = nullptr;
+  instruction.multiCapture = nullptr;
+  instruction.delegate = -1;
+  if (matcher.hasChildPattern()) {
+    // The delegate checks the callback, the children and captures the node.
+    instruction.nChildren = 0;
+    instruction.anyForestChild = false;
+    instruction.delegate = static_cast<int>(delegates_.size());
+    delegates_.push_back(matcher);
+    program_.push_back(instruction);
+    return;
+  }
+  if (matcher.nodeCallback_) {
+    instruction.callback = static_cast<int>(callbacks_.size());
+    callbacks_.push_back(matcher.nodeCallback_);
+  }
   if (matcher.needToCapture_) {
-    matcher.capture_ = node;
+    if (matcher.current_ == ScheduleNodeType::AnyForest) {
+      instruction.multiCapture = &matcher.multiCapture_;
+    } else {
+      instruction.capture = &matcher.capture_;
+    }
+  }
+
+  program_.push_back(instruction);
+  size_t self = program_.size() - 1;
+  for (size_t i = 0, e = matcher.children_.size(); i < e; ++i) {
+    lower(matcher.children_.at(i), self, static_cast<int>(i));
+  }
+}
+
+// Check "node" against a single instruction, ignoring its children.
+bool CompiledMatcher::matchNode(const Instruction &instruction,
+                                isl_schedule_node *node) const {
+  if (instruction.type == ScheduleNodeType::AnyTree) {
+    return true;
+  }
+
+  // See ScheduleNodeMatcher::isMatching for the restrictions on AnyForest.
+  if (instruction.type == ScheduleNodeType::AnyForest) {
+    if (isl_schedule_node_has_previous_sibling(node) == isl_bool_true) {
+      ISLUTILS_DIE("AnyForest matcher combined with other types");
+    }
+    if (instruction.multiCapture) {
+      instruction.multiCapture->clear();
+      auto sibling = isl::manage_copy(node);
+      instruction.multiCapture->push_back(sibling);
+      while (isl_schedule_node_has_next_sibling(sibling.get()) ==
+             isl_bool_true) {
+        sibling =
+            isl::manage(isl_schedule_node_next_sibling(sibling.release()));
+        instruction.multiCapture->push_back(sibling);
+      }
+    }
+    return true;
+  }
+
+  if (isl_schedule_node_get_type(node) != instruction.islType) {
+    return false;
+  }
+
+  if (instruction.delegate >= 0) {
+    return ScheduleNodeMatcher::isMatching(delegates_[instruction.delegate],
+                                           isl::manage_copy(node));
   }
 
+  if (instruction.callback >= 0 &&
+      !callbacks_[instruction.callback](isl::manage_copy(node))) {
+    return false;
+  }
+
+  size_t nChildren = static_cast<size_t>(isl_schedule_node_n_children(node));
+  if (instruction.anyForestChild) {
+    return nChildren != 0;
+  }
+  return nChildren == instruction.nChildren;
+}
+
+bool CompiledMatcher::isMatching(const CompiledMatcher &matcher,
+                                 isl::schedule_node node, uint64_t shape) {
+  if (matcher.shape_ != 0 && matcher.shape_ != shape) {
+    return false;
+  }
+  return isMatching(matcher, node);
+}
+
+bool CompiledMatcher::isMatching(const CompiledMatcher &matcher,
+                                 isl::schedule_node node) {
+  if (!node.get()) {
+    return false;
+  }
+
+  // The handle is owned by this function.  Once it has been copied on the
+  // first move, isl navigates it in place.
+  const auto &program = matcher.program_;
+  isl_schedule_node *current = node.copy();
+  for (size_t pc = 0, e = program.size(); pc < e; ++pc) {
+    const Instruction &instruction = program[pc];
+    // Instructions are in preorder, so the parent of the current instruction
+    // is an ancestor of the previous one.  Climb up to it, capturing the nodes
+    // whose subtrees have been fully matched, and step into the child.
+    if (pc != 0) {
+      for (size_t done = pc - 1; done != instruction.parent;
+           done = program[done].parent) {
+        if (program[done].capture) {
+          *program[done].capture = isl::manage_copy(current);
+        }
+        current = isl_schedule_node_parent(current);
+      }
+      current = isl_schedule_node_child(current, instruction.position);
+    }
+    if (!current || !matcher.matchNode(instruction, current)) {
+      isl_schedule_node_free(current);
+      return false;
+    }
+  }
+
+  // Capture the nodes on the way back to the root of the match.
+  for (size_t done = program.size() - 1; done != noParent;
+       done = program[done].parent) {
+    if (program[done].capture) {
+      *program[done].capture = isl::manage_copy(current);
+    }
+    if (program[done].parent != noParent) {
+      current = isl_schedule_node_parent(current);
+    }
+  }
+  isl_schedule_node_free(current);
   return true;
 }
 
+size_t MatcherSet::add(const ScheduleNodeMatcher &matcher) {
+  // Check the root before compiling, which expects a tree node at the root.
+  auto type = matcher.current_;
+  if (type == ScheduleNodeType::AnyForest || isRepetition(type)) {
+    ISLUTILS_DIE("cannot anchor a pattern at AnyForest or a repetition");
+  }
+  size_t index = matchers_.size();
+  matchers_.emplace_back(matcher);
+  if (type == ScheduleNodeType::AnyTree) {
+    anyType_.push_back(index);
+  } else {
+    byType_[toIslType(type)].push_back(index);
+  }
+  return index;
+}
+
+std::vector<std::vector<isl::schedule_node>>
+MatcherSet::findAll(isl::schedule_node root) const {
+  std::vector<std::vector<isl::schedule_node>> result(matchers_.size());
+  if (!root.get()) {
+    return result;
+  }
+
+  auto tryMatchers = [this, &result](const std::vector<size_t> &indices,
+                                     isl_schedule_node *node,
+                                     uint64_t shape) {
+    for (auto index : indices) {
+      auto candidate = isl::manage_copy(node);
+      if (CompiledMatcher::isMatching(matchers_[index], candidate, shape)) {
+        result[index].push_back(candidate);
+      }
+    }
+  };
+
+  // Iterative preorder traversal moving a single handle through the tree;
+  // "depth" is relative to "root" so that the traversal does not leave the
+  // subtree.
+  isl_schedule_node *current = root.copy();
+  int depth = 0;
+  while (current) {
+    auto type = isl_schedule_node_get_type(current);
+    int nChildren = isl_schedule_node_n_children(current);
+    auto shape = shapeFingerprint(type, nChildren);
+    if (type >= 0 && type < nIslTypes) {
+      tryMatchers(byType_[type], current, shape);
+    }
+    tryMatchers(anyType_, current, shape);
+
+    if (nChildren > 0) {
+      current = isl_schedule_node_child(current, 0);
+      ++depth;
+      continue;
+    }
+    while (depth > 0 &&
+           isl_schedule_node_has_next_sibling(current) != isl_bool_true) {
+      current = isl_schedule_node_parent(current);
+      --depth;
+    }
+    if (depth == 0) {
+      break;
+    }
+    current = isl_schedule_node_next_sibling(current);
+  }
+  isl_schedule_node_free(current);
+  return result;
+}
+
 static bool hasPreviousSiblingImpl(isl::schedule_node node,
                                    const ScheduleNodeMatcher &siblingMatcher) {
 
@@ -139,7 +667,6 @@ hasSibling(const ScheduleNodeMatcher &siblingMatcher) {
 
 std::function<bool(isl::schedule_node)>
 hasDescendant(const ScheduleNodeMatcher &descendantMatcher) {
-  isl::schedule_node n;
   return [descendantMatcher](isl::schedule_node node) {
     // Cannot use capturing lambdas as C function pointers.
     struct Data {
@@ -166,11 +693,8 @@ hasDescendant(const ScheduleNodeMatcher &descendantMatcher) {
   };
 }
 
-// not tested.
 std::function<bool(isl::schedule_node)>
 hasAncestor(const ScheduleNodeMatcher &ancestorMatcher) {
-
-  isl::schedule_node n;  
   return [ancestorMatcher](isl::schedule_node node) {
     struct Data {
       bool found;
@@ -178,7 +702,7 @@ hasAncestor(const ScheduleNodeMatcher &ancestorMatcher) {
     };
     Data data{false, ancestorMatcher};
 
-    auto r = isl_schedule_node_foreach_ancestor_top_down(
+    isl_schedule_node_foreach_ancestor_top_down(
       node.get(),
       [](__isl_keep isl_schedule_node *cn, void *user) -> isl_stat {
         auto data = static_cast<Data *>(user);
@@ -192,7 +716,8 @@ hasAncestor(const ScheduleNodeMatcher &ancestorMatcher) {
         return  data->found ? isl_stat_error : isl_stat_ok;
       },  
       &data);
-    return r == isl_stat_ok && data.found;
+    // The traversal is interrupted with an error once a match is found.
+    return data.found;
   };
 }
 
@@ -1,5 +1,12 @@
+#ifndef MATCHERS_H
+#define MATCHERS_H
+
 #include <isl/isl-noexceptions.h>
 #include <isl/schedule_node.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 /** \defgroup Matchers Matchers
@@ -34,6 +41,7 @@
 namespace matchers {
 
 class ScheduleNodeMatcher;
+class ScheduleTreeCursor;
 
 /** \defgroup MatchersStructuralCstr Structural Matcher Constructors.
  * \ingroup Matchers
@@ -331,6 +339,31 @@ ScheduleNodeMatcher anyForest(std::vector<isl::schedule_node> &captures);
 /// ~~~~
 /// @param captures Captures will contain the sequence of captured filters.
 ScheduleNodeMatcher filterForest(std::vector<isl::schedule_node> &captures);
+/// Create a matcher of zero or one child matched by "child".
+///
+/// Optional and repeated matchers, as well as anyForest() combined with other
+/// children, turn the list of children of a matcher into a regular expression
+/// over the children of the tree node.  For example,
+/// ~~~~
+/// sequence(anyForest(), filter(gemm), anyForest(), filter(reduction),
+///          zeroOrMore(filter(leaf())))
+/// ~~~~
+/// matches a sequence in which a filter satisfying "gemm" is followed, not
+/// necessarily immediately, by a filter satisfying "reduction", optionally
+/// followed by filters over leaves.  Among other children, anyForest()
+/// matches any number, possibly zero, of consecutive children.  Such lists are
+/// matched by simulating a finite automaton over the children, which checks
+/// every child at most once against every child matcher.  When several ways
+/// of matching exist, the captures reflect one of them.
+///
+/// @param child: Matcher for the optional child.
+ScheduleNodeMatcher optional(ScheduleNodeMatcher &&child);
+/// Create a matcher of any number, possibly zero, of consecutive children
+/// matched by "child".  Captures in "child" refer to the last of them.
+ScheduleNodeMatcher zeroOrMore(ScheduleNodeMatcher &&child);
+/// Create a matcher of one or more consecutive children matched by "child".
+/// Captures in "child" refer to the last of them.
+ScheduleNodeMatcher oneOrMore(ScheduleNodeMatcher &&child);
 
 /** \} */
 
@@ -351,12 +384,43 @@ enum class ScheduleNodeType {
   AnyForest,
   FilterForest,
   Loop,
+
+  Optional,
+  ZeroOrMore,
+  OneOrMore,
 };
 
 inline isl_schedule_node_type toIslType(ScheduleNodeType type);
 inline ScheduleNodeType fromIslType(isl_schedule_node_type type);
 inline std::string fromTypeToString(ScheduleNodeType type);
 
+/** Nodes captured by a successful match, keyed by matcher labels.
+ * \ingroup Matchers
+ *
+ * Returned by ScheduleNodeMatcher::match, which records the node matched by
+ * every labeled matcher (see ScheduleNodeMatcher::setLabel) in the result
+ * instead of writing to the capture references of the matcher.
+ */
+class MatchResult {
+public:
+  explicit operator bool() const { return matched_; }
+
+  /// Whether a node or a forest was captured under "label".
+  bool has(const std::string &label) const;
+  /// Node matched by the matcher labeled "label".
+  isl::schedule_node operator[](const std::string &label) const;
+  /// Nodes matched by the anyForest() matcher labeled "label".
+  const std::vector<isl::schedule_node> &
+  forest(const std::string &label) const;
+
+private:
+  friend class ScheduleNodeMatcher;
+
+  bool matched_ = false;
+  std::unordered_map<std::string, isl::schedule_node> nodes_;
+  std::unordered_map<std::string, std::vector<isl::schedule_node>> forests_;
+};
+
 /** Node type matcher class for isl schedule trees.
  * \ingroup Matchers
  */
@@ -413,6 +477,18 @@ class ScheduleNodeMatcher {
   friend ScheduleNodeMatcher loop(std::function<bool(isl::schedule_node)>f,
                                   ScheduleNodeMatcher &&child);
   friend ScheduleNodeMatcher loop(std::function<bool(isl::schedule_node)> f);
+  friend ScheduleNodeMatcher optional(ScheduleNodeMatcher &&);
+  friend ScheduleNodeMatcher zeroOrMore(ScheduleNodeMatcher &&);
+  friend ScheduleNodeMatcher oneOrMore(ScheduleNodeMatcher &&);
+  friend ScheduleNodeMatcher
+  makeMatcher(ScheduleNodeType type,
+              std::function<bool(isl::schedule_node)> callback,
+              isl::schedule_node *capture,
+              std::vector<isl::schedule_node> *multiCapture,
+              std::vector<ScheduleNodeMatcher> children);
+
+  friend class CompiledMatcher;
+  friend class MatcherSet;
 
 private:
   explicit ScheduleNodeMatcher(isl::schedule_node &capture)
@@ -424,10 +500,42 @@ private:
 public:
   static bool isMatching(const ScheduleNodeMatcher &matcher,
                          isl::schedule_node node);
+  /// Same as above, but first compare the shape fingerprint of "node",
+  /// available in "shape", with the one required by the matcher.
+  static bool isMatching(const ScheduleNodeMatcher &matcher,
+                         isl::schedule_node node, uint64_t shape);
+  /// Shape fingerprint (see \ref Fingerprints) of the nodes the matcher may
+  /// match, or zero if the matcher accepts nodes of different shapes.
+  uint64_t shapeFingerprint() const;
+
+  /// Match "node" without modifying the matcher or its capture variables.
+  /// Nodes are returned in the result by label.  Unlike isMatching, this may
+  /// be called concurrently, or reentrantly from a callback, with the same
+  /// matcher as long as the callbacks themselves allow it.
+  static MatchResult match(const ScheduleNodeMatcher &matcher,
+                           isl::schedule_node node);
+
   void setLabel(std::string l);
   std::string getLabel() const;
 
 private:
+  // Destinations of the captured nodes: capture references or a MatchResult.
+  struct ReferenceSink;
+  struct LabelSink;
+  struct NullSink;
+
+  template <typename Sink>
+  static bool matchImpl(const ScheduleNodeMatcher &matcher,
+                        isl::schedule_node node, Sink &sink);
+  // Match the children of "node" against the children of "matcher" seen as
+  // a regular expression.
+  template <typename Sink>
+  static bool matchChildList(const ScheduleNodeMatcher &matcher,
+                             isl::schedule_node node, Sink &sink);
+  // Whether the children of the matcher form a regular expression rather
+  // than a fixed list.
+  bool hasChildPattern() const;
+
   ScheduleNodeType current_;
   // is the matcher suppose to capture a node?
   bool needToCapture_ = false;
@@ -440,6 +548,140 @@ private:
   static thread_local std::vector<isl::schedule_node> dummyMultiCaptureData_;
 };
 
+/** Flat, non-recursive form of a schedule tree matcher.
+ * \ingroup Matchers
+ *
+ * The nested structure of a ScheduleNodeMatcher is lowered once into an array
+ * of instructions laid out in preorder.  Matching is a loop over this array
+ * that moves a single isl node handle through the schedule tree: node types
+ * and the number of children are checked on the isl C object and a C++
+ * wrapper is only created to call a callback or to capture a node.
+ *
+ * The compiled matcher keeps its own copies of the callbacks, so the original
+ * matcher may be destroyed after compilation.  Capture variables are still
+ * referenced and must outlive the compiled matcher.
+ */
+class CompiledMatcher {
+public:
+  explicit CompiledMatcher(const ScheduleNodeMatcher &matcher);
+
+  static bool isMatching(const CompiledMatcher &matcher,
+                         isl::schedule_node node);
+  static bool isMatching(const CompiledMatcher &matcher,
+                         isl::schedule_node node, uint64_t shape);
+  /// Match at the position of "cursor".  Types and numbers of children are
+  /// read from the index; isl nodes are only created for callbacks and
+  /// captures.  Defined in schedule_cursor.cc.
+  static bool isMatching(const CompiledMatcher &matcher,
+                         const ScheduleTreeCursor &cursor);
+
+  /// Number of instructions, i.e. of nodes in the original matcher.
+  size_t size() const { return program_.size(); }
+  /// Type of the root of the original matcher.
+  ScheduleNodeType rootType() const { return program_.front().type; }
+  /// Number of tree levels spanned by the matcher, 1 for a single node.
+  size_t height() const { return height_; }
+  /// Set of isl node types that must appear in a matching subtree, with bit
+  /// (1 << t) set for each required isl_schedule_node_type t.
+  uint32_t requiredTypes() const { return requiredTypes_; }
+  uint64_t shapeFingerprint() const { return shape_; }
+
+private:
+  static constexpr size_t noParent = static_cast<size_t>(-1);
+
+  struct Instruction {
+    ScheduleNodeType type;
+    // Expected isl node type, only meaningful for type-based matchers.
+    isl_schedule_node_type islType;
+    // Index of the parent instruction and position among its children.
+    size_t parent;
+    int position;
+    // Number of child matchers; if the only child is AnyForest, the node is
+    // only required to have at least one child.
+    size_t nChildren;
+    bool anyForestChild;
+    // Index in callbacks_, negative if there is no callback.
+    int callback;
+    // Capture targets, null if the matcher does not capture.
+    isl::schedule_node *capture;
+    std::vector<isl::schedule_node> *multiCapture;
+    // Index in delegates_ of the matcher to call on the node, negative if
+    // the node is matched by the instructions.  Matchers whose children form
+    // a pattern (see optional()) are not lowered.
+    int delegate;
+  };
+
+  void lower(const ScheduleNodeMatcher &matcher, size_t parent, int position);
+  bool matchNode(const Instruction &instruction,
+                 isl_schedule_node *node) const;
+
+  std::vector<Instruction> program_;
+  static size_t matcherHeight(const ScheduleNodeMatcher &matcher);
+
+  std::vector<std::function<bool(isl::schedule_node)>> callbacks_;
+  std::vector<ScheduleNodeMatcher> delegates_;
+  size_t height_ = 0;
+  uint32_t requiredTypes_ = 0;
+  uint64_t shape_ = 0;
+};
+
+/** Set of matchers applied together in a single tree traversal.
+ * \ingroup Matchers
+ *
+ * Matchers are compiled when added to the set and indexed by the type of
+ * their root, so that each visited node is only checked against the patterns
+ * that may be anchored at a node of its type.  Patterns rooted at anyTree()
+ * are checked against every node.  Patterns cannot be rooted at anyForest().
+ *
+ * Captures behave as if the matchers were applied one after another: after
+ * the traversal, they hold the values of the last match of each pattern.
+ */
+class MatcherSet {
+public:
+  MatcherSet() = default;
+  template <typename... Args>
+  explicit MatcherSet(const ScheduleNodeMatcher &matcher,
+                      const Args &... matchers) {
+    for (const auto &m : {matcher, matchers...}) {
+      add(m);
+    }
+  }
+
+  /// Add a matcher to the set and return its index.
+  size_t add(const ScheduleNodeMatcher &matcher);
+  size_t size() const { return matchers_.size(); }
+
+  /// Traverse the subtree rooted at "root" in preorder once and return, for
+  /// each matcher in the order of addition, the list of nodes it matched.
+  std::vector<std::vector<isl::schedule_node>>
+  findAll(isl::schedule_node root) const;
+
+private:
+  static constexpr int nIslTypes = isl_schedule_node_set + 1;
+
+  std::vector<CompiledMatcher> matchers_;
+  // Indices of matchers, by isl type of their root.
+  std::vector<size_t> byType_[nIslTypes];
+  // Indices of matchers rooted at anyTree().
+  std::vector<size_t> anyType_;
+};
+
+/// Construct a matcher from its components.  "capture" and "multiCapture"
+/// may be null if the matcher does not capture.  This is used to convert other
+/// representations of matchers, e.g. typed matchers, to ScheduleNodeMatcher.
+ScheduleNodeMatcher makeMatcher(ScheduleNodeType type,
+                                std::function<bool(isl::schedule_node)> callback,
+                                isl::schedule_node *capture,
+                                std::vector<isl::schedule_node> *multiCapture,
+                                std::vector<ScheduleNodeMatcher> children);
+
+/// Set the label of "matcher", e.g., band(labeled("inner", leaf())).
+inline ScheduleNodeMatcher labeled(std::string label,
+                                   ScheduleNodeMatcher matcher) {
+  matcher.setLabel(std::move(label));
+  return matcher;
+}
+
 std::function<bool(isl::schedule_node)>
 hasPreviousSibling(const ScheduleNodeMatcher &siblingMatcher);
 
@@ -510,3 +752,5 @@ std::function<bool(isl::schedule_node)> _or(Args... args) {
 } // namespace matchers
 
 #include "matchers-inl.h"
+
+#endif // MATCHERS_H
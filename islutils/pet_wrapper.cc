@@ -4,6 +4,7 @@
 #include "islutils/operators.h"
 #include "islutils/pet_wrapper.h"
 #include <iostream>
+#include <unordered_map>
 #include <vector>
 
 namespace pet {
@@ -115,6 +116,9 @@ struct ScopAndStmtsWrapper {
   std::vector<StmtDescr> &stmts;
   std::function<std::string(isl::ast_build, isl::ast_node, pet_stmt *)>
       stmtCodegen;
+  // Positions in "stmts" by occurrence identifier.  The descriptors keep the
+  // identifiers alive.
+  std::unordered_map<isl_id *, size_t> occurrences;
 };
 
 } // namespace
@@ -158,6 +162,7 @@ static __isl_give isl_ast_node *at_domain(__isl_take isl_ast_node *node,
   auto occurrenceId = isl::id::alloc(
       astBuild.get_ctx(), id.get_name() + "_occ_" + std::to_string(counter++),
       nullptr);
+  wrapper->occurrences.emplace(occurrenceId.get(), wrapper->stmts.size());
   wrapper->stmts.emplace_back(StmtDescr{occurrenceId, statement, astBuild});
   return isl_ast_node_set_annotation(node, occurrenceId.release());
 }
@@ -166,10 +171,9 @@ static __isl_give isl_ast_node *at_domain(__isl_take isl_ast_node *node,
 // The descriptor is expected to exist.
 static const StmtDescr &findStmtDescriptor(const ScopAndStmtsWrapper &wrapper,
                                            isl::id id) {
-  for (const auto &descr : wrapper.stmts) {
-    if (descr.occurrenceId == id) {
-      return descr;
-    }
+  auto it = wrapper.occurrences.find(id.get());
+  if (it != wrapper.occurrences.end()) {
+    return wrapper.stmts[it->second];
   }
   ISLUTILS_DIE("could not find statement");
   static StmtDescr dummy;
@@ -282,12 +286,14 @@ static isl::id getStmtId(const pet_stmt *stmt) {
 }
 
 pet_stmt *Scop::stmt(isl::id id) const {
-  for (int i = 0; i < scop_->n_stmt; ++i) {
-    if (getStmtId(scop_->stmts[i]) == id) {
-      return scop_->stmts[i];
+  if (stmtIndex_.empty()) {
+    stmtIndex_.reserve(scop_->n_stmt);
+    for (int i = 0; i < scop_->n_stmt; ++i) {
+      stmtIndex_.emplace(getStmtId(scop_->stmts[i]).get(), scop_->stmts[i]);
     }
   }
-  return nullptr;
+  auto it = stmtIndex_.find(id.get());
+  return it == stmtIndex_.end() ? nullptr : it->second;
 }
 
 IslCopyRefWrapper<isl::schedule> Scop::schedule() {
@@ -4,6 +4,7 @@
 #include <islutils/scop.h>
 #include <islutils/type_traits.h>
 #include <string>         // std::string
+#include <unordered_map>  // std::unordered_map
 #include <vector>         // std::vector
 
 class pet_scop;
@@ -98,7 +99,8 @@ public:
       std::function<std::string(isl::ast_build, isl::ast_node, pet_stmt *stmt, void *user)>
           custom = printPetAndCustomCommentsWithPayload, void *user = nullptr ) const;
 
-  /// Find a statement by its identifier.
+  /// Find a statement by its identifier.  Statements are indexed by their
+  /// identifiers on the first call.
   pet_stmt *stmt(isl::id id) const;
   /// Return an assignable wrapper class that can be used to overwrite the
   /// Scop's schedule.
@@ -133,6 +135,10 @@ public:
 
 private:
   pet_scop *scop_;
+  // Statements by the identifiers of their domains.  isl ids are unique
+  // within a context, so their addresses are used as keys; the statement
+  // domains keep the ids alive as long as the scop.
+  mutable std::unordered_map<isl_id *, pet_stmt *> stmtIndex_;
 };
 
 } // namespace pet
@@ -0,0 +1,248 @@
+#include "islutils/rewriter.h"
+#include "islutils/fingerprint.h"
+
+#include <isl/schedule_node.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+namespace rewriters {
+
+namespace {
+
+// Check that "path" designates an existing node below "node".  Paths in the
+// worklist may become stale when one of their ancestors is rewritten.
+bool isValidPath(isl::schedule_node node, const util::TreePath &path) {
+  for (auto position : path) {
+    if (position >= isl_schedule_node_n_children(node.get())) {
+      return false;
+    }
+    node = node.child(position);
+  }
+  return true;
+}
+
+// Whether "a" and "b" have the same type, number of children and properties.
+// Unlike fingerprints, properties are compared by isl, so that sets and
+// relations with different representations of the same elements are equal.
+bool isEqualNode(isl::schedule_node a, isl::schedule_node b) {
+  auto type = isl_schedule_node_get_type(a.get());
+  if (type != isl_schedule_node_get_type(b.get()) ||
+      isl_schedule_node_n_children(a.get()) !=
+          isl_schedule_node_n_children(b.get())) {
+    return false;
+  }
+  switch (type) {
+  case isl_schedule_node_band: {
+    int n = isl_schedule_node_band_n_member(a.get());
+    if (n != isl_schedule_node_band_n_member(b.get()) ||
+        isl_schedule_node_band_get_permutable(a.get()) !=
+            isl_schedule_node_band_get_permutable(b.get())) {
+      return false;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (isl_schedule_node_band_member_get_coincident(a.get(), i) !=
+          isl_schedule_node_band_member_get_coincident(b.get(), i)) {
+        return false;
+      }
+    }
+    return (n == 0 || a.band_get_partial_schedule_union_map().is_equal(
+                          b.band_get_partial_schedule_union_map())) &&
+           a.band_get_ast_build_options().is_equal(
+               b.band_get_ast_build_options());
+  }
+  case isl_schedule_node_domain:
+    return a.domain_get_domain().is_equal(b.domain_get_domain());
+  case isl_schedule_node_filter:
+    return a.filter_get_filter().is_equal(b.filter_get_filter());
+  case isl_schedule_node_context:
+    return a.context_get_context().is_equal(b.context_get_context());
+  case isl_schedule_node_guard:
+    return a.guard_get_guard().is_equal(b.guard_get_guard());
+  case isl_schedule_node_mark:
+    return a.mark_get_id().get() == b.mark_get_id().get();
+  case isl_schedule_node_extension:
+    return a.extension_get_extension().is_equal(b.extension_get_extension());
+  case isl_schedule_node_expansion:
+    return a.expansion_get_expansion().is_equal(b.expansion_get_expansion());
+  default:
+    return true;
+  }
+}
+
+bool isEqualSubtree(isl::schedule_node a, isl::schedule_node b) {
+  if (!isEqualNode(a, b)) {
+    return false;
+  }
+  int n = isl_schedule_node_n_children(a.get());
+  for (int i = 0; i < n; ++i) {
+    if (!isEqualSubtree(a.child(i), b.child(i))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether replacing "original" by "replaced", as described by "levels", left
+// the tree unchanged.  Only the replaced nodes are compared; the subtree
+// spliced below them is shared.
+bool isUnchanged(isl::schedule_node original, isl::schedule_node replaced,
+                 builders::ScheduleNodeBuilder::ReplacedLevels levels) {
+  if (levels.deleted < 0) {
+    return isEqualSubtree(original, replaced);
+  }
+  if (levels.deleted != levels.inserted) {
+    return false;
+  }
+  for (int i = 0; i < levels.deleted; ++i) {
+    if (!isEqualNode(original, replaced)) {
+      return false;
+    }
+    original = original.child(0);
+    replaced = replaced.child(0);
+  }
+  return true;
+}
+
+// Fingerprint of the "nLevels" nodes from "node" down, and of the root of the
+// subtree below them, which tells apart splices at different depths.  If
+// "nLevels" is negative, fingerprint the entire subtree.
+uint64_t replacedFingerprint(isl::schedule_node node, int nLevels) {
+  if (nLevels < 0) {
+    return matchers::subtreeFingerprint(node, true);
+  }
+  uint64_t hash = nLevels;
+  for (int i = 0; i < nLevels; ++i) {
+    matchers::combineHash(hash, matchers::nodeFingerprint(node, true));
+    node = node.child(0);
+  }
+  matchers::combineHash(hash, matchers::nodeFingerprint(node, true));
+  return hash;
+}
+
+bool isPrefix(const util::TreePath &prefix, const util::TreePath &path) {
+  return prefix.size() <= path.size() &&
+         std::equal(prefix.begin(), prefix.end(), path.begin());
+}
+
+} // namespace
+
+size_t Rewriter::addRule(std::string name,
+                         const matchers::ScheduleNodeMatcher &pattern,
+                         builders::ScheduleNodeBuilder &&replacement) {
+  rules_.emplace_back(std::move(name), pattern, std::move(replacement));
+  maxHeight_ = std::max(maxHeight_, rules_.back().pattern.height());
+  return rules_.size() - 1;
+}
+
+bool Rewriter::tryRules(isl::schedule_node &node, const util::TreePath &path,
+                        std::vector<WorkItem> &worklist) {
+  auto shape = matchers::shapeFingerprint(node);
+  for (size_t i = 0, e = rules_.size(); i < e; ++i) {
+    const auto &rule = rules_[i];
+    ++stats_[i].visitedNodes;
+    if (!matchers::CompiledMatcher::isMatching(rule.pattern, node, shape)) {
+      continue;
+    }
+
+    builders::ScheduleNodeBuilder::ReplacedLevels levels;
+    auto replaced = rule.replacement.replace(node, levels);
+    // A rewrite that does not change the tree should not shadow the
+    // following rules.
+    if (isUnchanged(node, replaced, levels)) {
+      continue;
+    }
+    auto before = replacedFingerprint(node, levels.deleted);
+    auto after = replacedFingerprint(replaced, levels.inserted);
+    if (before == after || seen_.count({path, after}) != 0) {
+      cycle_ = true;
+      continue;
+    }
+    forgetStates(path);
+    seen_.emplace(path, before);
+    seen_.emplace(path, after);
+
+    node = replaced;
+    ++stats_[i].rewrites;
+    ++iterations_;
+    // The worklist is processed last-in first-out: visit the new subtree
+    // first, then the ancestors from the closest to the farthest one.
+    size_t nAncestors = std::min(path.size(), maxHeight_ - 1);
+    for (size_t k = nAncestors; k >= 1; --k) {
+      worklist.push_back({util::TreePath(path.begin(), path.end() - k), false});
+    }
+    worklist.push_back({path, true});
+    return true;
+  }
+  return false;
+}
+
+void Rewriter::forgetStates(const util::TreePath &path) {
+  constexpr auto maxHash = std::numeric_limits<uint64_t>::max();
+  // Descendants are ordered after "path" and before any other path.
+  auto it = seen_.upper_bound({path, maxHash});
+  while (it != seen_.end() && isPrefix(path, it->first)) {
+    it = seen_.erase(it);
+  }
+  for (size_t length = 0; length < path.size(); ++length) {
+    util::TreePath ancestor(path.begin(), path.begin() + length);
+    seen_.erase(seen_.lower_bound({ancestor, 0}),
+                seen_.upper_bound({ancestor, maxHash}));
+  }
+}
+
+isl::schedule_node Rewriter::rewrite(isl::schedule_node node) {
+  stats_.assign(rules_.size(), RuleStatistics());
+  iterations_ = 0;
+  fixpoint_ = false;
+  cycle_ = false;
+  seen_.clear();
+
+  std::vector<WorkItem> worklist{{util::TreePath(), true}};
+  while (!worklist.empty()) {
+    if (iterations_ >= maxIterations_) {
+      return node;
+    }
+    auto item = std::move(worklist.back());
+    worklist.pop_back();
+    if (!isValidPath(node, item.path)) {
+      continue;
+    }
+
+    auto path = item.path;
+    auto current = util::followPath(node, path);
+    if (!item.subtree) {
+      tryRules(current, path, worklist);
+      node = util::ancestor(current, path.size());
+      continue;
+    }
+
+    // Preorder traversal of the subtree, skipping over rewritten subtrees
+    // since they have been scheduled for a visit of their own.
+    size_t base = path.size();
+    while (iterations_ < maxIterations_) {
+      bool rewritten = tryRules(current, path, worklist);
+      if (!rewritten && isl_schedule_node_n_children(current.get()) > 0) {
+        current = current.child(0);
+        path.push_back(0);
+        continue;
+      }
+      while (path.size() > base &&
+             !isl_schedule_node_has_next_sibling(current.get())) {
+        current = current.parent();
+        path.pop_back();
+      }
+      if (path.size() == base) {
+        break;
+      }
+      current = current.next_sibling();
+      ++path.back();
+    }
+    node = util::ancestor(current, path.size());
+  }
+  fixpoint_ = true;
+  return node;
+}
+
+} // namespace rewriters
@@ -0,0 +1,125 @@
+#ifndef ISLUTILS_REWRITER_H
+#define ISLUTILS_REWRITER_H
+
+#include "islutils/builders.h"
+#include "islutils/matchers.h"
+#include "islutils/tree_path.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rewriters {
+
+/** \brief Replace subtrees matching a pattern by a built tree.
+ *
+ * Whenever "pattern" matches a node, the subtree rooted at this node is
+ * replaced by "replacement", see builders::ScheduleNodeBuilder::replace.  The
+ * replacement builder typically refers, through lambdas or builders::splice,
+ * to the nodes captured by the pattern.
+ */
+struct RewriteRule {
+  RewriteRule(std::string name, const matchers::ScheduleNodeMatcher &pattern,
+              builders::ScheduleNodeBuilder &&replacement)
+      : name(std::move(name)), pattern(pattern),
+        replacement(std::move(replacement)) {}
+
+  std::string name;
+  matchers::CompiledMatcher pattern;
+  builders::ScheduleNodeBuilder replacement;
+};
+
+/// Per-rule counters collected by the Rewriter.
+struct RuleStatistics {
+  /// Number of rewrites that changed the tree.
+  size_t rewrites = 0;
+  /// Number of nodes the pattern was checked against.
+  size_t visitedNodes = 0;
+};
+
+/** \brief Apply a set of rewrite rules until none of them applies anymore.
+ *
+ * The rewriter keeps a worklist of tree paths, relative to the root of the
+ * rewritten subtree, that may contain new matches.  Initially, the entire
+ * subtree is scheduled for visiting.  After a rewrite, only the replaced
+ * subtree and those of its ancestors that are close enough to be the root of
+ * a match involving the new nodes (according to the height of the patterns)
+ * are revisited, rather than restarting from the root.
+ *
+ * Rules are tried in the order of their addition and the first rule that
+ * matches a node is applied.  A rewrite whose replaced nodes are equal to the
+ * original ones, as compared by isl, is not counted as a change and does not
+ * schedule further visits.  A rewrite reproducing nodes already seen at the
+ * same position is a cycle between rules; it is reported and not followed.
+ * Only the replaced nodes are compared, not the subtree spliced below them,
+ * so that the cost of a rewrite does not depend on the size of that subtree.
+ * The nodes seen at a position are forgotten when the tree changes above or
+ * below it, since the position may then designate a different region.
+ * Cycles that are not detected, for example because isl represents the same
+ * sets differently, stop after at most "maxIterations" rewrites.
+ *
+ * Patterns whose callbacks inspect nodes outside the matched subtree, for
+ * example through hasSibling() or hasDescendant() with a deep pattern, may
+ * miss matches that are enabled by rewrites outside of the revisited region.
+ */
+class Rewriter {
+public:
+  explicit Rewriter(size_t maxIterations = 1000)
+      : maxIterations_(maxIterations) {}
+
+  /// Add a rule and return its index.
+  size_t addRule(std::string name, const matchers::ScheduleNodeMatcher &pattern,
+                 builders::ScheduleNodeBuilder &&replacement);
+
+  /// Rewrite the subtree rooted at "node" and return the node at the same
+  /// position in the resulting tree.
+  isl::schedule_node rewrite(isl::schedule_node node);
+
+  size_t nRules() const { return rules_.size(); }
+  const std::string &ruleName(size_t rule) const {
+    return rules_.at(rule).name;
+  }
+  /// Statistics of the last call to rewrite(), one entry per rule.
+  const std::vector<RuleStatistics> &statistics() const { return stats_; }
+  /// Number of rewrites performed by the last call to rewrite().
+  size_t iterations() const { return iterations_; }
+  /// Whether the last call to rewrite() stopped because no rule applied
+  /// anymore, as opposed to reaching the iteration limit.
+  bool reachedFixpoint() const { return fixpoint_; }
+  /// Whether the last call to rewrite() detected a rewrite cycle.
+  bool detectedCycle() const { return cycle_; }
+
+private:
+  struct WorkItem {
+    util::TreePath path;
+    // Visit the entire subtree or only the node at "path".
+    bool subtree;
+  };
+
+  // Try all rules on "node".  If one of them applies, replace "node" and
+  // return true.
+  bool tryRules(isl::schedule_node &node, const util::TreePath &path,
+                std::vector<WorkItem> &worklist);
+  // Forget the nodes seen strictly above and below "path", whose regions
+  // change when "path" is rewritten.
+  void forgetStates(const util::TreePath &path);
+
+  std::vector<RewriteRule> rules_;
+  size_t maxIterations_;
+  // Largest number of tree levels spanned by a pattern.
+  size_t maxHeight_ = 0;
+
+  std::vector<RuleStatistics> stats_;
+  size_t iterations_ = 0;
+  bool fixpoint_ = false;
+  bool cycle_ = false;
+  // Fingerprints of the replaced nodes that appeared at each position.
+  std::set<std::pair<util::TreePath, uint64_t>> seen_;
+};
+
+} // namespace rewriters
+
+#endif // ISLUTILS_REWRITER_H
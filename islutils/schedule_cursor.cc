@@ -0,0 +1,109 @@
+#include "islutils/schedule_cursor.h"
+#include "islutils/die.h"
+
+#include <isl/schedule_node.h>
+
+namespace matchers {
+
+bool ScheduleTreeCursor::hasNextSibling() const {
+  return hasParent() &&
+         entry().childPosition + 1 < (*index_)[entry().parent].nChildren;
+}
+
+ScheduleTreeCursor PostorderCursorIterator::first(ScheduleTreeCursor root) {
+  while (root.hasChildren()) {
+    root = root.child(0);
+  }
+  return root;
+}
+
+PostorderCursorIterator &PostorderCursorIterator::operator++() {
+  if (cursor_ == root_) {
+    cursor_ = ScheduleTreeCursor(root_.index(), ScheduleTreeIndex::npos);
+  } else if (cursor_.hasNextSibling()) {
+    cursor_ = first(cursor_.nextSibling());
+  } else {
+    cursor_ = cursor_.parent();
+  }
+  return *this;
+}
+
+CursorRange<PreorderCursorIterator> preorder(ScheduleTreeCursor root) {
+  ScheduleTreeCursor end(root.index(), root.entry().subtreeEnd);
+  return CursorRange<PreorderCursorIterator>(PreorderCursorIterator(root),
+                                             PreorderCursorIterator(end));
+}
+
+CursorRange<PostorderCursorIterator> postorder(ScheduleTreeCursor root) {
+  ScheduleTreeCursor end(root.index(), ScheduleTreeIndex::npos);
+  return CursorRange<PostorderCursorIterator>(
+      PostorderCursorIterator(root, PostorderCursorIterator::first(root)),
+      PostorderCursorIterator(root, end));
+}
+
+bool CompiledMatcher::isMatching(const CompiledMatcher &matcher,
+                                 const ScheduleTreeCursor &cursor) {
+  const auto &program = matcher.program_;
+  const auto &index = cursor.index();
+  // Positions in the index of the nodes matched by each instruction.
+  std::vector<size_t> positions(program.size());
+  for (size_t pc = 0, e = program.size(); pc < e; ++pc) {
+    const Instruction &instruction = program[pc];
+    size_t position = cursor.position();
+    if (pc != 0) {
+      position = index.child(positions[instruction.parent],
+                             instruction.position);
+    }
+    positions[pc] = position;
+    const auto &entry = index[position];
+
+    if (instruction.type == ScheduleNodeType::AnyTree) {
+      continue;
+    }
+    if (instruction.type == ScheduleNodeType::AnyForest) {
+      if (entry.childPosition > 0) {
+        ISLUTILS_DIE("AnyForest matcher combined with other types");
+      }
+      continue;
+    }
+    if (entry.type != instruction.islType) {
+      return false;
+    }
+    // Only create isl nodes for the matchers that need them.
+    if (instruction.delegate >= 0 || instruction.callback >= 0) {
+      if (!matcher.matchNode(instruction, index.node(position).get())) {
+        return false;
+      }
+      continue;
+    }
+    size_t nChildren = static_cast<size_t>(entry.nChildren);
+    if (instruction.anyForestChild ? nChildren == 0
+                                   : nChildren != instruction.nChildren) {
+      return false;
+    }
+  }
+
+  for (size_t pc = 0, e = program.size(); pc < e; ++pc) {
+    const Instruction &instruction = program[pc];
+    if (instruction.capture) {
+      *instruction.capture = index.node(positions[pc]);
+    }
+    if (instruction.multiCapture) {
+      auto parentPosition = index[positions[pc]].parent;
+      instruction.multiCapture->clear();
+      // The root has no siblings.
+      if (parentPosition == ScheduleTreeIndex::npos) {
+        instruction.multiCapture->push_back(index.node(positions[pc]));
+        continue;
+      }
+      const auto &parent = index[parentPosition];
+      for (int i = 0; i < parent.nChildren; ++i) {
+        instruction.multiCapture->push_back(
+            index.node(index.child(parentPosition, i)));
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace matchers
@@ -0,0 +1,165 @@
+#ifndef ISLUTILS_SCHEDULE_CURSOR_H
+#define ISLUTILS_SCHEDULE_CURSOR_H
+
+#include "islutils/schedule_index.h"
+
+#include <cstddef>
+#include <iterator>
+
+namespace matchers {
+
+/** Read-only position in an indexed schedule tree.
+ * \ingroup Matchers
+ *
+ * A cursor is a position in a ScheduleTreeIndex.  Moving to the parent, a
+ * child or a sibling and querying the type or the number of children are
+ * constant-time operations that do not involve isl.  An isl::schedule_node
+ * is only created by node(), at a cost proportional to the depth of the node.
+ * The index must outlive the cursor.
+ */
+class ScheduleTreeCursor {
+public:
+  explicit ScheduleTreeCursor(const ScheduleTreeIndex &index,
+                              size_t position = 0)
+      : index_(&index), position_(position) {}
+
+  const ScheduleTreeIndex &index() const { return *index_; }
+  size_t position() const { return position_; }
+  const ScheduleTreeIndex::Entry &entry() const {
+    return (*index_)[position_];
+  }
+
+  isl_schedule_node_type type() const { return entry().type; }
+  int nChildren() const { return entry().nChildren; }
+  int depth() const { return entry().depth; }
+  int childPosition() const { return entry().childPosition; }
+
+  bool hasParent() const { return entry().parent != ScheduleTreeIndex::npos; }
+  bool hasChildren() const { return entry().nChildren > 0; }
+  bool hasNextSibling() const;
+  bool hasPreviousSibling() const {
+    return hasParent() && entry().childPosition > 0;
+  }
+
+  ScheduleTreeCursor parent() const { return at(entry().parent); }
+  ScheduleTreeCursor child(int child) const {
+    return at(index_->child(position_, child));
+  }
+  ScheduleTreeCursor nextSibling() const {
+    return parent().child(entry().childPosition + 1);
+  }
+  ScheduleTreeCursor previousSibling() const {
+    return parent().child(entry().childPosition - 1);
+  }
+
+  /// Create the isl node at the position of the cursor.
+  isl::schedule_node node() const { return index_->node(position_); }
+
+  bool operator==(const ScheduleTreeCursor &other) const {
+    return index_ == other.index_ && position_ == other.position_;
+  }
+  bool operator!=(const ScheduleTreeCursor &other) const {
+    return !(*this == other);
+  }
+
+private:
+  ScheduleTreeCursor at(size_t position) const {
+    return ScheduleTreeCursor(*index_, position);
+  }
+
+  const ScheduleTreeIndex *index_;
+  size_t position_;
+};
+
+/// Iterator over the cursors of a subtree in preorder.
+class PreorderCursorIterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = ScheduleTreeCursor;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const ScheduleTreeCursor *;
+  using reference = const ScheduleTreeCursor &;
+
+  explicit PreorderCursorIterator(ScheduleTreeCursor cursor)
+      : cursor_(cursor) {}
+
+  reference operator*() const { return cursor_; }
+  pointer operator->() const { return &cursor_; }
+  PreorderCursorIterator &operator++() {
+    // Preorder positions in a subtree are consecutive.
+    cursor_ = ScheduleTreeCursor(cursor_.index(), cursor_.position() + 1);
+    return *this;
+  }
+  PreorderCursorIterator operator++(int) {
+    auto result = *this;
+    ++*this;
+    return result;
+  }
+  bool operator==(const PreorderCursorIterator &other) const {
+    return cursor_ == other.cursor_;
+  }
+  bool operator!=(const PreorderCursorIterator &other) const {
+    return !(*this == other);
+  }
+
+private:
+  ScheduleTreeCursor cursor_;
+};
+
+/// Iterator over the cursors of a subtree in postorder.  Advancing takes
+/// amortized constant time.
+class PostorderCursorIterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = ScheduleTreeCursor;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const ScheduleTreeCursor *;
+  using reference = const ScheduleTreeCursor &;
+
+  /// Iterator at "cursor" in the postorder traversal of the subtree rooted
+  /// at "root".
+  PostorderCursorIterator(ScheduleTreeCursor root, ScheduleTreeCursor cursor)
+      : root_(root), cursor_(cursor) {}
+
+  reference operator*() const { return cursor_; }
+  pointer operator->() const { return &cursor_; }
+  PostorderCursorIterator &operator++();
+  PostorderCursorIterator operator++(int) {
+    auto result = *this;
+    ++*this;
+    return result;
+  }
+  bool operator==(const PostorderCursorIterator &other) const {
+    return cursor_ == other.cursor_;
+  }
+  bool operator!=(const PostorderCursorIterator &other) const {
+    return !(*this == other);
+  }
+
+  /// First node of the subtree rooted at "root" in postorder.
+  static ScheduleTreeCursor first(ScheduleTreeCursor root);
+
+private:
+  ScheduleTreeCursor root_;
+  ScheduleTreeCursor cursor_;
+};
+
+template <typename Iterator> class CursorRange {
+public:
+  CursorRange(Iterator begin, Iterator end) : begin_(begin), end_(end) {}
+  Iterator begin() const { return begin_; }
+  Iterator end() const { return end_; }
+
+private:
+  Iterator begin_;
+  Iterator end_;
+};
+
+/// Cursors of the subtree rooted at "root" in preorder.
+CursorRange<PreorderCursorIterator> preorder(ScheduleTreeCursor root);
+/// Cursors of the subtree rooted at "root" in postorder.
+CursorRange<PostorderCursorIterator> postorder(ScheduleTreeCursor root);
+
+} // namespace matchers
+
+#endif // ISLUTILS_SCHEDULE_CURSOR_H
@@ -0,0 +1,176 @@
+#include "islutils/schedule_index.h"
+#include "islutils/die.h"
+#include "islutils/tree_path.h"
+
+#include <isl/schedule_node.h>
+
+#include <algorithm>
+
+namespace matchers {
+
+ScheduleTreeIndex::ScheduleTreeIndex(isl::schedule_node node)
+    : root_(node.root()) {
+  // Iterative preorder traversal moving a single handle through the tree.
+  isl_schedule_node *current = root_.copy();
+  size_t parent = npos;
+  int depth = 0;
+  int childPosition = 0;
+  while (current) {
+    Entry entry;
+    entry.type = isl_schedule_node_get_type(current);
+    entry.depth = depth;
+    entry.nChildren = isl_schedule_node_n_children(current);
+    entry.parent = parent;
+    entry.childPosition = childPosition;
+    entry.firstChild = 0;
+    entry.subtreeEnd = entries_.size() + 1;
+    entry.subtreeTypes = typeBit(entry.type);
+    entry.ancestorTypes = 0;
+    if (parent != npos) {
+      entry.ancestorTypes =
+          entries_[parent].ancestorTypes | typeBit(entries_[parent].type);
+    }
+    entries_.push_back(entry);
+
+    size_t done = entries_.size() - 1;
+    if (entry.nChildren > 0) {
+      current = isl_schedule_node_child(current, 0);
+      parent = done;
+      childPosition = 0;
+      ++depth;
+      continue;
+    }
+    while (depth > 0 &&
+           isl_schedule_node_has_next_sibling(current) != isl_bool_true) {
+      current = isl_schedule_node_parent(current);
+      done = entries_[done].parent;
+      --depth;
+    }
+    if (depth == 0) {
+      break;
+    }
+    current = isl_schedule_node_next_sibling(current);
+    parent = entries_[done].parent;
+    childPosition = entries_[done].childPosition + 1;
+  }
+  isl_schedule_node_free(current);
+
+  // Children follow their parents, so a reverse pass sees complete subtrees.
+  for (size_t i = entries_.size(); i-- > 1;) {
+    auto &parentEntry = entries_[entries_[i].parent];
+    parentEntry.subtreeEnd =
+        std::max(parentEntry.subtreeEnd, entries_[i].subtreeEnd);
+    parentEntry.subtreeTypes |= entries_[i].subtreeTypes;
+  }
+
+  size_t nChildren = 0;
+  for (auto &entry : entries_) {
+    entry.firstChild = nChildren;
+    nChildren += entry.nChildren;
+  }
+  children_.resize(nChildren);
+  for (size_t i = 1, e = entries_.size(); i < e; ++i) {
+    const auto &parentEntry = entries_[entries_[i].parent];
+    children_[parentEntry.firstChild + entries_[i].childPosition] = i;
+  }
+}
+
+size_t ScheduleTreeIndex::child(size_t position, int child) const {
+  if (child < 0 || child >= entries_.at(position).nChildren) {
+    ISLUTILS_DIE("child position out of range");
+  }
+  return children_[entries_[position].firstChild + child];
+}
+
+isl::schedule_node ScheduleTreeIndex::node(size_t position) const {
+  util::TreePath path(entries_.at(position).depth);
+  for (size_t i = position; entries_[i].parent != npos;
+       i = entries_[i].parent) {
+    path[entries_[i].depth - 1] = entries_[i].childPosition;
+  }
+  return util::followPath(root_, path);
+}
+
+size_t ScheduleTreeIndex::find(isl::schedule_node node) const {
+  size_t position = 0;
+  for (auto childPosition : util::pathFromRoot(node)) {
+    position = child(position, childPosition);
+  }
+  return position;
+}
+
+// Bit of the isl type of the root of "matcher", zero if it matches any type.
+static uint32_t rootTypeBit(const CompiledMatcher &matcher) {
+  auto type = matcher.rootType();
+  if (type == ScheduleNodeType::AnyTree ||
+      type == ScheduleNodeType::AnyForest) {
+    return 0;
+  }
+  return ScheduleTreeIndex::typeBit(toIslType(type));
+}
+
+std::function<bool(isl::schedule_node)>
+hasDescendant(const ScheduleTreeIndex &index,
+              const ScheduleNodeMatcher &descendantMatcher) {
+  CompiledMatcher matcher(descendantMatcher);
+  return [&index, matcher](isl::schedule_node node) {
+    size_t position = index.find(node);
+    auto required = matcher.requiredTypes();
+    auto rootBit = rootTypeBit(matcher);
+    auto end = index[position].subtreeEnd;
+    // Like isl_schedule_node_foreach_descendant_top_down, visit the node
+    // itself and its descendants in preorder.
+    for (size_t i = position; i < end; ++i) {
+      const auto &entry = index[i];
+      if ((entry.subtreeTypes & required) != required) {
+        i = entry.subtreeEnd - 1;
+        continue;
+      }
+      if (rootBit != 0 && ScheduleTreeIndex::typeBit(entry.type) != rootBit) {
+        continue;
+      }
+      util::TreePath path(entry.depth - index[position].depth);
+      for (size_t j = i; j != position; j = index[j].parent) {
+        path[index[j].depth - index[position].depth - 1] =
+            index[j].childPosition;
+      }
+      if (CompiledMatcher::isMatching(matcher, util::followPath(node, path))) {
+        return true;
+      }
+    }
+    return false;
+  };
+}
+
+std::function<bool(isl::schedule_node)>
+hasAncestor(const ScheduleTreeIndex &index,
+            const ScheduleNodeMatcher &ancestorMatcher) {
+  CompiledMatcher matcher(ancestorMatcher);
+  return [&index, matcher](isl::schedule_node node) {
+    size_t position = index.find(node);
+    auto rootBit = rootTypeBit(matcher);
+    if (rootBit != 0 && (index[position].ancestorTypes & rootBit) == 0) {
+      return false;
+    }
+    std::vector<size_t> ancestors;
+    for (size_t i = index[position].parent; i != ScheduleTreeIndex::npos;
+         i = index[i].parent) {
+      ancestors.push_back(i);
+    }
+    // Like isl_schedule_node_foreach_ancestor_top_down, visit the ancestors
+    // starting from the root.
+    for (size_t generation = ancestors.size(); generation > 0; --generation) {
+      const auto &entry = index[ancestors[generation - 1]];
+      if (rootBit != 0 && ScheduleTreeIndex::typeBit(entry.type) != rootBit) {
+        continue;
+      }
+      if (CompiledMatcher::isMatching(matcher,
+                                      util::ancestor(node, generation))) {
+        return true;
+      }
+    }
+    return false;
+  };
+}
+
+} // namespace matchers
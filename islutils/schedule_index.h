@@ -0,0 +1,89 @@
+#ifndef ISLUTILS_SCHEDULE_INDEX_H
+#define ISLUTILS_SCHEDULE_INDEX_H
+
+#include "islutils/matchers.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace matchers {
+
+/** Summary of the node types present in each subtree of a schedule tree.
+ * \ingroup Matchers
+ *
+ * The index is built once for a schedule tree by a single traversal and
+ * stores, for each node in preorder, its type, depth and number of children
+ * together with the set of node types in its subtree (including the node
+ * itself) and on the path from the root (excluding the node itself).  Sets of
+ * types are bitmasks with bit (1 << t) set for each isl_schedule_node_type t.
+ *
+ * The index refers to the tree as it was when the index was built.  It must
+ * be rebuilt after the tree is modified.
+ */
+class ScheduleTreeIndex {
+public:
+  static constexpr size_t npos = static_cast<size_t>(-1);
+
+  struct Entry {
+    isl_schedule_node_type type;
+    int depth;
+    int nChildren;
+    // Position of the parent entry, npos for the root, and position of the
+    // node among the children of its parent.
+    size_t parent;
+    int childPosition;
+    // Offset of the positions of the children in the child table.
+    size_t firstChild;
+    // One past the position of the last entry in the subtree.
+    size_t subtreeEnd;
+    uint32_t subtreeTypes;
+    uint32_t ancestorTypes;
+  };
+
+  /// Index the entire schedule tree containing "node".
+  explicit ScheduleTreeIndex(isl::schedule_node node);
+
+  static uint32_t typeBit(isl_schedule_node_type type) {
+    return type < 0 ? 0 : 1u << type;
+  }
+
+  size_t size() const { return entries_.size(); }
+  const Entry &operator[](size_t position) const {
+    return entries_.at(position);
+  }
+
+  /// Position of the entry describing "node", which must belong to the
+  /// indexed tree.
+  size_t find(isl::schedule_node node) const;
+  /// Position of the "child"-th child of the entry at "position".
+  size_t child(size_t position, int child) const;
+  /// Create the isl node described by the entry at "position".
+  isl::schedule_node node(size_t position) const;
+  isl::schedule_node root() const { return root_; }
+
+private:
+  isl::schedule_node root_;
+  std::vector<Entry> entries_;
+  // Positions of the children of all entries, grouped by parent.
+  std::vector<size_t> children_;
+};
+
+/// Same as hasDescendant(descendantMatcher), rejecting nodes whose subtree
+/// lacks some node type required by the matcher without any traversal and
+/// only visiting descendants of the type of the matcher root.  "index" must
+/// outlive the returned callback and describe the tree it is called on.
+std::function<bool(isl::schedule_node)>
+hasDescendant(const ScheduleTreeIndex &index,
+              const ScheduleNodeMatcher &descendantMatcher);
+
+/// Same as hasAncestor(ancestorMatcher), using "index" to only visit the
+/// ancestors of the type of the matcher root.
+std::function<bool(isl::schedule_node)>
+hasAncestor(const ScheduleTreeIndex &index,
+            const ScheduleNodeMatcher &ancestorMatcher);
+
+} // namespace matchers
+
+#endif // ISLUTILS_SCHEDULE_INDEX_H
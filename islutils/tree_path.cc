@@ -0,0 +1,44 @@
+#include "islutils/tree_path.h"
+#include "islutils/die.h"
+
+#include <isl/schedule_node.h>
+
+namespace util {
+
+TreePath pathFromRoot(isl::schedule_node node) {
+  int depth = isl_schedule_node_get_tree_depth(node.get());
+  if (depth < 0) {
+    ISLUTILS_DIE("could not compute the depth of a schedule node");
+  }
+  return pathFromAncestor(node, depth);
+}
+
+TreePath pathFromAncestor(isl::schedule_node node, int generation) {
+  TreePath path(generation);
+  // Walk up with a single handle, modified in place.
+  isl_schedule_node *current = node.copy();
+  for (int i = generation - 1; i >= 0; --i) {
+    path[i] = isl_schedule_node_get_child_position(current);
+    current = isl_schedule_node_parent(current);
+  }
+  isl_schedule_node_free(current);
+  return path;
+}
+
+isl::schedule_node followPath(isl::schedule_node node, const TreePath &path) {
+  isl_schedule_node *current = node.copy();
+  for (auto position : path) {
+    current = isl_schedule_node_child(current, position);
+  }
+  return isl::manage(current);
+}
+
+isl::schedule_node ancestor(isl::schedule_node node, int generation) {
+  isl_schedule_node *current = node.copy();
+  for (int i = 0; i < generation; ++i) {
+    current = isl_schedule_node_parent(current);
+  }
+  return isl::manage(current);
+}
+
+} // namespace util
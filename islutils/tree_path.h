@@ -0,0 +1,30 @@
+#ifndef ISLUTILS_TREE_PATH_H
+#define ISLUTILS_TREE_PATH_H
+
+#include <isl/isl-noexceptions.h>
+
+#include <vector>
+
+namespace util {
+
+/// Position of a node in a schedule tree, given as the sequence of child
+/// positions to follow from some ancestor.  Unlike an isl::schedule_node, a
+/// path remains meaningful after copy-on-write modifications of the tree as
+/// long as the nodes above the designated node are left untouched.
+using TreePath = std::vector<int>;
+
+/// Compute the path to "node" from the root of its schedule tree.
+TreePath pathFromRoot(isl::schedule_node node);
+
+/// Compute the path to "node" from its ancestor "generation" levels above.
+TreePath pathFromAncestor(isl::schedule_node node, int generation);
+
+/// Follow "path" downwards starting from "node".
+isl::schedule_node followPath(isl::schedule_node node, const TreePath &path);
+
+/// Go up "generation" levels from "node".
+isl::schedule_node ancestor(isl::schedule_node node, int generation);
+
+} // namespace util
+
+#endif // ISLUTILS_TREE_PATH_H
@@ -0,0 +1,305 @@
+#ifndef ISLUTILS_TYPED_MATCHERS_H
+#define ISLUTILS_TYPED_MATCHERS_H
+
+#include "islutils/matchers.h"
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace matchers {
+
+/** \defgroup TypedMatchers Typed Matchers
+ * \ingroup Matchers
+ * \brief Structural matchers whose structure is encoded in their type.
+ *
+ * The constructors in this namespace mirror the structural matcher
+ * constructors (see \ref MatchersStructuralCstr) but return objects whose type
+ * encodes the node types, the callback types and the children of the matcher.
+ * Matching is a call to a function template that the compiler can inline
+ * entirely: no callback is type-erased, no matcher is allocated on the heap,
+ * and nodes are inspected through the isl C interface.  The combinators
+ * allOf() and anyOf() evaluate their callbacks lazily, from left to right.
+ *
+ * Typed matchers convert implicitly to ScheduleNodeMatcher, for example to be
+ * stored in containers or passed to functions expecting the latter:
+ *
+ * ```
+ * isl::schedule_node inner;
+ * auto m = typed::band(typed::band(inner, typed::leaf()));
+ * bool found = typed::isMatching(m, node);
+ * ScheduleNodeMatcher erased = m;
+ * ```
+ * \{
+ */
+namespace typed {
+
+template <typename T> struct IsPattern : std::false_type {};
+
+/// Callback accepting every node, removed at compile time.
+struct NoCallback {
+  bool operator()(isl::schedule_node) const { return true; }
+};
+
+class AnyTree {
+public:
+  explicit AnyTree(isl::schedule_node *capture) : capture_(capture) {}
+
+  bool match(isl_schedule_node *node) const {
+    if (capture_) {
+      *capture_ = isl::manage_copy(node);
+    }
+    return true;
+  }
+
+  operator ScheduleNodeMatcher() const {
+    return makeMatcher(ScheduleNodeType::AnyTree, nullptr, capture_, nullptr,
+                       {});
+  }
+
+private:
+  isl::schedule_node *capture_;
+};
+
+/// Matches a node and all its next siblings; only valid as the single child
+/// of a typed matcher, which Node checks at compile time.
+class AnyForest {
+public:
+  explicit AnyForest(std::vector<isl::schedule_node> *capture)
+      : capture_(capture) {}
+
+  bool match(isl_schedule_node *node) const {
+    if (!capture_) {
+      return true;
+    }
+    capture_->clear();
+    auto sibling = isl::manage_copy(node);
+    capture_->push_back(sibling);
+    while (isl_schedule_node_has_next_sibling(sibling.get()) ==
+           isl_bool_true) {
+      sibling = isl::manage(isl_schedule_node_next_sibling(sibling.release()));
+      capture_->push_back(sibling);
+    }
+    return true;
+  }
+
+  operator ScheduleNodeMatcher() const {
+    return makeMatcher(ScheduleNodeType::AnyForest, nullptr, nullptr, capture_,
+                       {});
+  }
+
+private:
+  std::vector<isl::schedule_node> *capture_;
+};
+
+template <isl_schedule_node_type Type, typename Callback,
+          typename... Children>
+class Node {
+public:
+  Node(Callback callback, isl::schedule_node *capture, Children... children)
+      : callback_(std::move(callback)), capture_(capture),
+        children_(std::move(children)...) {}
+
+  bool match(isl_schedule_node *node) const {
+    if (isl_schedule_node_get_type(node) != Type) {
+      return false;
+    }
+    if constexpr (!std::is_same<Callback, NoCallback>::value) {
+      if (!callback_(isl::manage_copy(node))) {
+        return false;
+      }
+    }
+    int nChildren = isl_schedule_node_n_children(node);
+    if constexpr (anyForestChild) {
+      if (nChildren == 0) {
+        return false;
+      }
+    } else if (nChildren != static_cast<int>(sizeof...(Children))) {
+      return false;
+    }
+    if (!matchChildren(node, std::index_sequence_for<Children...>())) {
+      return false;
+    }
+    if (capture_) {
+      *capture_ = isl::manage_copy(node);
+    }
+    return true;
+  }
+
+  operator ScheduleNodeMatcher() const {
+    std::function<bool(isl::schedule_node)> callback;
+    if constexpr (!std::is_same<Callback, NoCallback>::value) {
+      callback = callback_;
+    }
+    std::vector<ScheduleNodeMatcher> children;
+    std::apply(
+        [&children](const Children &... child) {
+          (children.push_back(static_cast<ScheduleNodeMatcher>(child)), ...);
+        },
+        children_);
+    return makeMatcher(fromIslType(Type), std::move(callback), capture_,
+                       nullptr, std::move(children));
+  }
+
+private:
+  static constexpr bool anyForestChild =
+      sizeof...(Children) == 1 &&
+      std::is_same<std::tuple<Children...>, std::tuple<AnyForest>>::value;
+  static_assert(anyForestChild ||
+                    !(std::is_same<Children, AnyForest>::value || ...),
+                "anyForest() is only valid as the single child");
+
+  template <size_t... I>
+  bool matchChildren(isl_schedule_node *node,
+                     std::index_sequence<I...>) const {
+    return (matchChild<I>(node) && ...);
+  }
+
+  template <size_t I> bool matchChild(isl_schedule_node *node) const {
+    isl_schedule_node *child = isl_schedule_node_get_child(node, I);
+    bool result = child && std::get<I>(children_).match(child);
+    isl_schedule_node_free(child);
+    return result;
+  }
+
+  Callback callback_;
+  isl::schedule_node *capture_;
+  std::tuple<Children...> children_;
+};
+
+template <> struct IsPattern<AnyTree> : std::true_type {};
+template <> struct IsPattern<AnyForest> : std::true_type {};
+template <isl_schedule_node_type Type, typename Callback, typename... Children>
+struct IsPattern<Node<Type, Callback, Children...>> : std::true_type {};
+
+template <typename... Ts>
+using EnableIfPatterns =
+    typename std::enable_if<(sizeof...(Ts) > 0) &&
+                            (IsPattern<Ts>::value && ...)>::type;
+
+// Callbacks are anything that is neither a pattern nor a node to capture to.
+template <typename T>
+using EnableIfCallback = typename std::enable_if<
+    !IsPattern<T>::value &&
+    !std::is_same<typename std::decay<T>::type,
+                  isl::schedule_node>::value>::type;
+
+/// Check if "pattern" matches the subtree rooted at "node".
+template <typename Pattern, typename = EnableIfPatterns<Pattern>>
+bool isMatching(const Pattern &pattern, isl::schedule_node node) {
+  return node.get() && pattern.match(node.get());
+}
+
+#define DEF_TYPED_MATCHER(name, type)                                          \
+  template <typename... Children, typename = EnableIfPatterns<Children...>>    \
+  Node<type, NoCallback, Children...> name(Children... children) {             \
+    return {NoCallback(), nullptr, std::move(children)...};                    \
+  }                                                                            \
+                                                                               \
+  template <typename... Children, typename = EnableIfPatterns<Children...>>    \
+  Node<type, NoCallback, Children...> name(isl::schedule_node &capture,        \
+                                           Children... children) {             \
+    return {NoCallback(), &capture, std::move(children)...};                   \
+  }                                                                            \
+                                                                               \
+  template <typename Callback, typename... Children,                           \
+            typename = EnableIfCallback<Callback>,                             \
+            typename = EnableIfPatterns<Children...>>                          \
+  Node<type, Callback, Children...> name(Callback callback,                    \
+                                         Children... children) {               \
+    return {std::move(callback), nullptr, std::move(children)...};             \
+  }                                                                            \
+                                                                               \
+  template <typename Callback, typename... Children,                           \
+            typename = EnableIfCallback<Callback>,                             \
+            typename = EnableIfPatterns<Children...>>                          \
+  Node<type, Callback, Children...> name(                                      \
+      Callback callback, isl::schedule_node &capture, Children... children) {  \
+    return {std::move(callback), &capture, std::move(children)...};            \
+  }
+
+DEF_TYPED_MATCHER(band, isl_schedule_node_band)
+DEF_TYPED_MATCHER(context, isl_schedule_node_context)
+DEF_TYPED_MATCHER(domain, isl_schedule_node_domain)
+DEF_TYPED_MATCHER(extension, isl_schedule_node_extension)
+DEF_TYPED_MATCHER(filter, isl_schedule_node_filter)
+DEF_TYPED_MATCHER(guard, isl_schedule_node_guard)
+DEF_TYPED_MATCHER(mark, isl_schedule_node_mark)
+DEF_TYPED_MATCHER(expansion, isl_schedule_node_expansion)
+DEF_TYPED_MATCHER(sequence, isl_schedule_node_sequence)
+DEF_TYPED_MATCHER(set, isl_schedule_node_set)
+
+#undef DEF_TYPED_MATCHER
+
+inline Node<isl_schedule_node_leaf, NoCallback> leaf() {
+  return {NoCallback(), nullptr};
+}
+
+inline Node<isl_schedule_node_leaf, NoCallback>
+leaf(isl::schedule_node &capture) {
+  return {NoCallback(), &capture};
+}
+
+inline AnyTree anyTree() { return AnyTree(nullptr); }
+inline AnyTree anyTree(isl::schedule_node &capture) {
+  return AnyTree(&capture);
+}
+
+inline AnyForest anyForest() { return AnyForest(nullptr); }
+inline AnyForest anyForest(std::vector<isl::schedule_node> &capture) {
+  return AnyForest(&capture);
+}
+
+template <typename... Callbacks> class AllOf {
+public:
+  explicit AllOf(Callbacks... callbacks)
+      : callbacks_(std::move(callbacks)...) {}
+
+  bool operator()(isl::schedule_node node) const {
+    return std::apply(
+        [&node](const Callbacks &... callback) {
+          return (callback(node) && ...);
+        },
+        callbacks_);
+  }
+
+private:
+  std::tuple<Callbacks...> callbacks_;
+};
+
+template <typename... Callbacks> class AnyOf {
+public:
+  explicit AnyOf(Callbacks... callbacks)
+      : callbacks_(std::move(callbacks)...) {}
+
+  bool operator()(isl::schedule_node node) const {
+    return std::apply(
+        [&node](const Callbacks &... callback) {
+          return (callback(node) || ...);
+        },
+        callbacks_);
+  }
+
+private:
+  std::tuple<Callbacks...> callbacks_;
+};
+
+/// Conjunction of callbacks, stopping at the first one returning false.
+template <typename... Callbacks>
+AllOf<Callbacks...> allOf(Callbacks... callbacks) {
+  return AllOf<Callbacks...>(std::move(callbacks)...);
+}
+
+/// Disjunction of callbacks, stopping at the first one returning true.
+template <typename... Callbacks>
+AnyOf<Callbacks...> anyOf(Callbacks... callbacks) {
+  return AnyOf<Callbacks...>(std::move(callbacks)...);
+}
+
+} // namespace typed
+/** \} */
+
+} // namespace matchers
+
+#endif // ISLUTILS_TYPED_MATCHERS_H
@@ -1,6 +1,7 @@
 #include "islutils/access.h"
 #include "islutils/access_patterns.h"
 #include "islutils/ctx.h"
+#include "islutils/match_cache.h"
 #include "islutils/pet_wrapper.h"
 
 #include "gtest/gtest.h"
@@ -365,6 +366,114 @@ TEST(AccessMatcher, Strides) {
   EXPECT_EQ(match(umap, allOf(access(dim(0, stride(ctx, 1))))).size(), 1);
 }
 
+TEST(AccessMatcher, ParametricStrides) {
+  auto ctx = ScopedCtx();
+  auto umap = isl::union_map(ctx, "[N] -> {[i]->A[a]: a=i;"
+                                  " [i]->B[a]: a=2*i;"
+                                  " [i]->C[a]: a=0}");
+  auto points = isl::set(ctx, "[N] -> {[i]: N > 0 and (i = 0 or i = N)}");
+  auto n = isl::aff(ctx, "[N] -> {[(N)]}");
+
+  auto sHolder = stride(n);
+  sHolder.pattern_.nonEmptySchedulePoints = points;
+  auto matches = match(umap, allOf(access(dim(0, sHolder))));
+  ASSERT_EQ(matches.size(), 1);
+  EXPECT_EQ(matches[0][sHolder].candidateSpaces()[0]
+                .range()
+                .get_tuple_name(isl::dim::set),
+            "A");
+
+  auto twiceHolder = stride(isl::aff(ctx, "[N] -> {[(2N)]}"));
+  twiceHolder.pattern_.nonEmptySchedulePoints = points;
+  EXPECT_EQ(match(umap, allOf(access(dim(0, twiceHolder)))).size(), 1);
+
+  // Constant strides only match the access that does not move.
+  auto zeroHolder = stride(ctx, 0);
+  zeroHolder.pattern_.nonEmptySchedulePoints = points;
+  EXPECT_EQ(match(umap, allOf(access(dim(0, zeroHolder)))).size(), 1);
+  auto oneHolder = stride(ctx, 1);
+  oneHolder.pattern_.nonEmptySchedulePoints = points;
+  EXPECT_EQ(match(umap, allOf(access(dim(0, oneHolder)))).size(), 0);
+
+  // Any stride matches all accesses and reports the stride.
+  auto anyHolder = anyStride(ctx);
+  anyHolder.pattern_.nonEmptySchedulePoints = points;
+  matches = match(umap, allOf(access(dim(0, anyHolder))));
+  ASSERT_EQ(matches.size(), 3);
+  for (const auto &m : matches) {
+    auto name = m[anyHolder].candidateSpaces()[0].range().get_tuple_name(
+        isl::dim::set);
+    auto matched = m[anyHolder].payload().stride;
+    ASSERT_FALSE(matched.is_null());
+    auto expected = name == "A"   ? n
+                    : name == "B" ? isl::aff(ctx, "[N] -> {[(2N)]}")
+                                  : isl::aff(ctx, "[N] -> {[(0)]}");
+    EXPECT_TRUE(isl::pw_aff(matched).is_equal(isl::pw_aff(expected)));
+  }
+
+  // Deltas that are not a single affine function of the parameters have no
+  // stride.
+  points = isl::set(ctx, "[N] -> {[i]: N > 0 and (i = 0 or i = N or "
+                         "i = 3N)}");
+  anyHolder.pattern_.nonEmptySchedulePoints = points;
+  EXPECT_EQ(match(umap, allOf(access(dim(0, anyHolder)))).size(), 1);
+}
+
+TEST(AccessMatcher, MultiInputDim) {
+  auto ctx = ScopedCtx();
+  // Skewed and tiled subscripts.
+  auto umap = isl::union_map(ctx, "{[t,i]->A[a,b]: a=t+i and b=t;"
+                                  " [t,i]->B[a,b]: a=32*t+i+1 and b=t;"
+                                  " [t,i]->C[a,b]: a=2*t+2*i+2 and b=5}");
+  auto _1 = affine(ctx);
+  auto _2 = affine(ctx);
+  auto matches = match(umap, allOf(access(_1, _2)));
+  // "C[.., 5]" involves no input dimension.
+  ASSERT_EQ(matches.size(), 2);
+  for (const auto &m : matches) {
+    EXPECT_EQ(m[_2].payload().coefficients_, (std::vector<long>{1, 0}));
+    EXPECT_EQ(m[_2].payload().constant_, 0);
+  }
+
+  auto matchesOne = [&](const MultiInputDim &payload,
+                        std::vector<long> coefficients, long constant) {
+    return payload.coefficients_ == coefficients &&
+           payload.constant_ == constant;
+  };
+  auto single = match(umap, allOf(access(dim(0, _1))));
+  ASSERT_EQ(single.size(), 3);
+  int nFound = 0;
+  for (const auto &m : single) {
+    const auto &payload = m[_1].payload();
+    nFound += matchesOne(payload, {1, 1}, 0) + matchesOne(payload, {32, 1}, 1) +
+              matchesOne(payload, {2, 2}, 2);
+  }
+  EXPECT_EQ(nFound, 3);
+
+  // Coefficient and constant of the pattern are factored out of X, so the
+  // subscripts of A and C share X = t+i.
+  auto folded =
+      match(umap, allOf(access(dim(0, _1)), access(dim(0, 2 * _1 + 2))));
+  ASSERT_EQ(folded.size(), 1);
+  EXPECT_EQ(folded[0][_1].payload().coefficients_, (std::vector<long>{1, 1}));
+  EXPECT_EQ(match(umap, allOf(access(dim(0, 3 * _1)))).size(), 0);
+
+  // Index and relations give the same results.
+  AccessIndex index;
+  index.add(umap, AccessIndex::Read);
+  EXPECT_EQ(match(index, allOf(access(_1, _2))).size(), 2);
+  EXPECT_EQ(match(index, allOf(access(dim(0, _1)),
+                               access(dim(0, 2 * _1 + 2)))).size(),
+            1);
+
+  // Shift the skewed subscript.
+  auto result = findAndReplace(
+      isl::union_map(ctx, "{[t,i]->A[a,b]: a=t+i and b=t}"),
+      replace(access(_1, _2), access(_1 + 1, _2)));
+  EXPECT_TRUE(result.is_equal(
+      isl::union_map(ctx, "{[t,i]->A[a,b]: a=t+i+1 and b=t}")));
+}
+
 TEST(AccessMatcher, NegativeIndexMatch) {
   auto ctx = ScopedCtx();
   auto umap = isl::union_map(ctx, "{[i,j]->A[a]: a=j;"
@@ -483,6 +592,87 @@ TEST(AccessMatcher, MultiDimensionalReplace) {
   EXPECT_TRUE(umap.is_equal(expected));
 }
 
+TEST(AccessMatcher, ReplaceReport) {
+  auto ctx = ScopedCtx();
+  std::string relations = "{";
+  for (int i = 0; i < 100; ++i) {
+    auto n = std::to_string(i);
+    relations += "[i,j]->A" + n + "[a,b]: a=i and b=j;";
+    relations += "[i,j]->B" + n + "[a]: a=i+j;";
+  }
+  relations.back() = '}';
+  auto umap = isl::union_map(ctx, relations);
+
+  auto _1 = placeholder(ctx);
+  auto _2 = placeholder(ctx);
+  auto report =
+      findAndReplaceReport(umap, replace(access(_1, _2), access(_2, _1)));
+  ASSERT_EQ(report.nTransformed.size(), 1);
+  EXPECT_EQ(report.nTransformed[0], 100);
+  EXPECT_TRUE(report.fired(0));
+
+  std::string expected = "{";
+  for (int i = 0; i < 100; ++i) {
+    auto n = std::to_string(i);
+    expected += "[i,j]->A" + n + "[a,b]: a=j and b=i;";
+    expected += "[i,j]->B" + n + "[a]: a=i+j;";
+  }
+  expected.back() = '}';
+  EXPECT_TRUE(report.result.is_equal(isl::union_map(ctx, expected)));
+  EXPECT_TRUE(findAndReplace(umap, replace(access(_1, _2), access(_2, _1)))
+                  .is_equal(report.result));
+
+  auto _3 = placeholder(ctx);
+  report = findAndReplaceReport(umap, replace(access(_1, _2, _3),
+                                              access(_3, _2, _1)));
+  EXPECT_FALSE(report.fired(0));
+  EXPECT_TRUE(report.result.is_equal(umap));
+}
+
+TEST(AccessMatcher, MatchCache) {
+  auto ctx = ScopedCtx();
+  auto umap = isl::union_map(ctx, "{[i,j]->A[a,b]: a=i and b=j;"
+                                  " [i,j]->B[a,b]: a=j and b=i;"
+                                  " [i,j]->C[a,b]: a=i and b=2*j}");
+  MatchCache<SingleInputDim, FixedOutDimPattern<SimpleAff>> cache;
+
+  // Each call uses new placeholders, like a tactic callback would.
+  auto transposed = [&ctx, &cache](isl::union_map accesses, int coefficient) {
+    auto _1 = placeholder(ctx);
+    auto _2 = placeholder(ctx);
+    auto ps = allOf(access(_1, coefficient * _2));
+    auto matches = cache.match(accesses, ps);
+    auto expected = match(accesses, ps);
+    EXPECT_EQ(matches.size(), expected.size());
+    for (size_t i = 0; i < matches.size() && i < expected.size(); ++i) {
+      EXPECT_EQ(matches[i][_1].payload().inputDimPos_,
+                expected[i][_1].payload().inputDimPos_);
+      EXPECT_EQ(matches[i][_2].payload().inputDimPos_,
+                expected[i][_2].payload().inputDimPos_);
+      EXPECT_EQ(matches[i][_1].candidateSpaces(),
+                expected[i][_1].candidateSpaces());
+    }
+    return matches.size();
+  };
+
+  EXPECT_EQ(transposed(umap, 1), 2);
+  EXPECT_EQ(cache.misses(), 1);
+  EXPECT_EQ(transposed(umap, 1), 2);
+  EXPECT_EQ(cache.hits(), 1);
+
+  // Different patterns or accesses are not served from the cache.
+  EXPECT_EQ(transposed(umap, 2), 1);
+  auto subset = isl::union_map(ctx, "{[i,j]->A[a,b]: a=i and b=j}");
+  EXPECT_EQ(transposed(subset, 1), 1);
+  EXPECT_EQ(cache.misses(), 3);
+  EXPECT_EQ(cache.size(), 3);
+
+  cache.clear();
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(transposed(umap, 1), 2);
+  EXPECT_EQ(cache.misses(), 1);
+}
+
 // Access strides may be caused by strides in the iteration domain.
 // Check that, for strided domains, we can detect strides properly, given the
 // information on the sparseness of the domain.
@@ -637,3 +827,369 @@ TEST(AccessMatcher, GroupFoldsAPI) {
   EXPECT_EQ(match(umapDiff, psDiff).size(), 2);
 }
 
+TEST(AccessMatcher, SuitableCombination) {
+  auto ctx = ScopedCtx();
+  auto spaceOf = [&ctx](const char *str) {
+    return isl::map(ctx, str).get_space();
+  };
+  auto refA1 = spaceOf("{[i,j]->[ref1[]->A[a,b]]}");
+  auto refA2 = spaceOf("{[i,j]->[ref2[]->A[a,b]]}");
+  auto refB = spaceOf("{[i,j]->[ref2[]->B[a,b]]}");
+  using Combination = std::vector<DimCandidate<SingleInputDim>>;
+  auto candidate = [](int pos, isl::space space) {
+    return DimCandidate<SingleInputDim>(SingleInputDim{pos}, space);
+  };
+
+  // Folds {0, 2} and {1, 3}, groups {0, 1} and {2, 3} on different arrays.
+  auto ps = makeTwoGroupsPlaceholderGroupedSet(ctx, false);
+  Combination prefix = {candidate(0, refA1)};
+  EXPECT_TRUE(ps.isSuitableCombination(prefix));
+  // Same candidate as another fold.
+  EXPECT_FALSE(ps.isSuitableCombination(
+      Combination{candidate(0, refA1), candidate(0, refA1)}));
+  // Different map within the group.
+  EXPECT_FALSE(ps.isSuitableCombination(
+      Combination{candidate(0, refA1), candidate(1, refB)}));
+  prefix.push_back(candidate(1, refA1));
+  EXPECT_TRUE(ps.isSuitableCombination(prefix));
+
+  auto extended = [&prefix](DimCandidate<SingleInputDim> candidate) {
+    auto combination = prefix;
+    combination.push_back(candidate);
+    return combination;
+  };
+  // Different candidate within the fold.
+  EXPECT_FALSE(ps.isSuitableCombination(extended(candidate(1, refB))));
+  // Map of another group.
+  EXPECT_FALSE(ps.isSuitableCombination(extended(candidate(0, refA1))));
+  // Array of another group fold.
+  EXPECT_FALSE(ps.isSuitableCombination(extended(candidate(0, refA2))));
+  EXPECT_TRUE(ps.isSuitableCombination(extended(candidate(0, refB))));
+  prefix.push_back(candidate(0, refB));
+  EXPECT_TRUE(ps.isSuitableCombination(extended(candidate(1, refB))));
+}
+
+TEST(AccessMatcher, CombinationValidator) {
+  auto ctx = ScopedCtx();
+  auto spaceOf = [&ctx](const char *str) {
+    return isl::map(ctx, str).get_space();
+  };
+  auto refA1 = spaceOf("{[i,j]->[ref1[]->A[a,b]]}");
+  auto refA2 = spaceOf("{[i,j]->[ref2[]->A[a,b]]}");
+  auto refB = spaceOf("{[i,j]->[ref2[]->B[a,b]]}");
+  auto candidate = [](int pos, isl::space space) {
+    return DimCandidate<SingleInputDim>(SingleInputDim{pos}, space);
+  };
+  auto i0A1 = candidate(0, refA1);
+  auto i0A2 = candidate(0, refA2);
+  auto i0B = candidate(0, refB);
+  auto i1A1 = candidate(1, refA1);
+  auto i1B = candidate(1, refB);
+
+  // Folds {0, 2} and {1, 3}, groups {0, 1} and {2, 3} on different arrays.
+  // Placeholders are assigned out of order, as in the search.
+  auto ps = makeTwoGroupsPlaceholderGroupedSet(ctx, false);
+  CombinationValidator<decltype(ps)> validator(ps);
+  auto A1 = validator.spaceId(refA1);
+  auto A2 = validator.spaceId(refA2);
+  auto B = validator.spaceId(refB);
+  EXPECT_EQ(validator.spaceId(refA1), A1);
+
+  ASSERT_TRUE(validator.accepts(2, i0B, B));
+  validator.push(2, i0B, B);
+  // Map of another group.
+  EXPECT_FALSE(validator.accepts(0, i0B, B));
+  // Different candidate within the fold.
+  EXPECT_FALSE(validator.accepts(0, i1A1, A1));
+  ASSERT_TRUE(validator.accepts(0, i0A1, A1));
+  validator.push(0, i0A1, A1);
+  // Same candidate as another fold.
+  EXPECT_FALSE(validator.accepts(3, i0B, B));
+  // Different map within the group.
+  EXPECT_FALSE(validator.accepts(3, i1A1, A1));
+  ASSERT_TRUE(validator.accepts(3, i1B, B));
+  validator.push(3, i1B, B);
+  EXPECT_EQ(validator.size(), 3);
+
+  // Popping restores the state before the candidates were pushed.
+  validator.pop();
+  validator.pop();
+  EXPECT_EQ(validator.size(), 1);
+  EXPECT_TRUE(validator.accepts(0, i0A2, A2));
+  EXPECT_TRUE(validator.accepts(3, i1B, B));
+  EXPECT_FALSE(validator.accepts(1, i0A1, A1));
+}
+
+// Enumerate the combinations of candidates in the order of placeholders and
+// keep those accepted by isSuitableCombination.
+template <typename PlaceholderCollectionTy>
+static void enumerateCombinations(
+    const PlaceholderCollectionTy &ps,
+    std::vector<DimCandidate<typename PlaceholderCollectionTy::CandidateTy>>
+        &combination,
+    Matches<typename PlaceholderCollectionTy::CandidateTy,
+            typename PlaceholderCollectionTy::PatternTy> &result) {
+  if (!ps.isSuitableCombination(combination)) {
+    return;
+  }
+  if (combination.size() == ps.placeholders_.size()) {
+    result.emplace_back(ps, combination);
+    return;
+  }
+  for (const auto &candidate :
+       ps.placeholders_[combination.size()].candidates_) {
+    combination.push_back(candidate);
+    enumerateCombinations(ps, combination, result);
+    combination.pop_back();
+  }
+}
+
+template <typename PlaceholderCollectionTy>
+static void expectSameAsEnumeration(isl::union_map umap,
+                                    PlaceholderCollectionTy ps) {
+  auto matches = match(umap, ps);
+  for (auto &ph : ps) {
+    umap.foreach_map([&ph](isl::map map) {
+      for (auto &&c : PlaceholderCollectionTy::CandidateTy::candidates(
+               map, ph.pattern_)) {
+        ph.candidates_.emplace_back(c, map.get_space());
+      }
+      return isl_stat_ok;
+    });
+  }
+  Matches<typename PlaceholderCollectionTy::CandidateTy,
+          typename PlaceholderCollectionTy::PatternTy>
+      expected;
+  std::vector<DimCandidate<typename PlaceholderCollectionTy::CandidateTy>>
+      combination;
+  enumerateCombinations(ps, combination, expected);
+
+  ASSERT_EQ(matches.size(), expected.size());
+  for (size_t i = 0; i < matches.size(); ++i) {
+    for (const auto &ph : ps) {
+      EXPECT_TRUE(matches[i][ph].payload() == expected[i][ph].payload());
+      EXPECT_EQ(matches[i][ph].candidateSpaces(),
+                expected[i][ph].candidateSpaces());
+    }
+  }
+}
+
+TEST(AccessMatcher, CombinationSearchMatchesEnumeration) {
+  auto ctx = ScopedCtx();
+  auto umap = isl::union_map(ctx, "{[i,j,k]->A[a,b]: a=i and b=k;"
+                                  " [i,j,k]->B[a,b]: a=k and b=j;"
+                                  " [i,j,k]->C[a,b]: a=i and b=j;"
+                                  " [i,j,k]->D[a,b]: a=i and b=k;"
+                                  " [i,j,k]->E[a,b]: a=j and b=i}");
+  auto _i = placeholder(ctx);
+  auto _j = placeholder(ctx);
+  auto _k = placeholder(ctx);
+  expectSameAsEnumeration(umap, allOf(access(_i, _j), access(_i, _k),
+                                      access(_k, _j)));
+  expectSameAsEnumeration(umap, allOf(access(_i, _k), access(_i, _k)));
+  expectSameAsEnumeration(umap, allOf(access(dim(0, _j)), access(_i, _k)));
+
+  auto umapGrouped =
+      isl::union_map(ctx, "{[i,j]->[ref1[]->A[a,b]]: a=i and b=j;"
+                          " [i,j]->[ref2[]->A[a,b]]: a=j and b=i;"
+                          " [i,j]->[ref3[]->B[a,b]]: a=i and b=j}");
+  auto Arr = arrayPlaceholder();
+  auto Other = arrayPlaceholder();
+  expectSameAsEnumeration(umapGrouped, allOf(access(Arr, _i, _j),
+                                             access(Other, _i, _j)));
+  expectSameAsEnumeration(umapGrouped, allOf(access(Arr, _i, _j),
+                                             access(Arr, _j, _i)));
+}
+
+TEST(AccessMatcher, CombinationSearchThreeMatmul) {
+  auto ctx = ScopedCtx();
+  // Accesses of three matrix multiplications in the same schedule space.
+  auto umap = isl::union_map(ctx, "{[i,j,k]->A[a,b]: a=i and b=k;"
+                                  " [i,j,k]->B[a,b]: a=k and b=j;"
+                                  " [i,j,k]->E[a,b]: a=i and b=j;"
+                                  " [i,j,k]->C[a,b]: a=i and b=k;"
+                                  " [i,j,k]->D[a,b]: a=k and b=j;"
+                                  " [i,j,k]->F[a,b]: a=i and b=j;"
+                                  " [i,j,k]->G[a,b]: a=i and b=k;"
+                                  " [i,j,k]->H[a,b]: a=k and b=j;"
+                                  " [i,j,k]->I[a,b]: a=i and b=j}");
+  auto _i = placeholder(ctx);
+  auto _j = placeholder(ctx);
+  auto _k = placeholder(ctx);
+  auto ps = allOf(access(_i, _j), access(_i, _k), access(_k, _j),
+                  access(_i, _j), access(_i, _k), access(_k, _j),
+                  access(_i, _j), access(_i, _k), access(_k, _j));
+  // Each of the three groups of maps can be permuted.
+  auto matches = match(umap, ps);
+  ASSERT_EQ(matches.size(), 6 * 6 * 6);
+  for (const auto &m : matches) {
+    EXPECT_EQ(m[_i].payload().inputDimPos_, 0);
+    EXPECT_EQ(m[_j].payload().inputDimPos_, 1);
+    EXPECT_EQ(m[_k].payload().inputDimPos_, 2);
+    EXPECT_EQ(m[_i].candidateSpaces().size(), 6);
+  }
+}
+
+TEST(AccessMatcher, DecomposedAccess) {
+  auto ctx = ScopedCtx();
+  auto decomposed = DecomposedAccess(isl::map(
+      ctx, "{[i,j]->A[a,b]: a=j and (b=i or b=j) and 0<=i<10 and 0<=j<10}"));
+  ASSERT_EQ(decomposed.nOutDims(), 2);
+  EXPECT_TRUE(decomposed.outDim(0).is_equal(
+      isl::map(ctx, "{[i,j]->[a]: a=j and 0<=i<10 and 0<=j<10}")));
+  EXPECT_FALSE(decomposed.outDimAff(0).is_null());
+  // The second dimension is not single-valued.
+  EXPECT_TRUE(decomposed.outDimAff(1).is_null());
+
+  auto pattern = SimpleAff(ctx);
+  auto candidates = SingleInputDim::candidates(decomposed, 0, pattern);
+  ASSERT_EQ(candidates.size(), 1);
+  EXPECT_EQ(candidates[0].inputDimPos_, 1);
+  EXPECT_TRUE(SingleInputDim::candidates(decomposed, 1, pattern).empty());
+
+  // match() finds the same candidate through the decomposition.
+  auto _1 = placeholder(ctx);
+  auto ps = allOf(access(dim(-2, _1)));
+  EXPECT_EQ(match(isl::union_map(decomposed.map()), ps).size(), 1);
+}
+
+TEST(AccessMatcher, AccessIndex) {
+  auto ctx = ScopedCtx(pet::allocCtx());
+  auto petScop = pet::Scop::parseFile(ctx, "inputs/1mmWithoutInitStmt.c");
+  auto scop = petScop.getScop();
+
+  auto index = AccessIndex(scop, AccessIndex::Read);
+  // alpha, A, B and tmp are read once.
+  ASSERT_EQ(index.size(), 4);
+  for (size_t i = 0; i < index.size(); ++i) {
+    EXPECT_EQ(index.kind(i), AccessIndex::Read);
+    EXPECT_FALSE(index.statement(i).is_null());
+    EXPECT_FALSE(index.ref(i).is_null());
+    EXPECT_EQ(index.nInputs(i), 3);
+    if (index.array(i).get_name() != "A") {
+      continue;
+    }
+    // A[i][k] with loops (j, i, k).
+    ASSERT_EQ(index.nSubscripts(i), 2);
+    ASSERT_TRUE(index.isAffine(i, 0));
+    EXPECT_EQ(index.coefficient(i, 0, 0), 0);
+    EXPECT_EQ(index.coefficient(i, 0, 1), 1);
+    EXPECT_EQ(index.coefficient(i, 0, 2), 0);
+    EXPECT_EQ(index.constant(i, 0), 0);
+  }
+  EXPECT_TRUE(index.relations().is_equal(scop.reads.curry()));
+
+  auto _i = placeholder(ctx);
+  auto _j = placeholder(ctx);
+  auto _k = placeholder(ctx);
+  auto ps = allOf(access(_i, _j), access(_i, _k), access(_k, _j));
+  auto matches = match(index, ps);
+  auto expected = match(scop.reads.curry(), ps);
+  ASSERT_EQ(matches.size(), expected.size());
+  ASSERT_EQ(matches.size(), 1);
+  EXPECT_EQ(matches[0][_i].payload().inputDimPos_, 1);
+  EXPECT_EQ(matches[0][_j].payload().inputDimPos_, 0);
+  EXPECT_EQ(matches[0][_k].payload().inputDimPos_, 2);
+
+  // Payloads without an index-specific overload work on the relations.
+  auto writes = AccessIndex(petScop, AccessIndex::MustWrite);
+  ASSERT_EQ(writes.size(), 1);
+  // tmp[i][j] is invariant in the innermost loop k.
+  EXPECT_EQ(match(writes, allOf(access(dim(-1, stride(ctx, 0))))).size(), 1);
+  EXPECT_EQ(match(writes, allOf(access(_i, _j))).size(), 1);
+
+  // On the diagonal, both subscripts are equal to both i and j.
+  auto diagonal = isl::union_map(
+      ctx, "{S[i,j]->A[a,b]: a=i and b=j and i=j and 0<=i<10}");
+  AccessIndex diagonalIndex;
+  diagonalIndex.add(diagonal, AccessIndex::Read);
+  EXPECT_TRUE(diagonalIndex.hasInputEqualities(0));
+  EXPECT_FALSE(index.hasInputEqualities(0));
+  auto ij = allOf(access(_i, _j));
+  EXPECT_EQ(match(diagonal, ij).size(), 2);
+  EXPECT_EQ(match(diagonalIndex, ij).size(), 2);
+}
+
+TEST(AccessMatcher, MatchVariants) {
+  auto ctx = ScopedCtx();
+  auto umap = isl::union_map(ctx, "{[i,j]->A[a,b]: a=i and b=j;"
+                                  " [i,j]->B[a,b]: a=j and b=i;"
+                                  " [i,j]->C[a,b]: a=i and b=j}");
+  auto _1 = placeholder(ctx);
+  auto _2 = placeholder(ctx);
+  auto ps = allOf(access(_1, _2), access(_1, _2));
+  auto matches = match(umap, ps);
+  ASSERT_EQ(matches.size(), 2);
+
+  EXPECT_EQ(matchCount(umap, ps), 2);
+  EXPECT_EQ(matchCount(umap, ps, 1), 1);
+  EXPECT_EQ(matchCount(umap, ps, 0), 0);
+  EXPECT_TRUE(matchAny(umap, ps));
+  EXPECT_FALSE(matchAny(umap, allOf(access(_1, _1))));
+
+  // Visit matches in the order of match() and stop on request.
+  size_t nVisited = 0;
+  forEachMatch(umap, ps, [&](const Match<SingleInputDim,
+                                         FixedOutDimPattern<SimpleAff>> &m) {
+    EXPECT_EQ(m[_1].candidateSpaces(), matches[nVisited][_1].candidateSpaces());
+    EXPECT_EQ(m[_2].payload().inputDimPos_,
+              matches[nVisited][_2].payload().inputDimPos_);
+    ++nVisited;
+    return true;
+  });
+  EXPECT_EQ(nVisited, 2);
+  nVisited = 0;
+  forEachMatch(umap, ps, [&nVisited](const auto &) {
+    ++nVisited;
+    return false;
+  });
+  EXPECT_EQ(nVisited, 1);
+
+  auto first = matchFirst(umap, ps);
+  ASSERT_TRUE(first.has_value());
+  EXPECT_EQ((*first)[_1].candidateSpaces(), matches[0][_1].candidateSpaces());
+  EXPECT_FALSE(matchFirst(umap, allOf(access(_1, _1))).has_value());
+}
+
+TEST(AccessMatcher, StrideProfile) {
+  auto ctx = ScopedCtx();
+  auto accesses = isl::union_map(
+      ctx, "{S[i,j]->A[a,b]: a=i and b=j and 0<=i,j<10;"
+           " S[i,j]->B[a]: a=2j and 0<=i,j<10;"
+           " S[i,j]->C[a]: a=0 and 0<=i,j<10}");
+  auto schedule = isl::multi_union_pw_aff(
+      ctx, "[{S[i,j]->[(i)]}, {S[i,j]->[(j)]}]");
+  auto profile = StrideProfile(schedule, accesses);
+  ASSERT_EQ(profile.nDims(), 2);
+  ASSERT_EQ(profile.nAccesses(), 3);
+
+  for (size_t i = 0; i < profile.nAccesses(); ++i) {
+    auto name = profile.space(i).get_tuple_name(isl::dim::set);
+    EXPECT_TRUE(profile.isAccessed(i, 0));
+    EXPECT_TRUE(profile.isAccessed(i, 1));
+    if (name == "C") {
+      EXPECT_EQ(profile.stride(i, 0).get_num_si(), 0);
+    } else {
+      // Scheduled by i alone, the last subscript of A and B takes all the
+      // values of j, so it has no stride.
+      EXPECT_TRUE(profile.stride(i, 0).is_null());
+    }
+    ASSERT_FALSE(profile.stride(i, 1).is_null());
+    EXPECT_EQ(profile.stride(i, 1).get_num_si(),
+              name == "A" ? 1 : name == "B" ? 2 : 0);
+  }
+  EXPECT_EQ(profile.nAccessed(0), 3);
+  EXPECT_EQ(profile.count(0, 0), 1);
+  EXPECT_EQ(profile.count(1, 0), 1);
+  EXPECT_EQ(profile.count(1, 1), 1);
+  EXPECT_EQ(profile.count(1, 2), 1);
+  EXPECT_EQ(profile.count(1, 3), 0);
+
+  // The profile agrees with stride matchers on the scheduled accesses.
+  auto scheduled = accesses.apply_domain(
+      isl::union_map::from_union_pw_aff(schedule.get_union_pw_aff(1)));
+  for (int s = 0; s <= 3; ++s) {
+    EXPECT_EQ(matchCount(scheduled, allOf(access(dim(-1, stride(ctx, s))))),
+              profile.count(1, s));
+  }
+}
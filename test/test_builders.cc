@@ -133,3 +133,244 @@ TEST(Builders, ExpansionUnderFilter) {
 
   ctx.release();
 }
+
+// Builders are move-only and keep all their nodes in one arena, so that wide
+// trees can be assembled from vectors of subtrees without copying them.
+TEST(Builders, MoveOnlyArena) {
+  using namespace builders;
+  static_assert(!std::is_copy_constructible<ScheduleNodeBuilder>::value,
+                "builders should not be copied");
+  static_assert(std::is_nothrow_move_constructible<ScheduleNodeBuilder>::value,
+                "builders should be cheap to move");
+
+  auto ctx = isl::ctx(isl_ctx_alloc());
+  auto iterationDomain = isl::union_set(ctx, "{S[i]: 0 <= i < 100}");
+  auto schedule = isl::multi_union_pw_aff(ctx, "[{S[i]->[(i)]}]");
+
+  const int nFilters = 10;
+  std::vector<ScheduleNodeBuilder> filters;
+  for (int i = 0; i < nFilters; ++i) {
+    auto filterSet = isl::union_set(
+        ctx, "{S[i]: " + std::to_string(10 * i) + " <= i < " +
+                 std::to_string(10 * (i + 1)) + "}");
+    filters.push_back(filter(filterSet, band(schedule)));
+  }
+
+  auto builder = domain(iterationDomain,
+                        context(isl::set(ctx, "{:}"),
+                                sequence(std::move(filters))));
+  // Domain, context, sequence and a filter, a band and a leaf per filter.
+  EXPECT_EQ(builder.size(), 3u + 3u * nFilters);
+  EXPECT_EQ(builder.type(), isl_schedule_node_domain);
+
+  auto moved = std::move(builder);
+  auto node = moved.build();
+  EXPECT_EQ(isl_schedule_node_get_type(node.child(0).get()),
+            isl_schedule_node_context);
+  auto sequenceNode = node.child(0).child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(sequenceNode.get()),
+            isl_schedule_node_sequence);
+  EXPECT_EQ(sequenceNode.n_children(), nFilters);
+  EXPECT_EQ(isl_schedule_node_get_type(sequenceNode.child(3).child(0).get()),
+            isl_schedule_node_band);
+
+  ctx.release();
+}
+
+// Domain-rooted trees are built from their description in one go; check that
+// band properties and mark identifiers survive the round trip.
+TEST(Builders, BulkBuildKeepsProperties) {
+  using namespace builders;
+  auto ctx = isl::ctx(isl_ctx_alloc());
+  auto iterationDomain = isl::union_set(ctx, "{S[i,j]: 0 <= i,j < 42}");
+  BandDescriptor descriptor(
+      isl::multi_union_pw_aff(ctx, "[{S[i,j]->[(i)]}, {S[i,j]->[(j)]}]"));
+  descriptor.permutable = true;
+  descriptor.coincident = {true, false};
+  int payload = 0;
+  auto markId = isl::id::alloc(ctx, "kernel", &payload);
+
+  // clang-format off
+  auto node =
+      domain(iterationDomain,
+        mark(markId,
+          band(descriptor,
+            sequence(
+              filter(isl::union_set(ctx, "{S[i,j]: i < 10}")),
+              filter(isl::union_set(ctx, "{S[i,j]: i >= 10}")))))).build();
+  // clang-format on
+
+  auto markNode = node.child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(markNode.get()),
+            isl_schedule_node_mark);
+  EXPECT_EQ(markNode.mark_get_id().get(), markId.get());
+  EXPECT_EQ(markNode.mark_get_id().get_user(), &payload);
+
+  auto bandNode = markNode.child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(bandNode.get()),
+            isl_schedule_node_band);
+  EXPECT_TRUE(bandNode.band_get_permutable());
+  EXPECT_TRUE(bandNode.band_member_get_coincident(0));
+  EXPECT_FALSE(bandNode.band_member_get_coincident(1));
+  EXPECT_EQ(bandNode.child(0).n_children(), 2);
+
+  ctx.release();
+}
+
+// Tuple identifiers with user pointers cannot be described textually; trees
+// using them must still be built with the original identifiers.
+TEST(Builders, BuildKeepsUserPointerTupleIds) {
+  using namespace builders;
+  auto ctx = isl::ctx(isl_ctx_alloc());
+  int payload = 0;
+  auto statementId = isl::id::alloc(ctx, "S", &payload);
+  auto statement =
+      isl::set(ctx, "{ [i] : 0 <= i < 42 }").set_tuple_id(statementId);
+
+  // clang-format off
+  auto node =
+      domain(isl::union_set(statement),
+        filter(isl::union_set(statement))).build();
+  // clang-format on
+
+  auto hasStatementId = [&statementId](isl::set set) {
+    EXPECT_EQ(set.get_tuple_id().get(), statementId.get());
+    return isl_stat_ok;
+  };
+  node.domain_get_domain().foreach_set(hasStatementId);
+  node.child(0).filter_get_filter().foreach_set(hasStatementId);
+
+  ctx.release();
+}
+
+// Insert an expansion below the second filter of an existing tree and check
+// that insertion continues at the new expansion node.
+TEST(Builders, ExpansionInsertedInExistingTree) {
+  using namespace builders;
+  auto ctx = isl::ctx(isl_ctx_alloc());
+  auto iterationDomain =
+      isl::union_set(ctx, "{other[]; group[i]: 0 <= i <= 42}");
+  auto filterOther = isl::union_set(ctx, "{other[]:}");
+  auto filterGroup = isl::union_set(ctx, "{group[i]:}");
+  auto expansionMap =
+      isl::union_map(ctx, "{group[i] -> S1[a,b]: i = a and 0 <= b <= 100;"
+                          " group[i] -> S2[a,b]: i = a and 0 <= b <= 200}");
+  auto schedule =
+      isl::multi_union_pw_aff(ctx, "[{S1[a,b]->[(b)]; S2[a,b]->[(b + 1)]}]");
+
+  // clang-format off
+  auto root = domain(iterationDomain,
+                sequence(
+                  filter(filterOther),
+                  filter(filterGroup))).build();
+  // clang-format on
+
+  auto leaf = root.child(0).child(1).child(0);
+  auto node = expansion(expansionMap, band(schedule)).insertAt(leaf);
+  ASSERT_EQ(isl_schedule_node_get_type(node.get()),
+            isl_schedule_node_expansion);
+  EXPECT_EQ(node.get_tree_depth(), 3);
+  EXPECT_EQ(node.parent().get_child_position(), 1);
+  EXPECT_EQ(node.child(0).get_domain().n_set(), 2);
+
+  ctx.release();
+}
+
+// Replace a mark and a band by a single band while keeping the sequence below
+// them in place.
+TEST(Builders, ReplaceKeepsSplicedSubtree) {
+  using namespace builders;
+  auto ctx = isl::ctx(isl_ctx_alloc());
+  auto iterationDomain =
+      isl::union_set(ctx, "{S1[i]: 0 <= i < 10; S2[i]: 0 <= i < 10}");
+  auto schedule =
+      isl::multi_union_pw_aff(ctx, "[{S1[i]->[(i)]; S2[i]->[(i)]}]");
+  auto reversed =
+      isl::multi_union_pw_aff(ctx, "[{S1[i]->[(-i)]; S2[i]->[(-i)]}]");
+  BandDescriptor inner(
+      isl::multi_union_pw_aff(ctx, "[{S1[i]->[(2*i)]; S2[i]->[(2*i)]}]"));
+  inner.permutable = true;
+  inner.coincident = {true};
+
+  // clang-format off
+  auto root =
+      domain(iterationDomain,
+        mark(isl::id::alloc(ctx, "old", nullptr),
+          band(schedule,
+            band(inner,
+              sequence(
+                filter(isl::union_set(ctx, "{S1[i]}")),
+                filter(isl::union_set(ctx, "{S2[i]}"))))))).build();
+  // clang-format on
+
+  auto kept = root.child(0).child(0).child(0);
+  auto node = band(reversed, splice(kept)).replace(root.child(0));
+  ASSERT_EQ(isl_schedule_node_get_type(node.get()), isl_schedule_node_band);
+  EXPECT_EQ(node.get_tree_depth(), 1);
+  EXPECT_TRUE(node.band_get_partial_schedule_union_map().is_equal(
+      isl::union_map::from(reversed)));
+
+  // The spliced subtree is the original one, with its band flags.
+  auto innerNode = node.child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(innerNode.get()),
+            isl_schedule_node_band);
+  EXPECT_TRUE(innerNode.band_get_partial_schedule_union_map().is_equal(
+      kept.band_get_partial_schedule_union_map()));
+  EXPECT_TRUE(innerNode.band_get_permutable());
+  EXPECT_TRUE(innerNode.band_member_get_coincident(0));
+  auto sequenceNode = innerNode.child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(sequenceNode.get()),
+            isl_schedule_node_sequence);
+  EXPECT_EQ(sequenceNode.n_children(), 2);
+
+  // Splicing a subtree that is not below the replaced node rebuilds it,
+  // band properties included.
+  auto leaf = sequenceNode.child(1).child(0);
+  auto copy = band(reversed, splice(kept)).replace(leaf);
+  auto copiedInner = copy.child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(copiedInner.get()),
+            isl_schedule_node_band);
+  EXPECT_TRUE(copiedInner.band_get_permutable());
+  EXPECT_TRUE(copiedInner.band_member_get_coincident(0));
+  EXPECT_EQ(isl_schedule_node_get_type(copiedInner.child(0).get()),
+            isl_schedule_node_sequence);
+
+  ctx.release();
+}
+
+// isl cannot delete or insert bands above an extension node, which depends on
+// the prefix schedule; the subtree is then rebuilt below the new band.
+TEST(Builders, ReplaceAboveAnchoredSubtree) {
+  using namespace builders;
+  auto ctx = isl::ctx(isl_ctx_alloc());
+  auto iterationDomain = isl::union_set(ctx, "{S[i]: 0 <= i < 10}");
+  auto schedule = isl::multi_union_pw_aff(ctx, "[{S[i]->[(i)]}]");
+  auto reversed = isl::multi_union_pw_aff(ctx, "[{S[i]->[(-i)]}]");
+
+  // clang-format off
+  auto root =
+      domain(iterationDomain,
+        band(schedule,
+          extension(isl::union_map(ctx, "{[i]->T[i]: 0 <= i < 10}"),
+            sequence(
+              filter(isl::union_set(ctx, "{S[i]}")),
+              filter(isl::union_set(ctx, "{T[i]}")))))).build();
+  // clang-format on
+
+  auto kept = root.child(0).child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(kept.get()),
+            isl_schedule_node_extension);
+  auto node = band(reversed, splice(kept)).replace(root.child(0));
+  ASSERT_TRUE(node.get());
+  ASSERT_EQ(isl_schedule_node_get_type(node.get()), isl_schedule_node_band);
+  EXPECT_TRUE(node.band_get_partial_schedule_union_map().is_equal(
+      isl::union_map::from(reversed)));
+  auto extensionNode = node.child(0);
+  ASSERT_EQ(isl_schedule_node_get_type(extensionNode.get()),
+            isl_schedule_node_extension);
+  EXPECT_TRUE(extensionNode.extension_get_extension().is_equal(
+      kept.extension_get_extension()));
+  EXPECT_EQ(extensionNode.child(0).n_children(), 2);
+
+  ctx.release();
+}
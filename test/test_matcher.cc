@@ -1,10 +1,18 @@
 #include <islutils/builders.h>
 #include <islutils/ctx.h>
+#include <islutils/fingerprint.h>
+#include <islutils/match_iterator.h>
 #include <islutils/matchers.h>
 #include <islutils/pet_wrapper.h>
+#include <islutils/schedule_cursor.h>
+#include <islutils/schedule_index.h>
+#include <islutils/typed_matchers.h>
 
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <thread>
+
 using util::ScopedCtx;
 
 TEST(TreeMatcher, ReadFromFile) {
@@ -217,3 +225,517 @@ TEST(TreeMatcher, AnyForestCapture) {
   EXPECT_TRUE(captures[0].is_equal(first));
   EXPECT_TRUE(captures[1].is_equal(second));
 }
+
+TEST(TreeMatcher, CompiledMatchesLikeInterpreted) {
+  using namespace matchers;
+  // clang-format off
+  std::vector<ScheduleNodeMatcher> matchers = {
+    band(
+      sequence(
+        filter(
+          leaf()),
+        filter(
+          band(
+            leaf())))),
+    band(
+      sequence(
+        anyForest())),
+    band(
+      sequence(
+        filter(
+          leaf()))),
+    band(
+      sequence(
+        filter(
+          anyTree()),
+        filter(
+          band(
+            band(
+              leaf()))))),
+    band([](isl::schedule_node n) { return false; },
+      anyTree()),
+    domain(
+      anyTree())};
+  // clang-format on
+
+  auto node = makeGemmTree();
+  for (const auto &m : matchers) {
+    CompiledMatcher compiled(m);
+    EXPECT_EQ(CompiledMatcher::isMatching(compiled, node.child(0)),
+              ScheduleNodeMatcher::isMatching(m, node.child(0)));
+    EXPECT_EQ(CompiledMatcher::isMatching(compiled, node),
+              ScheduleNodeMatcher::isMatching(m, node));
+  }
+}
+
+TEST(TreeMatcher, CompiledCapture) {
+  using namespace matchers;
+  isl::schedule_node outer, first, second, inner;
+  std::vector<isl::schedule_node> captures;
+
+  // clang-format off
+  auto matcher =
+    band(outer,
+      sequence(
+        filter(first,
+          leaf()),
+        filter(second,
+          band(inner,
+            anyForest(captures)))));
+  // clang-format on
+
+  auto node = makeGemmTree();
+  CompiledMatcher compiled(matcher);
+  EXPECT_EQ(compiled.size(), 7u);
+  ASSERT_TRUE(CompiledMatcher::isMatching(compiled, node.child(0)));
+
+  EXPECT_TRUE(outer.is_equal(node.child(0)));
+  EXPECT_TRUE(first.is_equal(node.child(0).child(0).child(0)));
+  EXPECT_TRUE(second.is_equal(node.child(0).child(0).child(1)));
+  EXPECT_TRUE(inner.is_equal(node.child(0).child(0).child(1).child(0)));
+  ASSERT_EQ(captures.size(), 1u);
+  EXPECT_EQ(isl_schedule_node_get_type(captures[0].get()),
+            isl_schedule_node_leaf);
+}
+
+TEST(TreeMatcher, MatcherSetSingleTraversal) {
+  using namespace matchers;
+  // clang-format off
+  MatcherSet set(
+    band(anyTree()),
+    filter(leaf()),
+    sequence(
+      filter(anyTree()),
+      filter(anyTree())),
+    leaf(),
+    anyTree(),
+    mark(anyTree()));
+  // clang-format on
+  ASSERT_EQ(set.size(), 6u);
+
+  auto node = makeGemmTree();
+  auto anchors = set.findAll(node);
+  ASSERT_EQ(anchors.size(), 6u);
+  ASSERT_EQ(anchors[0].size(), 2u);
+  EXPECT_TRUE(anchors[0][0].is_equal(node.child(0)));
+  EXPECT_TRUE(anchors[0][1].is_equal(node.child(0).child(0).child(1).child(0)));
+  ASSERT_EQ(anchors[1].size(), 1u);
+  EXPECT_TRUE(anchors[1][0].is_equal(node.child(0).child(0).child(0)));
+  ASSERT_EQ(anchors[2].size(), 1u);
+  EXPECT_TRUE(anchors[2][0].is_equal(node.child(0).child(0)));
+  EXPECT_EQ(anchors[3].size(), 2u);
+  EXPECT_EQ(anchors[4].size(), 8u);
+  EXPECT_TRUE(anchors[5].empty());
+
+  // Traversal does not leave the given subtree.
+  anchors = set.findAll(node.child(0).child(0).child(1));
+  EXPECT_EQ(anchors[0].size(), 1u);
+  EXPECT_TRUE(anchors[1].empty());
+  EXPECT_EQ(anchors[4].size(), 3u);
+}
+
+TEST(TreeMatcher, ScheduleTreeIndex) {
+  using namespace matchers;
+  auto node = makeGemmTree();
+  ScheduleTreeIndex index(node);
+  ASSERT_EQ(index.size(), 8u);
+
+  auto typeBit = ScheduleTreeIndex::typeBit;
+  const auto &root = index[0];
+  EXPECT_EQ(root.type, isl_schedule_node_domain);
+  EXPECT_EQ(root.subtreeEnd, 8u);
+  EXPECT_EQ(root.ancestorTypes, 0u);
+  EXPECT_TRUE(root.subtreeTypes & typeBit(isl_schedule_node_sequence));
+  EXPECT_FALSE(root.subtreeTypes & typeBit(isl_schedule_node_mark));
+
+  auto innerBand = node.child(0).child(0).child(1).child(0);
+  const auto &inner = index[index.find(innerBand)];
+  EXPECT_EQ(inner.type, isl_schedule_node_band);
+  EXPECT_EQ(inner.depth, 4);
+  EXPECT_EQ(inner.nChildren, 1);
+  EXPECT_EQ(inner.subtreeTypes,
+            typeBit(isl_schedule_node_band) | typeBit(isl_schedule_node_leaf));
+  EXPECT_TRUE(inner.ancestorTypes & typeBit(isl_schedule_node_filter));
+
+  // The indexed callbacks agree with the traversing ones on every node.
+  // clang-format off
+  std::vector<std::pair<std::function<bool(isl::schedule_node)>,
+                        std::function<bool(isl::schedule_node)>>> callbacks = {
+    {hasDescendant(band(leaf())), hasDescendant(index, band(leaf()))},
+    {hasDescendant(mark(anyTree())), hasDescendant(index, mark(anyTree()))},
+    {hasDescendant(filter(band(leaf()))),
+     hasDescendant(index, filter(band(leaf())))},
+    {hasAncestor(sequence(anyForest())), hasAncestor(index, sequence(anyForest()))},
+    {hasAncestor(band(sequence(anyForest()))),
+     hasAncestor(index, band(sequence(anyForest())))},
+    {hasAncestor(mark(anyTree())), hasAncestor(index, mark(anyTree()))}};
+  // clang-format on
+  MatcherSet all(anyTree());
+  auto nodes = all.findAll(node).front();
+  ASSERT_EQ(nodes.size(), 8u);
+  for (const auto &callbackPair : callbacks) {
+    for (const auto &n : nodes) {
+      EXPECT_EQ(callbackPair.first(n), callbackPair.second(n));
+    }
+  }
+  EXPECT_TRUE(callbacks[0].second(node));
+  EXPECT_FALSE(callbacks[0].second(node.child(0).child(0).child(0)));
+  EXPECT_TRUE(callbacks[3].second(innerBand));
+  EXPECT_FALSE(callbacks[3].second(node.child(0)));
+}
+
+TEST(TreeMatcher, Fingerprints) {
+  using namespace matchers;
+  auto node = makeGemmTree();
+  auto fingerprints = computeFingerprints(node.get_schedule());
+  ASSERT_EQ(fingerprints.size(), 8u);
+  EXPECT_EQ(fingerprints[1].shape, shapeFingerprint(node.child(0)));
+  // Both leaves have the same shape and subtree.
+  EXPECT_EQ(fingerprints[4].subtree, fingerprints[7].subtree);
+  EXPECT_NE(fingerprints[0].subtree, fingerprints[1].subtree);
+
+  EXPECT_EQ(band(anyTree()).shapeFingerprint(), fingerprints[1].shape);
+  EXPECT_EQ(anyTree().shapeFingerprint(), 0u);
+  EXPECT_EQ(sequence(anyForest()).shapeFingerprint(), 0u);
+  EXPECT_EQ(optional(band(anyTree())).shapeFingerprint(), 0u);
+  EXPECT_EQ(oneOrMore(band(anyTree())).shapeFingerprint(), 0u);
+  EXPECT_TRUE(ScheduleNodeMatcher::isMatching(band(anyTree()), node.child(0),
+                                              fingerprints[1].shape));
+  EXPECT_FALSE(ScheduleNodeMatcher::isMatching(band(anyTree()), node.child(0),
+                                               fingerprints[2].shape));
+  CompiledMatcher compiled(band(anyTree()));
+  EXPECT_FALSE(CompiledMatcher::isMatching(compiled, node.child(0),
+                                           fingerprints[2].shape));
+
+  // Only the fingerprints that cover the contents of the modified band and
+  // of its ancestors change.
+  auto innerBand = node.child(0).child(0).child(1).child(0);
+  auto modified = innerBand.band_set_permutable(1);
+  auto before = computeFingerprints(node.get_schedule(), true);
+  auto after = computeFingerprints(modified.get_schedule(), true);
+  auto afterShape = computeFingerprints(modified.get_schedule());
+  ASSERT_EQ(after.size(), 8u);
+  for (size_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(fingerprints[i].subtree, afterShape[i].subtree);
+  }
+  EXPECT_EQ(before[3].subtree, after[3].subtree);
+  EXPECT_EQ(before[7].subtree, after[7].subtree);
+  EXPECT_NE(before[6].node, after[6].node);
+  EXPECT_NE(before[0].subtree, after[0].subtree);
+  EXPECT_EQ(subtreeFingerprint(modified, true), after[6].subtree);
+}
+
+TEST(TreeMatcher, MatchResultByLabel) {
+  using namespace matchers;
+  isl::schedule_node captured;
+  std::vector<isl::schedule_node> capturedForest;
+  // clang-format off
+  auto matcher =
+    labeled("outer",
+      band(captured,
+        sequence(
+          labeled("first", filter(leaf())),
+          filter(
+            labeled("inner", band(labeled("rest", anyForest(capturedForest))))))));
+  // clang-format on
+
+  auto node = makeGemmTree();
+  auto result = ScheduleNodeMatcher::match(matcher, node.child(0));
+  ASSERT_TRUE(static_cast<bool>(result));
+  EXPECT_TRUE(result["outer"].is_equal(node.child(0)));
+  EXPECT_TRUE(result["first"].is_equal(node.child(0).child(0).child(0)));
+  EXPECT_TRUE(
+      result["inner"].is_equal(node.child(0).child(0).child(1).child(0)));
+  ASSERT_EQ(result.forest("rest").size(), 1u);
+  EXPECT_FALSE(result.has("null"));
+  // Capture variables are left untouched.
+  EXPECT_TRUE(captured.is_null());
+  EXPECT_TRUE(capturedForest.empty());
+
+  EXPECT_FALSE(static_cast<bool>(ScheduleNodeMatcher::match(matcher, node)));
+}
+
+TEST(TreeMatcher, MatchResultConcurrent) {
+  using namespace matchers;
+  // clang-format off
+  const auto matcher =
+    sequence(
+      labeled("first", filter(leaf())),
+      labeled("second", filter(band(leaf()))));
+  // clang-format on
+
+  // Each thread uses its own isl context and the same matcher.
+  std::vector<int> found(4, 0);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < found.size(); ++t) {
+    threads.emplace_back([&matcher, &found, t]() {
+      auto node = makeGemmTree();
+      for (int i = 0; i < 100; ++i) {
+        auto result =
+            ScheduleNodeMatcher::match(matcher, node.child(0).child(0));
+        if (result && result["second"].is_equal(
+                          node.child(0).child(0).child(1))) {
+          ++found[t];
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (auto count : found) {
+    EXPECT_EQ(count, 100);
+  }
+}
+
+TEST(TreeMatcher, MatchIterator) {
+  using namespace matchers;
+  auto node = makeGemmTree();
+  auto innerBand = node.child(0).child(0).child(1).child(0);
+
+  std::vector<isl::schedule_node> preorder, postorder;
+  for (const auto &n : matches(anyTree(), node)) {
+    preorder.push_back(n);
+  }
+  for (const auto &n : matches(anyTree(), node, TraversalOrder::Postorder)) {
+    postorder.push_back(n);
+  }
+  ASSERT_EQ(preorder.size(), 8u);
+  ASSERT_EQ(postorder.size(), 8u);
+  EXPECT_TRUE(preorder.front().is_equal(node));
+  EXPECT_TRUE(preorder.back().is_equal(innerBand.child(0)));
+  EXPECT_TRUE(postorder.front().is_equal(node.child(0).child(0).child(0).child(0)));
+  EXPECT_TRUE(postorder.back().is_equal(node));
+
+  EXPECT_TRUE(findFirst(band(anyTree()), node).is_equal(node.child(0)));
+  EXPECT_TRUE(findFirst(band(anyTree()), node, TraversalOrder::Postorder)
+                  .is_equal(innerBand));
+  EXPECT_TRUE(findFirst(mark(anyTree()), node).is_null());
+  EXPECT_EQ(count(band(anyTree()), node), 2u);
+  EXPECT_EQ(count(leaf(), node.child(0).child(0).child(1)), 1u);
+  EXPECT_TRUE(any(filter(leaf()), node));
+  EXPECT_FALSE(any(mark(anyTree()), node));
+
+  // The traversal stops at the first match.
+  int visited = 0;
+  auto counting = [&visited](isl::schedule_node) {
+    ++visited;
+    return true;
+  };
+  EXPECT_TRUE(any(band(counting, anyTree()), node));
+  EXPECT_EQ(visited, 1);
+}
+
+TEST(TreeMatcher, TypedMatchers) {
+  using namespace matchers;
+  isl::schedule_node outer, inner;
+  std::vector<isl::schedule_node> children;
+  // clang-format off
+  auto typedMatcher =
+    typed::band(outer,
+      typed::sequence(
+        typed::filter(typed::leaf()),
+        typed::filter(
+          typed::band(inner, typed::anyForest(children)))));
+  // clang-format on
+
+  auto node = makeGemmTree();
+  EXPECT_TRUE(typed::isMatching(typedMatcher, node.child(0)));
+  EXPECT_TRUE(outer.is_equal(node.child(0)));
+  EXPECT_TRUE(inner.is_equal(node.child(0).child(0).child(1).child(0)));
+  EXPECT_EQ(children.size(), 1u);
+  EXPECT_FALSE(typed::isMatching(typedMatcher, node));
+  EXPECT_FALSE(typed::isMatching(typed::band(typed::leaf()), node.child(0)));
+  EXPECT_TRUE(typed::isMatching(typed::sequence(typed::anyForest()),
+                                node.child(0).child(0)));
+
+  // Conversion to the type-erased matcher keeps the structure and captures.
+  outer = isl::schedule_node();
+  ScheduleNodeMatcher erased = typedMatcher;
+  EXPECT_TRUE(ScheduleNodeMatcher::isMatching(erased, node.child(0)));
+  EXPECT_TRUE(outer.is_equal(node.child(0)));
+  EXPECT_FALSE(ScheduleNodeMatcher::isMatching(erased, node));
+
+  // Combinators stop at the first decisive callback.
+  int calls = 0;
+  auto yes = [&calls](isl::schedule_node) {
+    ++calls;
+    return true;
+  };
+  auto no = [&calls](isl::schedule_node) {
+    ++calls;
+    return false;
+  };
+  auto callbackMatcher =
+      typed::band(typed::allOf(yes, typed::anyOf(yes, no)), typed::anyTree());
+  EXPECT_TRUE(typed::isMatching(callbackMatcher, node.child(0)));
+  EXPECT_EQ(calls, 2);
+  calls = 0;
+  EXPECT_FALSE(typed::isMatching(
+      typed::band(typed::allOf(no, yes), typed::anyTree()), node.child(0)));
+  EXPECT_EQ(calls, 1);
+  ScheduleNodeMatcher erasedCallback = callbackMatcher;
+  EXPECT_TRUE(ScheduleNodeMatcher::isMatching(erasedCallback, node.child(0)));
+}
+
+// Sequence of six filters over S0 to S5, where the filters over S2 and S4
+// have a band child and the others are leaves.
+static isl::schedule_node makeFusedTree() {
+  using namespace builders;
+  auto ctx = isl::ctx(isl_ctx_alloc());
+  auto iterationDomain =
+      isl::union_set(ctx, "{S0[i]: 0 <= i < 10; S1[i]: 0 <= i < 10; "
+                          "S2[i]: 0 <= i < 10; S3[i]: 0 <= i < 10; "
+                          "S4[i]: 0 <= i < 10; S5[i]: 0 <= i < 10}");
+  auto filterOf = [ctx](int i) {
+    return isl::union_set(ctx, "{S" + std::to_string(i) + "[i]}");
+  };
+  auto sched2 = isl::multi_union_pw_aff(ctx, "[{S2[i]->[(i)]}]");
+  auto sched4 = isl::multi_union_pw_aff(ctx, "[{S4[i]->[(i)]}]");
+
+  // clang-format off
+  auto builder =
+    domain(iterationDomain,
+      sequence(
+        filter(filterOf(0)),
+        filter(filterOf(1)),
+        filter(filterOf(2), band(sched2)),
+        filter(filterOf(3)),
+        filter(filterOf(4), band(sched4)),
+        filter(filterOf(5))));
+  // clang-format on
+
+  return builder.build().child(0);
+}
+
+TEST(TreeMatcher, ChildListPatterns) {
+  using namespace matchers;
+  auto node = makeFusedTree();
+
+  isl::schedule_node first, second;
+  std::vector<isl::schedule_node> before, between, after;
+  int calls = 0;
+  auto counting = [&calls](isl::schedule_node) {
+    ++calls;
+    return true;
+  };
+  // clang-format off
+  auto twoBands =
+    sequence(
+      anyForest(before),
+      filter(counting, first, band(anyTree())),
+      anyForest(between),
+      filter(second, band(anyTree())),
+      anyForest(after));
+  // clang-format on
+  ASSERT_TRUE(ScheduleNodeMatcher::isMatching(twoBands, node));
+  EXPECT_TRUE(first.is_equal(node.child(2)));
+  EXPECT_TRUE(second.is_equal(node.child(4)));
+  EXPECT_EQ(before.size(), 2u);
+  EXPECT_EQ(between.size(), 1u);
+  EXPECT_EQ(after.size(), 1u);
+  // Each child is checked at most once, plus once more to capture.
+  EXPECT_LE(calls, 7);
+
+  // clang-format off
+  auto withOptional =
+    sequence(
+      filter(leaf()),
+      optional(filter(leaf())),
+      filter(band(leaf())),
+      zeroOrMore(filter(anyTree())));
+  // clang-format on
+  EXPECT_TRUE(ScheduleNodeMatcher::isMatching(withOptional, node));
+  EXPECT_TRUE(ScheduleNodeMatcher::isMatching(
+      sequence(oneOrMore(filter(anyTree()))), node));
+  EXPECT_FALSE(ScheduleNodeMatcher::isMatching(
+      sequence(oneOrMore(filter(leaf()))), node));
+  EXPECT_TRUE(ScheduleNodeMatcher::isMatching(
+      sequence(filter(leaf()), optional(filter(band(leaf()))), anyForest()),
+      node));
+  EXPECT_FALSE(ScheduleNodeMatcher::isMatching(
+      sequence(filter(band(anyTree())), anyForest()), node));
+  EXPECT_FALSE(ScheduleNodeMatcher::isMatching(
+      sequence(anyForest(), filter(band(leaf())), filter(band(leaf())),
+               anyForest()),
+      node));
+  EXPECT_EQ(withOptional.shapeFingerprint(), 0u);
+
+  // Compiled matchers delegate such lists to the matcher above.
+  first = isl::schedule_node();
+  CompiledMatcher compiled(domain(ScheduleNodeMatcher(twoBands)));
+  EXPECT_TRUE(CompiledMatcher::isMatching(compiled, node.parent()));
+  EXPECT_TRUE(first.is_equal(node.child(2)));
+  EXPECT_EQ(compiled.height(), 5u);
+  MatcherSet set(twoBands, withOptional);
+  auto anchors = set.findAll(node.parent());
+  EXPECT_EQ(anchors[0].size(), 1u);
+  EXPECT_EQ(anchors[1].size(), 1u);
+}
+
+TEST(TreeMatcher, ScheduleTreeCursor) {
+  using namespace matchers;
+  auto node = makeGemmTree();
+  ScheduleTreeIndex index(node);
+  ScheduleTreeCursor root(index);
+
+  auto sequenceCursor = root.child(0).child(0);
+  EXPECT_EQ(sequenceCursor.type(), isl_schedule_node_sequence);
+  EXPECT_EQ(sequenceCursor.nChildren(), 2);
+  auto second = sequenceCursor.child(1);
+  EXPECT_TRUE(second.hasPreviousSibling());
+  EXPECT_FALSE(second.hasNextSibling());
+  EXPECT_EQ(second.previousSibling(), sequenceCursor.child(0));
+  EXPECT_EQ(second.parent(), sequenceCursor);
+  EXPECT_TRUE(second.node().is_equal(node.child(0).child(0).child(1)));
+
+  std::vector<isl_schedule_node_type> types;
+  for (const auto &cursor : preorder(root)) {
+    types.push_back(cursor.type());
+  }
+  std::vector<isl_schedule_node_type> expected = {
+      isl_schedule_node_domain, isl_schedule_node_band,
+      isl_schedule_node_sequence, isl_schedule_node_filter,
+      isl_schedule_node_leaf, isl_schedule_node_filter,
+      isl_schedule_node_band, isl_schedule_node_leaf};
+  EXPECT_EQ(types, expected);
+
+  types.clear();
+  for (const auto &cursor : postorder(sequenceCursor)) {
+    types.push_back(cursor.type());
+  }
+  expected = {isl_schedule_node_leaf, isl_schedule_node_filter,
+              isl_schedule_node_leaf, isl_schedule_node_band,
+              isl_schedule_node_filter, isl_schedule_node_sequence};
+  EXPECT_EQ(types, expected);
+
+  auto all = preorder(root);
+  auto isBand = [](const ScheduleTreeCursor &cursor) {
+    return cursor.type() == isl_schedule_node_band;
+  };
+  EXPECT_EQ(std::count_if(all.begin(), all.end(), isBand), 2);
+  auto post = postorder(root);
+  auto firstBand = std::find_if(post.begin(), post.end(), isBand);
+  ASSERT_TRUE(firstBand != post.end());
+  EXPECT_EQ(firstBand->depth(), 4);
+
+  // Matching on cursors only creates nodes for captures.
+  isl::schedule_node captured;
+  CompiledMatcher matcher(
+      sequence(filter(leaf()), filter(band(captured, leaf()))));
+  EXPECT_TRUE(CompiledMatcher::isMatching(matcher, sequenceCursor));
+  EXPECT_TRUE(captured.is_equal(node.child(0).child(0).child(1).child(0)));
+  EXPECT_FALSE(CompiledMatcher::isMatching(matcher, root));
+  int matches = 0;
+  for (const auto &cursor : preorder(root)) {
+    matches += CompiledMatcher::isMatching(matcher, cursor);
+  }
+  EXPECT_EQ(matches, 1);
+
+  // A capturing anyForest at the root has no siblings to capture.
+  std::vector<isl::schedule_node> forest;
+  CompiledMatcher rootForest(anyForest(forest));
+  EXPECT_TRUE(CompiledMatcher::isMatching(rootForest, root));
+  ASSERT_EQ(forest.size(), 1u);
+  EXPECT_TRUE(forest[0].is_equal(node));
+}
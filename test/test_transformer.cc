@@ -10,6 +10,7 @@
 #include <islutils/pet_wrapper.h>
 #include <islutils/aff_op.h>
 #include <islutils/access.h>
+#include <islutils/rewriter.h>
 #include <thread>
 #include <fstream>
 
@@ -1483,6 +1484,169 @@ TEST(Transformer, Capture) {
   node.dump();
 }
 
+TEST(Transformer, RewriterMergesBandsToFixpoint) {
+  auto ctx = ScopedCtx(isl_ctx_alloc());
+  auto node = [&]() {
+    using namespace builders;
+    auto iterationDomain =
+        isl::union_set(ctx, "{S[i,j,k]: 0 <= i,j,k < 10}");
+    auto schedI = isl::multi_union_pw_aff(ctx, "[{S[i,j,k]->[(i)]}]");
+    auto schedJ = isl::multi_union_pw_aff(ctx, "[{S[i,j,k]->[(j)]}]");
+    auto schedK = isl::multi_union_pw_aff(ctx, "[{S[i,j,k]->[(k)]}]");
+    // clang-format off
+    auto builder =
+      domain(iterationDomain,
+        band(schedI,
+          band(schedJ,
+            band(schedK))));
+    // clang-format on
+    return builder.build();
+  }();
+
+  isl::schedule_node parent, child, grandchild;
+  auto matcher = [&]() {
+    using namespace matchers;
+    // clang-format off
+    return band(parent,
+             band(child,
+               anyTree(grandchild)));
+    // clang-format on
+  }();
+  auto merger = builders::ScheduleNodeBuilder();
+  {
+    using namespace builders;
+    auto schedule = [&]() {
+      return parent.band_get_partial_schedule().flat_range_product(
+          child.band_get_partial_schedule());
+    };
+    auto st = [&]() { return subtreeBuilder(grandchild); };
+    merger = band(schedule, subtree(st));
+  }
+
+  rewriters::Rewriter rewriter;
+  auto rule = rewriter.addRule("merge-bands", matcher, std::move(merger));
+  node = rewriter.rewrite(node);
+
+  EXPECT_TRUE(rewriter.reachedFixpoint());
+  EXPECT_FALSE(rewriter.detectedCycle());
+  EXPECT_EQ(rewriter.iterations(), 2u);
+  EXPECT_EQ(rewriter.statistics().at(rule).rewrites, 2u);
+  using namespace matchers;
+  EXPECT_TRUE(ScheduleNodeMatcher::isMatching(domain(band(leaf())), node));
+  EXPECT_EQ(node.child(0).band_get_partial_schedule().dim(isl::dim::set), 3u);
+}
+
+TEST(Transformer, RewriterDetectsCycles) {
+  auto ctx = ScopedCtx(isl_ctx_alloc());
+  auto schedI = isl::multi_union_pw_aff(ctx, "[{S[i,j]->[(i)]}]");
+  auto schedJ = isl::multi_union_pw_aff(ctx, "[{S[i,j]->[(j)]}]");
+  auto node = [&]() {
+    using namespace builders;
+    auto iterationDomain = isl::union_set(ctx, "{S[i,j]: 0 <= i,j < 10}");
+    return domain(iterationDomain, band(schedI)).build();
+  }();
+
+  auto hasSchedule = [](isl::multi_union_pw_aff schedule) {
+    return [schedule](isl::schedule_node node) {
+      return node.band_get_partial_schedule_union_map().is_equal(
+          isl::union_map::from(schedule));
+    };
+  };
+  auto matcherI = [&]() {
+    using namespace matchers;
+    return band(hasSchedule(schedI), leaf());
+  }();
+  auto matcherJ = [&]() {
+    using namespace matchers;
+    return band(hasSchedule(schedJ), leaf());
+  }();
+
+  // The two rules undo each other.
+  rewriters::Rewriter rewriter;
+  rewriter.addRule("i-to-j", matcherI, builders::band(schedJ));
+  rewriter.addRule("j-to-i", matcherJ, builders::band(schedI));
+  node = rewriter.rewrite(node);
+
+  EXPECT_TRUE(rewriter.reachedFixpoint());
+  EXPECT_TRUE(rewriter.detectedCycle());
+  EXPECT_EQ(rewriter.iterations(), 1u);
+  EXPECT_TRUE(hasSchedule(schedJ)(node.child(0)));
+}
+
+// A rewrite of an ancestor changes the region designated by the paths below
+// it, so a rewrite seen there before is not a cycle anymore.
+TEST(Transformer, RewriterForgetsStatesBelowRewrites) {
+  auto ctx = ScopedCtx(isl_ctx_alloc());
+  auto markId = [&ctx](const char *name) {
+    return isl::id::alloc(ctx, name, nullptr);
+  };
+  auto node = [&]() {
+    using namespace builders;
+    auto iterationDomain = isl::union_set(ctx, "{S[i]: 0 <= i < 10}");
+    return domain(iterationDomain, mark(markId("m1"), mark(markId("m2"))))
+        .build();
+  }();
+
+  auto named = [](const char *name) {
+    return [name](isl::schedule_node node) {
+      return node.mark_get_id().get_name() == name;
+    };
+  };
+  auto renameInner = [&]() {
+    using namespace matchers;
+    return mark(named("m2"), leaf());
+  }();
+  auto renameOuter = [&]() {
+    using namespace matchers;
+    return mark(named("m1"), mark(named("m3"), leaf()));
+  }();
+
+  // The second rule restores "m2" below a different outer mark, which the
+  // first rule renames again.
+  rewriters::Rewriter rewriter;
+  rewriter.addRule("m2-to-m3", renameInner, builders::mark(markId("m3")));
+  rewriter.addRule("m1-to-m0", renameOuter,
+                   builders::mark(markId("m0"), builders::mark(markId("m2"))));
+  node = rewriter.rewrite(node);
+
+  EXPECT_TRUE(rewriter.reachedFixpoint());
+  EXPECT_FALSE(rewriter.detectedCycle());
+  EXPECT_EQ(rewriter.iterations(), 3u);
+  EXPECT_EQ(node.child(0).mark_get_id().get_name(), "m0");
+  EXPECT_EQ(node.child(0).child(0).mark_get_id().get_name(), "m3");
+}
+
+// Rebuilding equal nodes is not a change, even if isl represents them
+// differently.
+TEST(Transformer, RewriterIgnoresEqualReplacements) {
+  auto ctx = ScopedCtx(isl_ctx_alloc());
+  auto all = isl::union_set(ctx, "{S[i]}");
+  auto node = [&]() {
+    using namespace builders;
+    auto iterationDomain = isl::union_set(ctx, "{S[i]: 0 <= i < 10}");
+    return domain(iterationDomain, filter(all)).build();
+  }();
+
+  auto matcher = [&]() {
+    using namespace matchers;
+    return filter(
+        [all](isl::schedule_node node) {
+          return node.filter_get_filter().is_equal(all);
+        },
+        leaf());
+  }();
+  rewriters::Rewriter rewriter;
+  auto rule = rewriter.addRule(
+      "split-filter", matcher,
+      builders::filter(isl::union_set(ctx, "{S[i]: i < 5 or i >= 5}")));
+  rewriter.rewrite(node);
+
+  EXPECT_TRUE(rewriter.reachedFixpoint());
+  EXPECT_FALSE(rewriter.detectedCycle());
+  EXPECT_EQ(rewriter.iterations(), 0u);
+  EXPECT_EQ(rewriter.statistics().at(rule).rewrites, 0u);
+}
+
 TEST(schedule, MergeBandsCallLambda) {
 
   auto ctx = ScopedCtx(pet::allocCtx());
@@ -1790,27 +1954,18 @@ static bool canSink(isl::schedule_node band) {
 // pluto-style sinking
 // assuming access relations with tags in the range
 static int findSinkable(isl::union_map accesses, isl::schedule_node band) {
-  auto schedule = band.band_get_partial_schedule();
-  auto nDim = schedule.dim(isl::dim::set);
-  auto ctx = accesses.get_ctx();
+  auto profile = matchers::StrideProfile(band, accesses);
+  auto nDim = profile.nDims();
 
   std::vector<int64_t> weights;
   weights.reserve(nDim);
-  for (unsigned i = 0; i < nDim; ++i) {
-
-    auto schedule1D = schedule.get_union_pw_aff(i);
-    auto scheduleMap1D = isl::union_map::from_union_pw_aff(schedule1D);
-    auto scheduledAccess = accesses.apply_domain(scheduleMap1D);
-
-    using namespace matchers;
-    int nRepeated =
-        match(scheduledAccess, allOf(access(dim(-1, stride(ctx, 0))))).size();
+  for (int i = 0; i < nDim; ++i) {
+    int nRepeated = profile.count(i, 0);
     int nLocal = 0;
     for (int s = 1; s <= 4; ++s) {
-      nLocal +=
-          match(scheduledAccess, allOf(access(dim(-1, stride(ctx, s))))).size();
+      nLocal += profile.count(i, s);
     }
-    int nAccesses = scheduledAccess.n_map();
+    int nAccesses = profile.nAccessed(i);
     int nNonLocal = nAccesses - nRepeated - nLocal;
     bool isVectorizable = nNonLocal == 0;
 
@@ -1877,6 +2032,28 @@ TEST(Transformer, SinkLocal) {
   EXPECT_TRUE(node.get_schedule().get_map().is_subset(expected));
 }
 
+// Check that every statement of the scop can be found by the identifier of its
+// domain, and that unknown identifiers are not found.
+TEST(Transformer, ScopStatementLookup) {
+  auto ctx = ScopedCtx(pet::allocCtx());
+  auto petScop = pet::Scop::parseFile(ctx, "inputs/doubleStmtGemm.c");
+  auto domain = petScop.getScop().domain();
+
+  int nStatements = 0;
+  domain.foreach_set([&](isl::set set) {
+    auto id = set.get_tuple_id();
+    auto statement = petScop.stmt(id);
+    EXPECT_NE(statement, nullptr);
+    if (statement) {
+      EXPECT_TRUE(isl::manage_copy(statement->domain).get_tuple_id() == id);
+    }
+    ++nStatements;
+    return isl_stat_ok;
+  });
+  EXPECT_EQ(nStatements, petScop.get()->n_stmt);
+  EXPECT_EQ(petScop.stmt(isl::id::alloc(ctx, "unknown", nullptr)), nullptr);
+}
+
 // Check that all relevant parts of the code (loops and transformed statements)
 // are correctly generated.  In particular, check that loops are generated in
 // the right order.  Whitespace is ignored.
@@ -2398,11 +2575,12 @@ TEST(Transformer, HenrettyDLTJacobi) {
     auto arr = arrayPlaceholder();
     auto i = placeholder(ctx);
 
-    auto matches =
-        match(scheduledReads, allOf(access(dim(-1, i - 1)), access(dim(-1, i)),
-                                    access(dim(-1, i + 1))));
+    auto nMatches = matchCount(scheduledReads,
+                               allOf(access(dim(-1, i - 1)), access(dim(-1, i)),
+                                     access(dim(-1, i + 1))),
+                               2);
     node = band;
-    return matches.size() == 1;
+    return nMatches == 1;
   };
 
   auto DLTbuilder = [&]() {